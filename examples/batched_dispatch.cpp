@@ -0,0 +1,110 @@
+// A microbenchmark for the dispatch overhead of a scheduler.  A large
+// number of trivial method requests with ready scheduling guards are
+// queued up behind a request which blocks the dispatcher thread, then the
+// dispatcher is released and the time taken to run them all is measured.
+// Prints the time per method request for various batch sizes set with
+// scheduler_attributes::set_batch_size(), for both in order and out of
+// order activation queues.
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <poet/active_object.hpp>
+#include <vector>
+
+// blocks the dispatcher thread until the gate is opened
+class gate_request: public poet::method_request_base
+{
+public:
+	gate_request(const poet::future<void> &gate): _gate(gate)
+	{}
+	virtual void run()
+	{
+		_gate.get();
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(1);
+	}
+private:
+	poet::future<void> _gate;
+};
+
+class count_request: public poet::method_request_base
+{
+public:
+	count_request(unsigned &counter, unsigned target, const poet::promise<void> &done):
+		_counter(counter), _target(target), _done(done)
+	{}
+	virtual void run()
+	{
+		if(++_counter == _target) _done.fulfill();
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(1);
+	}
+	virtual bool scheduling_guard_complete() const
+	{
+		return true;
+	}
+private:
+	unsigned &_counter;
+	unsigned _target;
+	poet::promise<void> _done;
+};
+
+// returns nanoseconds per method request
+double time_dispatch(const boost::shared_ptr<poet::activation_queue_base> &queue, unsigned batch_size, unsigned num_requests)
+{
+	poet::scheduler_attributes attributes;
+	attributes.set_batch_size(batch_size);
+	poet::scheduler scheduler(queue, attributes);
+
+	poet::promise<void> gate;
+	scheduler.post_method_request(boost::shared_ptr<poet::method_request_base>(new gate_request(gate)));
+	unsigned counter = 0;
+	poet::promise<void> done;
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	requests.reserve(num_requests);
+	unsigned i;
+	for(i = 0; i < num_requests; ++i)
+	{
+		requests.push_back(boost::shared_ptr<poet::method_request_base>(new count_request(counter, num_requests, done)));
+	}
+	for(i = 0; i < num_requests; ++i)
+	{
+		scheduler.post_method_request(requests.at(i));
+	}
+	requests.clear();
+
+	const boost::system_time start = boost::get_system_time();
+	gate.fulfill();
+	poet::future<void>(done).get();
+	const boost::posix_time::time_duration elapsed = boost::get_system_time() - start;
+	return elapsed.total_microseconds() * 1e3 / num_requests;
+}
+
+int main(int argc, const char *argv[])
+{
+	const unsigned num_requests = argc > 1 ? std::atoi(argv[1]) : 1000000;
+	static const unsigned batch_sizes[] = {1, 4, 16, 64};
+
+	std::cout << num_requests << " method requests\n";
+	std::cout << "batch size\tin_order_activation_queue (ns/request)\tout_of_order_activation_queue (ns/request)\n";
+	unsigned i;
+	for(i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++i)
+	{
+		const double in_order = time_dispatch(boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue),
+			batch_sizes[i], num_requests);
+		const double out_of_order = time_dispatch(boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue),
+			batch_sizes[i], num_requests);
+		std::cout << batch_sizes[i] << "\t" << in_order << "\t" << out_of_order << std::endl;
+	}
+	return 0;
+}
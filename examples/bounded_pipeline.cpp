@@ -0,0 +1,74 @@
+// A producer feeds a two stage pipeline of active_functions, where the
+// second stage is much slower than the first.  Each stage has its own
+// scheduler with a bounded_activation_queue, so instead of queuing up
+// an unbounded number of method requests, the producer is slowed down
+// to the speed of the slowest stage.  The first stage's queue simply
+// blocks the producer when it is full.  The second stage's queue fails
+// fast instead, and the producer waits on its space_available() future
+// before each call (a producer which must not block could attach a
+// continuation to the future instead).
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <vector>
+
+static const unsigned queue_capacity = 4;
+
+boost::shared_ptr<poet::bounded_activation_queue> fast_queue(new poet::bounded_activation_queue(
+	boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue), queue_capacity));
+boost::shared_ptr<poet::bounded_activation_queue> slow_queue(new poet::bounded_activation_queue(
+	boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue), queue_capacity,
+	poet::bounded_activation_queue::fail_on_overflow));
+
+int fast_stage(int value)
+{
+	return value * 2;
+}
+
+int slow_stage(int value)
+{
+	boost::this_thread::sleep(boost::posix_time::millisec(50));
+	return value + 1;
+}
+
+int main()
+{
+	static const int num_inputs = 40;
+
+	poet::active_function<int (int)> fast(&fast_stage,
+		boost::shared_ptr<poet::scheduler_base>(new poet::scheduler(fast_queue)));
+	poet::active_function<int (int)> slow(&slow_stage,
+		boost::shared_ptr<poet::scheduler_base>(new poet::scheduler(slow_queue)));
+
+	std::vector<poet::future<int> > results;
+	int i;
+	for(i = 0; i < num_inputs; ++i)
+	{
+		// blocks while the fast stage's queue is full
+		poet::future<int> doubled = fast(i);
+		// we are the only producer, so there is still space when we call slow()
+		slow_queue->space_available().join();
+		results.push_back(slow(doubled));
+		if(i % 10 == 0)
+		{
+			std::cout << "input " << i << ": queue depths " << fast_queue->size() << ", " <<
+				slow_queue->size() << " (capacity " << queue_capacity << ")" << std::endl;
+		}
+	}
+	for(i = 0; i < num_inputs; ++i)
+	{
+		if(results.at(i).get() != i * 2 + 1)
+		{
+			std::cerr << "wrong answer!" << std::endl;
+			return 1;
+		}
+	}
+	std::cout << "processed " << num_inputs << " inputs" << std::endl;
+	return 0;
+}
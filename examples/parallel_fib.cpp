@@ -0,0 +1,118 @@
+// A recursive divide-and-conquer benchmark.  Calculates Fibonacci
+// numbers by splitting each problem into two method requests until the
+// sub-problems are small enough to solve serially.  The method requests
+// for sub-problems are posted from inside the scheduler threads, and
+// the results are combined by a method request whose scheduling guard
+// waits for both halves.  Prints the run time using a work_stealing_scheduler
+// and a thread_pool_scheduler for 1 up to the number of hardware threads.
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <poet/work_stealing_scheduler.hpp>
+
+int serial_fib(int n)
+{
+	if(n < 2) return n;
+	return serial_fib(n - 1) + serial_fib(n - 2);
+}
+
+int add(int a, int b)
+{
+	return a + b;
+}
+
+class fib_request: public poet::method_request_base
+{
+public:
+	fib_request(int n, int cutoff, const poet::promise<int> &result,
+		const boost::shared_ptr<poet::scheduler_base> &scheduler):
+		_n(n), _cutoff(cutoff), _result(result), _scheduler(scheduler)
+	{}
+	virtual void run()
+	{
+		if(_n <= _cutoff)
+		{
+			_result.fulfill(serial_fib(_n));
+			return;
+		}
+		poet::promise<int> a;
+		poet::promise<int> b;
+		_scheduler->post_method_request(boost::shared_ptr<fib_request>(new fib_request(_n - 1, _cutoff, a, _scheduler)));
+		_scheduler->post_method_request(boost::shared_ptr<fib_request>(new fib_request(_n - 2, _cutoff, b, _scheduler)));
+		/* The add request holds its own copy of _result, so the promise stays
+		alive until the sum is available. */
+		_scheduler->post_method_request(boost::shared_ptr<add_request>(new add_request(a, b, _result)));
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(0);
+	}
+private:
+	class add_request: public poet::method_request_base
+	{
+	public:
+		add_request(const poet::future<int> &a, const poet::future<int> &b, const poet::promise<int> &result):
+			_a(a), _b(b), _result(result)
+		{}
+		virtual void run()
+		{
+			_result.fulfill(add(_a, _b));
+		}
+		virtual poet::future<void> scheduling_guard() const
+		{
+			return poet::future_barrier(_a, _b);
+		}
+	private:
+		poet::future<int> _a;
+		poet::future<int> _b;
+		poet::promise<int> _result;
+	};
+
+	int _n;
+	int _cutoff;
+	poet::promise<int> _result;
+	boost::shared_ptr<poet::scheduler_base> _scheduler;
+};
+
+double time_fib(const boost::shared_ptr<poet::scheduler_base> &scheduler, int n, int cutoff)
+{
+	const boost::system_time start = boost::get_system_time();
+	poet::promise<int> result;
+	scheduler->post_method_request(boost::shared_ptr<fib_request>(new fib_request(n, cutoff, result, scheduler)));
+	const int value = poet::future<int>(result).get();
+	const boost::posix_time::time_duration elapsed = boost::get_system_time() - start;
+	if(value != serial_fib(n))
+	{
+		std::cerr << "wrong answer!" << std::endl;
+		std::exit(1);
+	}
+	return elapsed.total_microseconds() / 1e6;
+}
+
+int main(int argc, const char *argv[])
+{
+	const int n = argc > 1 ? std::atoi(argv[1]) : 32;
+	const int cutoff = argc > 2 ? std::atoi(argv[2]) : 16;
+	unsigned max_threads = boost::thread::hardware_concurrency();
+	if(max_threads == 0) max_threads = 1;
+
+	std::cout << "fib(" << n << "), serial cutoff " << cutoff << "\n";
+	std::cout << "threads\twork_stealing_scheduler (s)\tthread_pool_scheduler (s)\n";
+	unsigned num_threads;
+	for(num_threads = 1; num_threads <= max_threads; ++num_threads)
+	{
+		boost::shared_ptr<poet::scheduler_base> stealing(new poet::work_stealing_scheduler(num_threads));
+		boost::shared_ptr<poet::scheduler_base> pool(new poet::thread_pool_scheduler(num_threads));
+		const double stealing_time = time_fib(stealing, n, cutoff);
+		const double pool_time = time_fib(pool, n, cutoff);
+		std::cout << num_threads << "\t" << stealing_time << "\t" << pool_time << std::endl;
+	}
+	return 0;
+}
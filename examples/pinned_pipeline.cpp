@@ -0,0 +1,95 @@
+// Compares the throughput of a pipeline of active objects whose
+// scheduler threads are left to float between CPUs against the same
+// pipeline with each stage's thread pinned to its own CPU using
+// scheduler_attributes::set_cpu_set().  Each stage keeps some state
+// which it updates on every call, so a stage whose thread migrates
+// has to drag its state along to the new CPU's cache (or across NUMA
+// nodes on a multi-socket machine).  Optionally takes the number of
+// items to push through the pipeline and the size of each stage's state
+// in doubles.
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <vector>
+
+class stage
+{
+public:
+	stage(unsigned state_size): _state(state_size, 1.0)
+	{}
+	double process(double value)
+	{
+		std::vector<double>::iterator it;
+		for(it = _state.begin(); it != _state.end(); ++it)
+		{
+			*it = *it * 0.5 + value;
+			value += *it * 1e-6;
+		}
+		return value;
+	}
+private:
+	std::vector<double> _state;
+};
+
+static const unsigned num_stages = 4;
+
+// returns items per second
+double time_pipeline(bool pinned, unsigned num_items, unsigned state_size)
+{
+	unsigned num_cpus = boost::thread::hardware_concurrency();
+	if(num_cpus == 0) num_cpus = 1;
+
+	std::vector<boost::shared_ptr<stage> > stages;
+	std::vector<poet::active_function<double (double)> > functions;
+	unsigned i;
+	for(i = 0; i < num_stages; ++i)
+	{
+		poet::scheduler_attributes attributes;
+		if(pinned) attributes.set_cpu_set(std::vector<unsigned>(1, i % num_cpus));
+		boost::shared_ptr<poet::scheduler_base> scheduler(new poet::scheduler(
+			boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue), attributes));
+		stages.push_back(boost::shared_ptr<stage>(new stage(state_size)));
+		functions.push_back(poet::active_function<double (double)>(
+			boost::bind(&stage::process, stages.back().get(), _1), scheduler));
+	}
+
+	const boost::system_time start = boost::get_system_time();
+	std::vector<poet::future<double> > results;
+	results.reserve(num_items);
+	for(i = 0; i < num_items; ++i)
+	{
+		poet::future<double> value = static_cast<double>(i);
+		unsigned j;
+		for(j = 0; j < num_stages; ++j)
+		{
+			value = functions.at(j)(value);
+		}
+		results.push_back(value);
+	}
+	for(i = 0; i < num_items; ++i)
+	{
+		results.at(i).join();
+	}
+	const boost::posix_time::time_duration elapsed = boost::get_system_time() - start;
+	return num_items / (elapsed.total_microseconds() / 1e6);
+}
+
+int main(int argc, const char *argv[])
+{
+	const unsigned num_items = argc > 1 ? std::atoi(argv[1]) : 20000;
+	const unsigned state_size = argc > 2 ? std::atoi(argv[2]) : 16384;
+
+	std::cout << num_stages << " stage pipeline, " << num_items << " items, " <<
+		state_size * sizeof(double) << " bytes of state per stage\n";
+	std::cout << "unpinned: " << time_pipeline(false, num_items, state_size) << " items/s\n";
+	std::cout << "pinned:   " << time_pipeline(true, num_items, state_size) << " items/s" << std::endl;
+	return 0;
+}
@@ -13,6 +13,8 @@
 #ifndef _POET_ACTIVE_FUNCTION_HPP
 #define _POET_ACTIVE_FUNCTION_HPP
 
+#include <boost/make_shared.hpp>
+#include <boost/optional.hpp>
 #include <boost/preprocessor/arithmetic.hpp>
 #include <boost/preprocessor/cat.hpp>
 #include <boost/preprocessor/iteration.hpp>
@@ -20,11 +22,15 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/signals2/slot.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <boost/tuple/tuple.hpp>
 #include <boost/type_traits.hpp>
 #include <boost/weak_ptr.hpp>
 #include <poet/active_object.hpp>
+#include <poet/detail/recycling_allocator.hpp>
 #include <poet/future.hpp>
 #include <poet/future_barrier.hpp>
+#include <cstddef>
 #include <vector>
 
 #ifndef POET_ACTIVE_FUNCTION_MAX_ARGS
@@ -19,26 +19,255 @@
 #ifndef _POET_ACTIVE_OBJECT_H
 #define _POET_ACTIVE_OBJECT_H
 
+#include <boost/atomic.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
 #include <boost/signals2/signal.hpp>
+#include <boost/weak_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <deque>
+#include <functional>
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
 #include <poet/detail/condition.hpp>
+#include <poet/detail/event_count.hpp>
+#include <poet/detail/intrusive_mpsc_queue.hpp>
+#include <poet/detail/thread_affinity.hpp>
 #include <poet/future.hpp>
 #include <poet/future_select.hpp>
+#include <poet/scheduler_statistics.hpp>
 
 namespace poet
 {
-	class method_request_base
+	namespace detail
+	{
+		class method_request_access;
+		template<typename Key, typename Compare>
+		class ordered_ready_queue;
+	}
+
+	/* A method request may only be queued in one place at a time.  Activation queues and the
+	work_stealing_scheduler link requests through the same hook embedded in the request, so
+	the same request must not be pushed again, anywhere, until it has been taken back out. */
+	class method_request_base: public detail::priority_inheritor
 	{
+		friend class detail::method_request_access;
 	public:
-		method_request_base() {}
+		method_request_base(): _priority(0), _deadline(boost::posix_time::pos_infin) {}
 		virtual ~method_request_base() {}
 		virtual void run() = 0;
 		virtual future<void> scheduling_guard() const = 0;
+		/* Lets activation queues skip building the scheduling guard when it would already
+		be complete.  Override it if the request can tell more cheaply than by calling
+		scheduling_guard(). */
+		virtual bool scheduling_guard_complete() const
+		{
+			const future<void> guard = scheduling_guard();
+			return guard.ready() || guard.has_exception();
+		}
+		/* Used by priority_activation_queue, larger values run first.  Set it before the
+		request is posted, after that it can only be raised with inherit_priority(). */
+		int priority() const
+		{
+			return _priority.load();
+		}
+		void set_priority(int priority)
+		{
+			_priority.store(priority);
+		}
+		/* Raises priority() to at least the given priority, on behalf of a thread waiting
+		for the request's result (see scoped_wait_priority).  If the request is waiting in
+		a priority_activation_queue, it moves up accordingly.  Overrides should also pass
+		the priority on to the requests producing the request's inputs, with
+		detail::inherit_priority().
+		Waiting threads only find the request through the future body of its result, see
+		detail::future_body_untyped_base::set_producer().  That only works for requests whose
+		lifetime is managed with their intrusive reference count, like the ones active_function
+		creates.  A request owned only by a shared_ptr has a count of zero, so it never inherits
+		priority from waiting threads, although it can still be raised by calling this directly. */
+		inline virtual void inherit_priority(int priority);
+		/* Used by keyed_activation_queue, requests with the same ordering key are returned in the
+		order they were pushed.  Requests without a key, the default, are unordered.  Set it before
+		the request is posted. */
+		const boost::optional<std::size_t>& ordering_key() const
+		{
+			return _ordering_key;
+		}
+		void set_ordering_key(const boost::optional<std::size_t> &key)
+		{
+			_ordering_key = key;
+		}
+		/* Used by deadline_activation_queue.  Defaults to positive infinity.  Set it before
+		the request is posted. */
+		const boost::system_time& deadline() const
+		{
+			return _deadline;
+		}
+		void set_deadline(const boost::system_time &deadline)
+		{
+			_deadline = deadline;
+		}
+		/* Set by activation queues which measure how long requests wait in them,
+		when the request is pushed. */
+		const boost::system_time& enqueue_time() const
+		{
+			return _enqueue_time;
+		}
+		void set_enqueue_time(const boost::system_time &enqueue_time)
+		{
+			_enqueue_time = enqueue_time;
+		}
+		/* Called instead of run() by activation queues which decide not to run the
+		request, for example because its deadline has passed.  Should renege on
+		the request's result with the given exception.  Only called if cancellable()
+		returns true. */
+		virtual void cancel(const exception_ptr &)
+		{}
+		/* Activation queues only shed requests which are cancellable, the others are
+		returned to be run even when they are late or overflow their queue.  The default
+		returns false, since the default cancel() can't tell anything waiting on the
+		request's result that it won't run.  Override it to return true along with cancel(). */
+		virtual bool cancellable() const
+		{
+			return false;
+		}
+	protected:
+		/* Whether the thread running the request should lend its priority to the futures it
+		waits on.  Only worth the cost if the priority was set, or raised, or the request was
+		posted to a priority_activation_queue. */
+		bool lends_wait_priority() const
+		{
+			return _priority.load() != 0 || _priority_queue.expired() == false;
+		}
+	private:
+		boost::atomic<int> _priority;
+		boost::optional<std::size_t> _ordering_key;
+		boost::system_time _deadline;
+		boost::system_time _enqueue_time;
+		// lets activation queues link requests together without allocating
+		detail::intrusive_mpsc_hook<method_request_base> _queue_hook;
+		// set by the priority_activation_queue the request is pushed into
+		boost::weak_ptr<detail::ordered_ready_queue<int, std::less<int> > > _priority_queue;
 	};
 
+	namespace detail
+	{
+		class method_request_access
+		{
+		public:
+			static intrusive_mpsc_hook<method_request_base>& hook(method_request_base &request)
+			{
+				return request._queue_hook;
+			}
+			static void set_priority_queue(method_request_base &request,
+				const boost::weak_ptr<ordered_ready_queue<int, std::less<int> > > &queue)
+			{
+				request._priority_queue = queue;
+			}
+		};
+
+		// a shared, already complete future for method requests which never need to wait
+		inline const future<void>& ready_scheduling_guard()
+		{
+			static const future<void> guard = future<int>(1);
+			return guard;
+		}
+
+		class null_method_request: public method_request_base
+		{
+		public:
+			virtual void run() {}
+			virtual future<void> scheduling_guard() const
+			{
+				return future<void>();
+			}
+		};
+
+		/* Holds the hook set by activation_queue_base::set_ready_hook().  It lives next to
+		the ready requests, so the continuations which make requests ready can call it
+		after their activation queue is destroyed. */
+		class ready_hook: boost::noncopyable
+		{
+		public:
+			ready_hook(): _set(false)
+			{}
+			void set(const boost::function<void ()> &hook)
+			{
+				boost::shared_ptr<const boost::function<void ()> > new_hook(new boost::function<void ()>(hook));
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				_hook = new_hook;
+				_set.store(true);
+			}
+			// calls the hook, if one was set
+			void operator()() const
+			{
+				if(_set.load() == false) return;
+				boost::shared_ptr<const boost::function<void ()> > hook;
+				{
+					boost::unique_lock<boost::mutex> lock(_mutex);
+					hook = _hook;
+				}
+				(*hook)();
+			}
+		private:
+			mutable boost::mutex _mutex;
+			boost::shared_ptr<const boost::function<void ()> > _hook;
+			boost::atomic<bool> _set;
+		};
+
+		/* Ready method requests, linked through their intrusive hooks.  Kept in a
+		shared_ptr so continuations which complete after their activation queue is
+		destroyed can still push into it.  Only one thread at a time may call try_pop(). */
+		class ready_request_queue: boost::noncopyable
+		{
+		public:
+			ready_request_queue(): _queue(_stub)
+			{}
+			void push(const boost::shared_ptr<method_request_base> &request)
+			{
+				_queue.push(request);
+				notify();
+			}
+			// the caller is responsible for calling notify() afterwards
+			void push_without_notify(const boost::shared_ptr<method_request_base> &request)
+			{
+				_queue.push(request);
+			}
+			void notify()
+			{
+				_wakeup.notify();
+				_ready_hook();
+			}
+			boost::shared_ptr<method_request_base> try_pop()
+			{
+				if(_queue.front() == 0) return boost::shared_ptr<method_request_base>();
+				return _queue.pop();
+			}
+			event_count& wakeup()
+			{
+				return _wakeup;
+			}
+			void set_ready_hook(const boost::function<void ()> &hook)
+			{
+				_ready_hook.set(hook);
+			}
+		private:
+			null_method_request _stub;
+			intrusive_mpsc_queue<method_request_base, method_request_access> _queue;
+			event_count _wakeup;
+			ready_hook _ready_hook;
+		};
+	}
+
 	class activation_queue_base
 	{
 	public:
@@ -46,64 +275,708 @@ namespace poet
 
 		virtual ~activation_queue_base() {}
 		virtual void push_back(const boost::shared_ptr<method_request_base> &request) = 0;
+		/* Pushes a batch of requests, in order.  Queues which override it link the whole batch
+		in with one synchronization and wake up a waiting consumer once.  The default
+		implementation pushes the requests one at a time. */
+		virtual void push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests)
+		{
+			std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+			for(it = requests.begin(); it != requests.end(); ++it)
+			{
+				push_back(*it);
+			}
+		}
+		template<typename InputIterator>
+		void push_back_range(InputIterator begin, InputIterator end)
+		{
+			const std::vector<boost::shared_ptr<method_request_base> > requests(begin, end);
+			push_back_range(requests);
+		}
 		virtual boost::shared_ptr<method_request_base> get_request() = 0;
+		/* Blocks like get_request(), then appends up to max_requests ready requests
+		to the end of requests.  Returns the number appended, which is zero if woken
+		by wake().  The default implementation only ever gets one request. */
+		virtual size_type get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests)
+		{
+			if(max_requests == 0) return 0;
+			boost::shared_ptr<method_request_base> request = get_request();
+			if(!request) return 0;
+			requests.push_back(request);
+			return 1;
+		}
+		/* Like get_requests(), but never blocks.  Returns zero if no request is ready.
+		The default implementation always returns zero. */
+		virtual size_type try_get_requests(std::vector<boost::shared_ptr<method_request_base> > &,
+			size_type)
+		{
+			return 0;
+		}
 		virtual size_type size() const = 0;
 		virtual bool empty() const = 0;
 		virtual void wake() = 0;
+		/* Makes the queue call hook whenever a request may have become ready, after
+		try_get_requests() can return it.  It is for schedulers which don't block in
+		get_requests(), like event_loop_scheduler.  The hook may be called from any thread,
+		including from push_back() and from the continuation of a scheduling guard, and must
+		not call back into the queue.  Returns false if the queue doesn't support a ready hook,
+		which is all the default implementation does. */
+		virtual bool set_ready_hook(const boost::function<void ()> &)
+		{
+			return false;
+		}
 	};
 
+	/* Pushing is lock-free and does not allocate, the requests are linked together through
+	a hook embedded in method_request_base.  Only one thread at a time may call get_request(). */
 	class in_order_activation_queue: public activation_queue_base
 	{
 	public:
+		in_order_activation_queue(): _queue(_stub), _size(0), _wake_pending(false),
+			_wakeup(new detail::event_count()), _ready_hook(new detail::ready_hook()),
+			_guarded_front(0), _front_guard_watched(false)
+		{}
 		virtual ~in_order_activation_queue() {}
 		inline virtual void push_back(const boost::shared_ptr<method_request_base> &request);
+		using activation_queue_base::push_back_range;
+		inline virtual void push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests);
 		inline virtual boost::shared_ptr<method_request_base> get_request();
+		inline virtual size_type get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
+		inline virtual size_type try_get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
 		virtual size_type size() const
 		{
-			boost::mutex::scoped_lock lock(_mutex);
-			return _pendingRequests.size();
+			return _size.load();
 		}
 		virtual bool empty() const
 		{
-			boost::mutex::scoped_lock lock(_mutex);
-			return _pendingRequests.empty();
+			return _size.load() == 0;
 		}
 		inline virtual void wake();
+		virtual bool set_ready_hook(const boost::function<void ()> &hook)
+		{
+			_ready_hook->set(hook);
+			return true;
+		}
 	private:
-		typedef std::deque<boost::shared_ptr<method_request_base> > request_container_type;
+		inline boost::shared_ptr<method_request_base> try_pop_ready();
+		static inline void front_guard_completed(const boost::shared_ptr<detail::event_count> &wakeup,
+			const boost::shared_ptr<detail::ready_hook> &ready_hook);
 
-		request_container_type _pendingRequests;
-		mutable boost::mutex _mutex;
-		promise<boost::shared_ptr<method_request_base> >_next_method_request;
-		promise<boost::shared_ptr<method_request_base> >_wake_promise;
+		typedef detail::intrusive_mpsc_queue<method_request_base, detail::method_request_access> request_container_type;
+
+		detail::null_method_request _stub;
+		request_container_type _queue;
+		/* incremented before a request is linked into _queue and decremented after it
+		is unlinked, so it never underflows. */
+		boost::atomic<size_type> _size;
+		boost::atomic<bool> _wake_pending;
+		/* shared with the continuations watching the front request's scheduling guard, which
+		may outlive the queue. */
+		boost::shared_ptr<detail::event_count> _wakeup;
+		boost::shared_ptr<detail::ready_hook> _ready_hook;
+		// consumer-only state caching the scheduling guard of the front request
+		const method_request_base *_guarded_front;
+		future<void> _front_guard;
+		bool _front_guard_watched;
 	};
 
+	/* Requests whose scheduling guards are already complete go straight onto a ready
+	queue, the others are moved there by a continuation when their guards complete.
+	Only one thread at a time may call get_request(). */
 	class out_of_order_activation_queue: public activation_queue_base
 	{
-		typedef future_selector<boost::shared_ptr<method_request_base> > selector_type;
 	public:
-		out_of_order_activation_queue()
+		out_of_order_activation_queue(): _ready(new detail::ready_request_queue()), _size(0), _wake_pending(false)
 		{}
 		virtual ~out_of_order_activation_queue() {}
 
 		inline virtual void push_back(const boost::shared_ptr<method_request_base> &request);
+		using activation_queue_base::push_back_range;
+		inline virtual void push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests);
 		inline virtual boost::shared_ptr<method_request_base> get_request();
+		inline virtual size_type get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
+		inline virtual size_type try_get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
 		virtual size_type size() const
 		{
-			const selector_type::difference_type size = _selector.size();
-			BOOST_ASSERT(size >= 0);
-			return size;
+			return _size.load();
 		}
 		virtual bool empty() const
 		{
-			BOOST_ASSERT(_selector.size() >= 0);
-			return _selector.size() == 0;
+			return _size.load() == 0;
 		}
 		inline virtual void wake();
+		virtual bool set_ready_hook(const boost::function<void ()> &hook)
+		{
+			_ready->set_ready_hook(hook);
+			return true;
+		}
+	private:
+		boost::shared_ptr<detail::ready_request_queue> _ready;
+		// includes requests still waiting on their scheduling guards
+		boost::atomic<size_type> _size;
+		boost::atomic<bool> _wake_pending;
+	};
+
+	namespace detail
+	{
+		/* Ready method requests ordered by a key, then by the order they were pushed
+		into their activation queue.  The request with the greatest key according to
+		Compare is popped first.  Shared with continuations like ready_request_queue. */
+		template<typename Key, typename Compare>
+		class ordered_ready_queue: boost::noncopyable
+		{
+		public:
+			struct entry
+			{
+				Key key;
+				unsigned long sequence;
+				boost::shared_ptr<method_request_base> request;
+			};
+
+			ordered_ready_queue(): _wake_pending(false)
+			{}
+			void push(const boost::shared_ptr<method_request_base> &request, const Key &key, unsigned long sequence)
+			{
+				entry new_entry;
+				new_entry.key = key;
+				new_entry.sequence = sequence;
+				new_entry.request = request;
+				{
+					boost::unique_lock<boost::mutex> lock(_mutex);
+					_heap.push_back(new_entry);
+					std::push_heap(_heap.begin(), _heap.end(), entry_less());
+					_condition.notify_one();
+				}
+				_ready_hook();
+			}
+			void push_range(const std::vector<entry> &entries)
+			{
+				if(entries.empty()) return;
+				{
+					boost::unique_lock<boost::mutex> lock(_mutex);
+					typename std::vector<entry>::const_iterator it;
+					for(it = entries.begin(); it != entries.end(); ++it)
+					{
+						_heap.push_back(*it);
+						std::push_heap(_heap.begin(), _heap.end(), entry_less());
+					}
+					_condition.notify_one();
+				}
+				_ready_hook();
+			}
+			void set_ready_hook(const boost::function<void ()> &hook)
+			{
+				_ready_hook.set(hook);
+			}
+			// blocks until a request is ready or wake() is called
+			activation_queue_base::size_type get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+				activation_queue_base::size_type max_requests)
+			{
+				if(max_requests == 0) return 0;
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				while(_heap.empty() && _wake_pending == false)
+				{
+					_condition.wait(lock);
+				}
+				if(_wake_pending)
+				{
+					_wake_pending = false;
+					return 0;
+				}
+				return pop(requests, max_requests);
+			}
+			activation_queue_base::size_type try_get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+				activation_queue_base::size_type max_requests)
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				return pop(requests, max_requests);
+			}
+			void wake()
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				_wake_pending = true;
+				_condition.notify_all();
+			}
+			/* Moves the request up to the given key, if it is still in the queue and its
+			key is smaller.  A linear search, raising keys is expected to be rare. */
+			void raise_key(const method_request_base *request, const Key &key)
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				typename std::vector<entry>::iterator it;
+				for(it = _heap.begin(); it != _heap.end(); ++it)
+				{
+					if(it->request.get() == request) break;
+				}
+				Compare compare;
+				if(it == _heap.end() || compare(it->key, key) == false) return;
+				it->key = key;
+				// [begin, it) is still a heap, so this sifts the raised entry up
+				std::push_heap(_heap.begin(), it + 1, entry_less());
+			}
+		private:
+			// _mutex must be locked
+			activation_queue_base::size_type pop(std::vector<boost::shared_ptr<method_request_base> > &requests,
+				activation_queue_base::size_type max_requests)
+			{
+				activation_queue_base::size_type count = 0;
+				while(_heap.empty() == false && count < max_requests)
+				{
+					std::pop_heap(_heap.begin(), _heap.end(), entry_less());
+					requests.push_back(_heap.back().request);
+					_heap.pop_back();
+					++count;
+				}
+				return count;
+			}
+
+			struct entry_less
+			{
+				bool operator()(const entry &a, const entry &b) const
+				{
+					Compare compare;
+					if(compare(a.key, b.key)) return true;
+					if(compare(b.key, a.key)) return false;
+					return a.sequence > b.sequence;
+				}
+			};
+
+			boost::mutex _mutex;
+			boost::condition _condition;
+			std::vector<entry> _heap;
+			bool _wake_pending;
+			ready_hook _ready_hook;
+		};
+	}
+
+	/* Like out_of_order_activation_queue, but among the requests whose scheduling guards
+	are complete, the one with the highest method_request_base::priority() is returned first.
+	Requests of equal priority are returned in the order they were pushed. */
+	class priority_activation_queue: public activation_queue_base
+	{
+	public:
+		priority_activation_queue(): _ready(new ready_queue_type()), _size(0), _sequence(0)
+		{}
+		virtual ~priority_activation_queue() {}
+
+		inline virtual void push_back(const boost::shared_ptr<method_request_base> &request);
+		using activation_queue_base::push_back_range;
+		inline virtual void push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests);
+		// sets the request's priority and pushes it
+		void push_back(const boost::shared_ptr<method_request_base> &request, int priority)
+		{
+			request->set_priority(priority);
+			push_back(request);
+		}
+		virtual boost::shared_ptr<method_request_base> get_request()
+		{
+			std::vector<boost::shared_ptr<method_request_base> > requests;
+			get_requests(requests, 1);
+			if(requests.empty()) return boost::shared_ptr<method_request_base>();
+			return requests.front();
+		}
+		virtual size_type get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests)
+		{
+			const size_type count = _ready->get_requests(requests, max_requests);
+			_size -= count;
+			return count;
+		}
+		virtual size_type try_get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests)
+		{
+			const size_type count = _ready->try_get_requests(requests, max_requests);
+			_size -= count;
+			return count;
+		}
+		virtual size_type size() const
+		{
+			return _size.load();
+		}
+		virtual bool empty() const
+		{
+			return _size.load() == 0;
+		}
+		virtual void wake()
+		{
+			_ready->wake();
+		}
+		virtual bool set_ready_hook(const boost::function<void ()> &hook)
+		{
+			_ready->set_ready_hook(hook);
+			return true;
+		}
+	private:
+		typedef detail::ordered_ready_queue<int, std::less<int> > ready_queue_type;
+
+		static inline void push_ready(const boost::shared_ptr<ready_queue_type> &ready,
+			const boost::shared_ptr<method_request_base> &request, unsigned long sequence);
+
+		boost::shared_ptr<ready_queue_type> _ready;
+		boost::atomic<size_type> _size;
+		boost::atomic<unsigned long> _sequence;
+	};
+
+	/* An earliest deadline first activation queue.  Among the requests whose scheduling guards
+	are complete, the one with the earliest method_request_base::deadline() is returned first.
+	Requests with equal deadlines are returned in the order they were pushed.  Optionally, cancellable
+	requests whose deadlines have already passed when they reach the front of the queue are cancelled
+	with a deadline_expired exception instead of being returned. */
+	class deadline_activation_queue: public activation_queue_base
+	{
+	public:
+		deadline_activation_queue(bool shed_late_requests = false): _ready(new ready_queue_type()),
+			_size(0), _sequence(0), _shed_late_requests(shed_late_requests)
+		{}
+		virtual ~deadline_activation_queue() {}
+
+		inline virtual void push_back(const boost::shared_ptr<method_request_base> &request);
+		using activation_queue_base::push_back_range;
+		inline virtual void push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests);
+		// sets the request's deadline and pushes it
+		void push_back(const boost::shared_ptr<method_request_base> &request, const boost::system_time &deadline)
+		{
+			request->set_deadline(deadline);
+			push_back(request);
+		}
+		virtual boost::shared_ptr<method_request_base> get_request()
+		{
+			std::vector<boost::shared_ptr<method_request_base> > requests;
+			get_requests(requests, 1);
+			if(requests.empty()) return boost::shared_ptr<method_request_base>();
+			return requests.front();
+		}
+		inline virtual size_type get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
+		inline virtual size_type try_get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
+		virtual size_type size() const
+		{
+			return _size.load();
+		}
+		virtual bool empty() const
+		{
+			return _size.load() == 0;
+		}
+		virtual void wake()
+		{
+			_ready->wake();
+		}
+		virtual bool set_ready_hook(const boost::function<void ()> &hook)
+		{
+			_ready->set_ready_hook(hook);
+			return true;
+		}
+		bool sheds_late_requests() const
+		{
+			return _shed_late_requests;
+		}
+	private:
+		typedef detail::ordered_ready_queue<boost::system_time, std::greater<boost::system_time> > ready_queue_type;
+
+		inline size_type shed_late_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			std::vector<boost::shared_ptr<method_request_base> >::size_type first);
+
+		boost::shared_ptr<ready_queue_type> _ready;
+		boost::atomic<size_type> _size;
+		boost::atomic<unsigned long> _sequence;
+		const bool _shed_late_requests;
+	};
+
+	namespace detail
+	{
+		/* The method requests of a keyed_activation_queue which have to wait for an earlier
+		request with the same ordering key.  Each key has a chain of requests in the order they
+		were pushed.  Once the request at the front of a chain has a complete scheduling guard, it
+		moves to the ready queue and the next request in the chain becomes the front.  Shared with
+		the continuations watching the scheduling guards. */
+		class keyed_request_chains: boost::noncopyable
+		{
+		public:
+			/* All the keys are equal, so ready requests come out in the order they were pushed
+			into the activation queue. */
+			typedef ordered_ready_queue<int, std::less<int> > ready_queue_type;
+
+			keyed_request_chains(): _ready(new ready_queue_type())
+			{}
+			const boost::shared_ptr<ready_queue_type>& ready() const
+			{
+				return _ready;
+			}
+			inline void push(const boost::shared_ptr<method_request_base> &request, std::size_t key,
+				unsigned long sequence, bool guard_complete);
+			static inline void guard_completed(const boost::shared_ptr<keyed_request_chains> &chains,
+				const method_request_base *request, std::size_t key);
+		private:
+			struct link
+			{
+				boost::shared_ptr<method_request_base> request;
+				unsigned long sequence;
+				bool guard_complete;
+			};
+			typedef std::map<std::size_t, std::deque<link> > chain_map_type;
+
+			inline void release_ready_front(chain_map_type::iterator chain);
+
+			boost::mutex _mutex;
+			/* Only keys with requests still waiting have a chain, and the request at the front
+			of a chain never has a complete scheduling guard. */
+			chain_map_type _chains;
+			boost::shared_ptr<ready_queue_type> _ready;
+		};
+	}
+
+	/* Requests with the same method_request_base::ordering_key() are returned in the order
+	they were pushed, like an in_order_activation_queue for each key.  Requests with different
+	keys, or without a key, are returned as soon as their scheduling guards complete, like an
+	out_of_order_activation_queue.  For example, an active object serving many accounts can keep
+	each account's requests in order without a slow request holding up the other accounts. */
+	class keyed_activation_queue: public activation_queue_base
+	{
+	public:
+		keyed_activation_queue(): _chains(new detail::keyed_request_chains()), _size(0), _sequence(0)
+		{}
+		virtual ~keyed_activation_queue() {}
+
+		inline virtual void push_back(const boost::shared_ptr<method_request_base> &request);
+		using activation_queue_base::push_back_range;
+		inline virtual void push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests);
+		// sets the request's ordering key and pushes it
+		void push_back(const boost::shared_ptr<method_request_base> &request, std::size_t key)
+		{
+			request->set_ordering_key(key);
+			push_back(request);
+		}
+		virtual boost::shared_ptr<method_request_base> get_request()
+		{
+			std::vector<boost::shared_ptr<method_request_base> > requests;
+			get_requests(requests, 1);
+			if(requests.empty()) return boost::shared_ptr<method_request_base>();
+			return requests.front();
+		}
+		virtual size_type get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests)
+		{
+			const size_type count = _chains->ready()->get_requests(requests, max_requests);
+			_size -= count;
+			return count;
+		}
+		virtual size_type try_get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests)
+		{
+			const size_type count = _chains->ready()->try_get_requests(requests, max_requests);
+			_size -= count;
+			return count;
+		}
+		virtual size_type size() const
+		{
+			return _size.load();
+		}
+		virtual bool empty() const
+		{
+			return _size.load() == 0;
+		}
+		virtual void wake()
+		{
+			_chains->ready()->wake();
+		}
+		virtual bool set_ready_hook(const boost::function<void ()> &hook)
+		{
+			_chains->ready()->set_ready_hook(hook);
+			return true;
+		}
 	private:
+		inline void push(const boost::shared_ptr<method_request_base> &request, unsigned long sequence);
+
+		boost::shared_ptr<detail::keyed_request_chains> _chains;
+		boost::atomic<size_type> _size;
+		boost::atomic<unsigned long> _sequence;
+	};
+
+	/* Limits the number of method requests in another activation queue.  What happens
+	when a request is pushed onto a full queue depends on the overflow_policy. */
+	class bounded_activation_queue: public activation_queue_base
+	{
+	public:
+		enum overflow_policy
+		{
+			/* push_back blocks until there is space.  Only the dispatcher thread makes space,
+			so pushing onto a full queue from a method request running on the queue's own
+			dispatcher thread deadlocks.  Use fail_on_overflow, or space_available(), there. */
+			block_on_overflow,
+			// push_back throws queue_full
+			fail_on_overflow,
+			/* the oldest cancellable request still in the queue is cancelled with a queue_full
+			exception.  If none of them are cancellable, push_back blocks until there is space.
+			A dropped request stays in the wrapped queue until the wrapped queue gives it back,
+			for example until its scheduling guard completes.  Once capacity() dropped requests
+			are waiting there, push_back blocks instead of dropping more. */
+			drop_oldest_on_overflow
+		};
+
+		inline bounded_activation_queue(const boost::shared_ptr<activation_queue_base> &queue,
+			size_type capacity, overflow_policy policy = block_on_overflow);
+		virtual ~bounded_activation_queue() {}
+
+		inline virtual void push_back(const boost::shared_ptr<method_request_base> &request);
+		using activation_queue_base::push_back_range;
+		/* Pushes all of the requests or none of them.  The overflow policy applies to the
+		whole range, it waits or drops until every request fits.  A range larger than
+		capacity() never fits, so it throws queue_full whatever the policy. */
+		inline virtual void push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests);
+		virtual boost::shared_ptr<method_request_base> get_request()
+		{
+			std::vector<boost::shared_ptr<method_request_base> > requests;
+			get_requests(requests, 1);
+			if(requests.empty()) return boost::shared_ptr<method_request_base>();
+			return requests.front();
+		}
+		inline virtual size_type get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
+		inline virtual size_type try_get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
+		virtual size_type size() const
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			return _size;
+		}
+		virtual bool empty() const
+		{
+			return size() == 0;
+		}
+		virtual void wake()
+		{
+			_queue->wake();
+		}
+		virtual bool set_ready_hook(const boost::function<void ()> &hook)
+		{
+			return _queue->set_ready_hook(hook);
+		}
+		size_type capacity() const
+		{
+			return _capacity;
+		}
+		overflow_policy policy() const
+		{
+			return _policy;
+		}
+		// becomes ready when the queue is not full
+		inline future<void> space_available();
+	private:
+		typedef std::list<boost::shared_ptr<method_request_base> > request_list_type;
+
+		inline void make_room(boost::unique_lock<boost::mutex> &lock, size_type num_requests,
+			std::vector<boost::shared_ptr<method_request_base> > &dropped);
+		inline bool drop_oldest(size_type num_requests, std::vector<boost::shared_ptr<method_request_base> > &dropped);
+		static inline void cancel_dropped(const std::vector<boost::shared_ptr<method_request_base> > &dropped);
+		inline size_type account_dequeued(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			std::vector<boost::shared_ptr<method_request_base> >::size_type first);
+
+		boost::shared_ptr<activation_queue_base> _queue;
+		const size_type _capacity;
+		const overflow_policy _policy;
 		mutable boost::mutex _mutex;
-		selector_type _selector;
-		promise<boost::shared_ptr<method_request_base> >_wake_promise;
+		boost::condition _space_condition;
+		size_type _size;
+		std::vector<promise<void> > _space_promises;
+		/* Only used by drop_oldest_on_overflow.  _queued holds the requests in _queue in push order, and
+		_dropped the requests which were cancelled but are still in _queue. */
+		request_list_type _queued;
+		std::map<const method_request_base *, request_list_type::iterator> _queued_index;
+		std::set<const method_request_base *> _dropped;
+	};
+
+	/* Wraps another activation queue and sheds load using the CoDel ("controlled delay")
+	algorithm of Nichols and Jacobson.  It tracks how long each request waited in the queue.
+	Once the waits have stayed above target for at least interval, it starts cancelling requests
+	at dequeue with an overloaded exception, at a rate which increases until the waits come back
+	down.  Requests which aren't cancellable are never dropped.  Only one thread at a time may
+	call get_request(). */
+	class codel_activation_queue: public activation_queue_base
+	{
+	public:
+		inline codel_activation_queue(const boost::shared_ptr<activation_queue_base> &queue,
+			const boost::posix_time::time_duration &target = boost::posix_time::milliseconds(5),
+			const boost::posix_time::time_duration &interval = boost::posix_time::milliseconds(100));
+		virtual ~codel_activation_queue() {}
+
+		virtual void push_back(const boost::shared_ptr<method_request_base> &request)
+		{
+			request->set_enqueue_time(boost::get_system_time());
+			_queue->push_back(request);
+		}
+		using activation_queue_base::push_back_range;
+		virtual void push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests)
+		{
+			const boost::system_time now = boost::get_system_time();
+			std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+			for(it = requests.begin(); it != requests.end(); ++it)
+			{
+				(*it)->set_enqueue_time(now);
+			}
+			_queue->push_back_range(requests);
+		}
+		virtual boost::shared_ptr<method_request_base> get_request()
+		{
+			std::vector<boost::shared_ptr<method_request_base> > requests;
+			get_requests(requests, 1);
+			if(requests.empty()) return boost::shared_ptr<method_request_base>();
+			return requests.front();
+		}
+		inline virtual size_type get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
+		inline virtual size_type try_get_requests(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			size_type max_requests);
+		virtual size_type size() const
+		{
+			return _queue->size();
+		}
+		virtual bool empty() const
+		{
+			return _queue->empty();
+		}
+		virtual void wake()
+		{
+			_queue->wake();
+		}
+		virtual bool set_ready_hook(const boost::function<void ()> &hook)
+		{
+			return _queue->set_ready_hook(hook);
+		}
+		const boost::posix_time::time_duration& target() const
+		{
+			return _target;
+		}
+		const boost::posix_time::time_duration& interval() const
+		{
+			return _interval;
+		}
+		// the number of requests cancelled so far
+		unsigned long drop_count() const
+		{
+			return _drop_count.load();
+		}
+	private:
+		inline size_type shed_overload(std::vector<boost::shared_ptr<method_request_base> > &requests,
+			std::vector<boost::shared_ptr<method_request_base> >::size_type first);
+		inline bool should_drop(const boost::system_time &now, const boost::posix_time::time_duration &sojourn_time,
+			bool cancellable);
+		inline boost::system_time control_law(const boost::system_time &t) const;
+
+		boost::shared_ptr<activation_queue_base> _queue;
+		const boost::posix_time::time_duration _target;
+		const boost::posix_time::time_duration _interval;
+		boost::atomic<unsigned long> _drop_count;
+		// consumer-only CoDel state
+		boost::system_time _first_above_time;
+		boost::system_time _drop_next;
+		unsigned _count;
+		// _count when the current or last dropping state started
+		unsigned _last_count;
+		bool _dropping;
 	};
 
 	class scheduler_base
@@ -112,34 +985,259 @@ namespace poet
 		virtual ~scheduler_base()
 		{}
 		virtual void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest) = 0;
+		/* Posts a batch of method requests, in order.  The default implementation posts
+		them one at a time. */
+		virtual void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+			for(it = methodRequests.begin(); it != methodRequests.end(); ++it)
+			{
+				post_method_request(*it);
+			}
+		}
+		template<typename InputIterator>
+		void post_method_requests(InputIterator begin, InputIterator end)
+		{
+			const std::vector<boost::shared_ptr<method_request_base> > methodRequests(begin, end);
+			post_method_requests(methodRequests);
+		}
 		virtual void kill() = 0;
 		virtual void join() = 0;
+		/* True if the calling thread is running one of this scheduler's method requests.
+		The default implementation always returns false. */
+		virtual bool running_in_this_thread() const
+		{
+			return false;
+		}
+	};
+
+	/* Optional settings for the threads of a scheduler or thread_pool_scheduler,
+	in the spirit of boost::thread::attributes. */
+	class scheduler_attributes
+	{
+	public:
+		scheduler_attributes(): _batch_size(1), _numa_node(-1), _spin_duration(boost::posix_time::seconds(0)),
+			_yield_count(0), _help_while_waiting(false)
+		{}
+		/* The maximum number of ready method requests a dispatcher thread takes from the
+		activation queue at once and runs back to back. */
+		void set_batch_size(unsigned batch_size)
+		{
+			_batch_size = batch_size > 0 ? batch_size : 1;
+		}
+		unsigned get_batch_size() const
+		{
+			return _batch_size;
+		}
+		/* Pins the dispatcher threads to the given CPUs (on Linux, elsewhere it is ignored).
+		An empty set, the default, leaves them unpinned. */
+		void set_cpu_set(const std::vector<unsigned> &cpus)
+		{
+			_cpu_set = cpus;
+			_numa_node = -1;
+		}
+		const std::vector<unsigned>& get_cpu_set() const
+		{
+			return _cpu_set;
+		}
+		/* Pins the dispatcher threads to the CPUs of a NUMA node.  Throws std::invalid_argument
+		if the node does not exist. */
+		void set_numa_node(unsigned node)
+		{
+			_cpu_set = detail::numa_node_cpus(node);
+			_numa_node = node;
+		}
+		// -1 if no NUMA node was set
+		int get_numa_node() const
+		{
+			return _numa_node;
+		}
+		/* If set, the dispatcher threads record their activity in statistics.  The same
+		object may be shared by several schedulers. */
+		void set_statistics(const boost::shared_ptr<scheduler_statistics> &statistics)
+		{
+			_statistics = statistics;
+		}
+		const boost::shared_ptr<scheduler_statistics>& get_statistics() const
+		{
+			return _statistics;
+		}
+		/* When a dispatcher thread runs out of method requests, it first polls the activation
+		queue for up to spin_duration, then polls it yield_count more times, yielding its time
+		slice between polls, and only then parks in the activation queue's get_requests().
+		Spinning trades CPU time for lower wakeup latency.  Both default to zero, which parks
+		immediately. */
+		void set_spin_duration(const boost::posix_time::time_duration &spin_duration)
+		{
+			_spin_duration = spin_duration.is_negative() ? boost::posix_time::seconds(0) : spin_duration;
+		}
+		const boost::posix_time::time_duration& get_spin_duration() const
+		{
+			return _spin_duration;
+		}
+		void set_yield_count(unsigned yield_count)
+		{
+			_yield_count = yield_count;
+		}
+		unsigned get_yield_count() const
+		{
+			return _yield_count;
+		}
+		/* If enabled, a method request which blocks in future::get() or future::join()
+		lets its dispatcher thread run other ready method requests from the scheduler
+		until the future completes, rather than sleeping.  This keeps small pools busy
+		(and out of deadlock) in recursive algorithms, but the other requests run nested
+		inside the waiting one, so it must not hold locks they need.  Defaults to false. */
+		void set_help_while_waiting(bool enable)
+		{
+			_help_while_waiting = enable;
+		}
+		bool get_help_while_waiting() const
+		{
+			return _help_while_waiting;
+		}
+	private:
+		unsigned _batch_size;
+		std::vector<unsigned> _cpu_set;
+		int _numa_node;
+		boost::shared_ptr<scheduler_statistics> _statistics;
+		boost::posix_time::time_duration _spin_duration;
+		unsigned _yield_count;
+		bool _help_while_waiting;
 	};
 
 	namespace detail
 	{
-		class scheduler_impl
+		/* Only one dispatcher thread at a time may wait in an activation queue, the others
+		queue up for the slot (leader/followers).  Threads helping while they wait on a future
+		queue up too, but are also woken by wake_helpers() when their future completes. */
+		class dispatch_slot: boost::noncopyable
+		{
+		public:
+			dispatch_slot(): _taken(false), _num_followers(0), _num_helpers(0), _wake_epoch(0)
+			{}
+			void acquire()
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				++_num_followers;
+				while(_taken) _follower_condition.wait(lock);
+				--_num_followers;
+				_taken = true;
+			}
+			bool try_acquire()
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				if(_taken) return false;
+				_taken = true;
+				return true;
+			}
+			void release()
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				_taken = false;
+				if(_num_followers > 0) _follower_condition.notify_one();
+				if(_num_helpers > 0) _helper_condition.notify_all();
+			}
+			/* Read it before checking whether a helper's future is complete, then pass it
+			to wait_for_release(), so a wake_helpers() in between isn't missed. */
+			unsigned long wake_epoch() const
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				return _wake_epoch;
+			}
+			// blocks until the slot is released, or wake_helpers() is called after epoch was read
+			void wait_for_release(unsigned long epoch)
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				++_num_helpers;
+				while(_taken && _wake_epoch == epoch) _helper_condition.wait(lock);
+				--_num_helpers;
+			}
+			static void wake_helpers(const boost::weak_ptr<dispatch_slot> &weak_slot)
+			{
+				boost::shared_ptr<dispatch_slot> slot = weak_slot.lock();
+				if(!slot) return;
+				boost::unique_lock<boost::mutex> lock(slot->_mutex);
+				++slot->_wake_epoch;
+				slot->_helper_condition.notify_all();
+			}
+
+			class scoped_acquire: boost::noncopyable
+			{
+			public:
+				explicit scoped_acquire(dispatch_slot &slot): _slot(slot)
+				{
+					_slot.acquire();
+				}
+				~scoped_acquire()
+				{
+					_slot.release();
+				}
+			private:
+				dispatch_slot &_slot;
+			};
+		private:
+			mutable boost::mutex _mutex;
+			boost::condition _follower_condition;
+			boost::condition _helper_condition;
+			bool _taken;
+			unsigned _num_followers;
+			unsigned _num_helpers;
+			unsigned long _wake_epoch;
+		};
+
+		class scheduler_impl: public wait_helper
 		{
 		public:
-			inline scheduler_impl(const boost::shared_ptr<activation_queue_base> &activationQueue);
+			inline scheduler_impl(const boost::shared_ptr<activation_queue_base> &activationQueue,
+				const scheduler_attributes &attributes);
 			~scheduler_impl() {}
 			inline void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest);
+			inline void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests);
 			inline void kill();
 			inline void detach();
 			inline bool mortallyWounded() const;
+			bool running_in_this_thread() const
+			{
+				return current_scheduler().get() == this;
+			}
 			static inline void dispatcherThreadFunction(const boost::shared_ptr<scheduler_impl> &shared_this);
+			inline virtual void help_until(const future<void> &done);
 		private:
-			inline bool dispatch();
+			static void null_cleanup(scheduler_impl *)
+			{}
+			// the scheduler_impl whose dispatcher thread this is, if any
+			static boost::thread_specific_ptr<scheduler_impl>& current_scheduler()
+			{
+				static boost::thread_specific_ptr<scheduler_impl> current(&null_cleanup);
+				return current;
+			}
+			static boost::uint64_t elapsed_microseconds(const boost::system_time &start, const boost::system_time &end)
+			{
+				if(start.is_special() || end < start) return 0;
+				return (end - start).total_microseconds();
+			}
+
 			bool detached() const
 			{
-				return _detached;
+				return _detached.load();
 			}
+			bool should_exit() const
+			{
+				return mortallyWounded() || (detached() && _activationQueue->empty());
+			}
+			inline void wait_for_requests(std::vector<boost::shared_ptr<method_request_base> > &batch,
+				unsigned batch_size, scheduler_statistics *statistics);
+			static inline void run_request(method_request_base &request, scheduler_statistics *statistics);
+			static inline void wake_helper(const boost::weak_ptr<activation_queue_base> &weak_queue,
+				const boost::weak_ptr<dispatch_slot> &weak_slot);
 
 			boost::shared_ptr<activation_queue_base> _activationQueue;
-			poet::promise<boost::shared_ptr<method_request_base> > _wake_promise;
-			mutable boost::mutex _mutex;
-			bool _mortallyWounded;
-			bool _detached;
+			const scheduler_attributes _attributes;
+			// shared so continuations on the futures helpers wait for can outlive us
+			const boost::shared_ptr<dispatch_slot> _dispatch_slot;
+			boost::atomic<bool> _mortallyWounded;
+			boost::atomic<bool> _detached;
 		};
 	}
 
@@ -147,7 +1245,8 @@ namespace poet
 	{
 	public:
 		inline scheduler(const boost::shared_ptr<activation_queue_base> &activationQueue =
-			boost::shared_ptr<activation_queue_base>(new out_of_order_activation_queue));
+			boost::shared_ptr<activation_queue_base>(new out_of_order_activation_queue),
+			const scheduler_attributes &attributes = scheduler_attributes());
 		virtual ~scheduler()
 		{
 			_pimpl->detach();
@@ -156,15 +1255,63 @@ namespace poet
 		{
 			_pimpl->post_method_request(methodRequest);
 		}
+		using scheduler_base::post_method_requests;
+		virtual void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			_pimpl->post_method_requests(methodRequests);
+		}
 		virtual void kill()
 		{
 			_pimpl->kill();
 		}
 		inline virtual void join();
+		virtual bool running_in_this_thread() const
+		{
+			return _pimpl->running_in_this_thread();
+		}
 	private:
 		boost::shared_ptr<detail::scheduler_impl> _pimpl;
 		boost::shared_ptr<boost::thread> _dispatcherThread;
 	};
+
+	class thread_pool_scheduler: public scheduler_base
+	{
+	public:
+		inline thread_pool_scheduler(unsigned num_threads = 0, const boost::shared_ptr<activation_queue_base> &activationQueue =
+			boost::shared_ptr<activation_queue_base>(new out_of_order_activation_queue),
+			const scheduler_attributes &attributes = scheduler_attributes());
+		virtual ~thread_pool_scheduler()
+		{
+			_pimpl->detach();
+		}
+		virtual void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			_pimpl->post_method_request(methodRequest);
+		}
+		using scheduler_base::post_method_requests;
+		virtual void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			_pimpl->post_method_requests(methodRequests);
+		}
+		virtual void kill()
+		{
+			_pimpl->kill();
+		}
+		inline virtual void join();
+		virtual bool running_in_this_thread() const
+		{
+			return _pimpl->running_in_this_thread();
+		}
+		unsigned num_threads() const
+		{
+			return _dispatcherThreads.size();
+		}
+	private:
+		typedef std::vector<boost::shared_ptr<boost::thread> > thread_container_type;
+
+		boost::shared_ptr<detail::scheduler_impl> _pimpl;
+		thread_container_type _dispatcherThreads;
+	};
 }
 
 #include <poet/detail/active_object.cpp>
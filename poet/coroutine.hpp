@@ -0,0 +1,291 @@
+/*
+	C++20 coroutine support.  Makes poet::future awaitable, and provides a
+	coroutine task type whose coroutines run on a scheduler.  A task which
+	co_awaits a future is suspended without holding its scheduler thread, and
+	is resumed by a method request posted to the scheduler when the future
+	completes.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_COROUTINE_HPP
+#define _POET_COROUTINE_HPP
+
+#if !defined(__cpp_impl_coroutine) || __cpp_impl_coroutine < 201902L
+#error "poet/coroutine.hpp requires a compiler with C++20 coroutine support"
+#endif
+
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <coroutine>
+#include <type_traits>
+#include <poet/active_object.hpp>
+#include <poet/detail/future_continuation.hpp>
+#include <poet/future.hpp>
+
+namespace poet
+{
+	template<typename T>
+	class task;
+
+	namespace detail
+	{
+		// runs (or destroys, if it never gets to run) a suspended coroutine
+		class coroutine_resume_request: public method_request_base
+		{
+		public:
+			explicit coroutine_resume_request(std::coroutine_handle<> handle): _handle(handle)
+			{}
+			virtual ~coroutine_resume_request()
+			{
+				/* If the scheduler was killed before we could run, destroy the coroutine
+				frame.  Its poet::promise is destroyed with it, so anyone waiting on the
+				task's future gets an uncertain_future exception instead of hanging. */
+				if(_handle) _handle.destroy();
+			}
+			virtual void run()
+			{
+				std::coroutine_handle<> handle = _handle;
+				_handle = std::coroutine_handle<>();
+				handle.resume();
+			}
+			virtual future<void> scheduling_guard() const
+			{
+				return ready_scheduling_guard();
+			}
+		private:
+			std::coroutine_handle<> _handle;
+		};
+
+		/* Resumes a coroutine on its scheduler, or in the calling thread if it has none.
+		Used as a future_continuation callback, so it must not throw. */
+		class coroutine_resumer
+		{
+		public:
+			coroutine_resumer(std::coroutine_handle<> handle):
+				_handle(handle), _scheduled(false)
+			{}
+			coroutine_resumer(std::coroutine_handle<> handle, const boost::weak_ptr<scheduler_base> &scheduler):
+				_handle(handle), _scheduler(scheduler), _scheduled(true)
+			{}
+			void operator()() const
+			{
+				if(_scheduled)
+				{
+					boost::shared_ptr<scheduler_base> scheduler = _scheduler.lock();
+					if(!scheduler)
+					{
+						// same as if the scheduler had been destroyed with our resume request in its queue
+						_handle.destroy();
+						return;
+					}
+					try
+					{
+						scheduler->post_method_request(
+							boost::shared_ptr<method_request_base>(new coroutine_resume_request(_handle)));
+						return;
+					}
+					catch(...)
+					{
+						/* for example a bounded_activation_queue which fails on overflow.
+						Resuming here is better than leaving the coroutine suspended forever. */
+					}
+				}
+				_handle.resume();
+			}
+		private:
+			std::coroutine_handle<> _handle;
+			boost::weak_ptr<scheduler_base> _scheduler;
+			bool _scheduled;
+		};
+
+		class task_promise_base
+		{
+		public:
+			// tasks don't start running until they are spawned on a scheduler
+			std::suspend_always initial_suspend() noexcept
+			{
+				return std::suspend_always();
+			}
+			// the coroutine frame destroys itself when the coroutine finishes
+			std::suspend_never final_suspend() noexcept
+			{
+				return std::suspend_never();
+			}
+			/* Weak, since a suspended coroutine may end up owned by a resume request in its
+			scheduler's activation queue. */
+			const boost::weak_ptr<scheduler_base>& scheduler() const
+			{
+				return _scheduler;
+			}
+			void set_scheduler(const boost::shared_ptr<scheduler_base> &scheduler)
+			{
+				_scheduler = scheduler;
+			}
+		private:
+			boost::weak_ptr<scheduler_base> _scheduler;
+		};
+
+		template<typename T>
+		class task_promise: public task_promise_base
+		{
+		public:
+			task<T> get_return_object()
+			{
+				return task<T>(std::coroutine_handle<task_promise>::from_promise(*this));
+			}
+			void return_value(const T &value)
+			{
+				_result.fulfill(value);
+			}
+			void unhandled_exception()
+			{
+				_result.renege(poet::current_exception());
+			}
+			const promise<T>& result() const
+			{
+				return _result;
+			}
+		private:
+			promise<T> _result;
+		};
+
+		template<>
+		class task_promise<void>: public task_promise_base
+		{
+		public:
+			inline task<void> get_return_object();
+			void return_void()
+			{
+				_result.fulfill();
+			}
+			void unhandled_exception()
+			{
+				_result.renege(poet::current_exception());
+			}
+			const promise<void>& result() const
+			{
+				return _result;
+			}
+		private:
+			promise<void> _result;
+		};
+
+		template<typename Promise>
+		coroutine_resumer make_coroutine_resumer(std::coroutine_handle<Promise> handle)
+		{
+			if constexpr(std::is_base_of<task_promise_base, Promise>::value)
+			{
+				return coroutine_resumer(handle, handle.promise().scheduler());
+			}else
+			{
+				return coroutine_resumer(handle);
+			}
+		}
+	}
+
+	/* The awaiter returned by co_await on a future.  If the future is not complete yet, the
+	coroutine is suspended and resumed when it completes: on its scheduler if the coroutine is a
+	task, otherwise in whichever thread completed the future.  co_await returns the future's value,
+	or throws its exception. */
+	template<typename T>
+	class future_awaiter
+	{
+	public:
+		explicit future_awaiter(const future<T> &f): _future(f)
+		{}
+		bool await_ready() const
+		{
+			return _future.ready() || _future.has_exception();
+		}
+		template<typename Promise>
+		void await_suspend(std::coroutine_handle<Promise> handle)
+		{
+			/* The coroutine may be resumed in another thread, and its frame destroyed, before
+			when_complete returns.  So pass a copy of the future, which stays valid. */
+			const future<void> f = _future;
+			detail::when_complete(f, detail::make_coroutine_resumer(handle));
+		}
+		T await_resume()
+		{
+			return _future.get();
+		}
+	private:
+		future<T> _future;
+	};
+
+	template<typename T>
+	future_awaiter<T> operator co_await(const future<T> &f)
+	{
+		return future_awaiter<T>(f);
+	}
+
+	/* The return type of coroutines which run on a scheduler.  A task does nothing until it is
+	passed to spawn().  If a task is destroyed without being spawned, its coroutine is destroyed
+	too. */
+	template<typename T>
+	class task
+	{
+		friend class detail::task_promise<T>;
+		template<typename U>
+		friend future<U> spawn(const boost::shared_ptr<scheduler_base> &scheduler, task<U> coroutine_task);
+	public:
+		typedef detail::task_promise<T> promise_type;
+
+		task(task &&other): _handle(other._handle)
+		{
+			other._handle = std::coroutine_handle<promise_type>();
+		}
+		~task()
+		{
+			if(_handle) _handle.destroy();
+		}
+		task& operator=(task &&other)
+		{
+			if(this != &other)
+			{
+				if(_handle) _handle.destroy();
+				_handle = other._handle;
+				other._handle = std::coroutine_handle<promise_type>();
+			}
+			return *this;
+		}
+		task(const task &) = delete;
+		task& operator=(const task &) = delete;
+	private:
+		explicit task(std::coroutine_handle<promise_type> handle): _handle(handle)
+		{}
+
+		std::coroutine_handle<promise_type> _handle;
+	};
+
+	namespace detail
+	{
+		task<void> task_promise<void>::get_return_object()
+		{
+			return task<void>(std::coroutine_handle<task<void>::promise_type>::from_promise(*this));
+		}
+	}
+
+	/* Starts running a task on scheduler.  Every time the task resumes from a co_await, it
+	runs as a separate method request posted to the scheduler, so a single scheduler thread
+	can interleave any number of suspended tasks.  The returned future receives the task's
+	return value, or the exception which escaped it.  The task only holds a weak reference
+	to the scheduler, if the scheduler is gone when the task is due to resume, the task is
+	destroyed and its future gets an uncertain_future exception. */
+	template<typename T>
+	future<T> spawn(const boost::shared_ptr<scheduler_base> &scheduler, task<T> coroutine_task)
+	{
+		std::coroutine_handle<typename task<T>::promise_type> handle = coroutine_task._handle;
+		coroutine_task._handle = std::coroutine_handle<typename task<T>::promise_type>();
+		future<T> result = handle.promise().result();
+		handle.promise().set_scheduler(scheduler);
+		scheduler->post_method_request(boost::shared_ptr<method_request_base>(
+			new detail::coroutine_resume_request(handle)));
+		return result;
+	}
+}
+
+#endif // _POET_COROUTINE_HPP
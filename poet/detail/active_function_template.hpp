@@ -34,9 +34,15 @@
 // typename poet::future<boost::function_traits<Signature>::argn_type> _argn ;
 #define POET_ACTIVE_FUNCTION_ARG_DECLARATION(z, n, Signature) POET_ACTIVE_FUNCTION_ARG_TYPE(~, n, Signature) \
 	POET_ARG_NAME(~, n, _arg) ;
-// tupleName.get < n >()
+// && (_argn.ready() || _argn.has_exception())
+#define POET_ACTIVE_FUNCTION_ARG_COMPLETE(z, n, arg_name) \
+	&& (POET_ARG_NAME(~, n, arg_name).ready() || POET_ARG_NAME(~, n, arg_name).has_exception())
+// detail::inherit_priority(_argn, priority);
+#define POET_ACTIVE_FUNCTION_INHERIT_PRIORITY(z, n, arg_name) \
+	detail::inherit_priority(POET_ARG_NAME(~, n, arg_name), priority);
+// boost::get < n >(tupleName)
 #define POET_ACTIVE_FUNCTION_GET_TUPLE_ELEMENT(z, n, tupleName) \
-	tupleName.get< n >()
+	boost::get< n >(tupleName)
 
 namespace poet
 {
@@ -58,32 +64,75 @@ namespace poet
 				_passive_function(passive_function)
 			{}
 			virtual ~POET_AF_METHOD_REQUEST_CLASS_NAME()
-			{}
+			{
+				// threads waiting on the result can't lend us their priority any more
+				get_future_body(future<passive_result_type>(_return_value))->clear_producer();
+			}
 
 			virtual void run()
 			{
-				try
+				// the result was cancelled before we got to run, for example by with_deadline
+				if(future<passive_result_type>(_return_value).has_exception()) return;
+				if(this->lends_wait_priority())
 				{
-					passive_result_type *resolver = 0;
-					m_run(resolver);
-				}
-				catch(...)
+					// futures the passive function waits on inherit our priority
+					scoped_wait_priority wait_priority(this->priority());
+					run_passive_function();
+				}else
 				{
-					_return_value.renege(current_exception());
+					run_passive_function();
 				}
 			}
 			virtual future<void> scheduling_guard() const
 			{
 #if POET_ACTIVE_FUNCTION_NUM_ARGS == 0
-				future<int> ready_future = 1;
-				return ready_future;
+				return ready_scheduling_guard();
 #elif POET_ACTIVE_FUNCTION_NUM_ARGS == 1
 				return _arg1;
 #else
 				return future_barrier(POET_REPEATED_ARG_NAMES(POET_ACTIVE_FUNCTION_NUM_ARGS, _arg));
 #endif
 			}
+			virtual void cancel(const exception_ptr &exception)
+			{
+				_return_value.renege(exception);
+			}
+			virtual bool cancellable() const
+			{
+				return true;
+			}
+			virtual bool scheduling_guard_complete() const
+			{
+				return true BOOST_PP_REPEAT(POET_ACTIVE_FUNCTION_NUM_ARGS, POET_ACTIVE_FUNCTION_ARG_COMPLETE, _arg);
+			}
+			// the requests producing our arguments have to run before we can
+			virtual void inherit_priority(int priority)
+			{
+				if(priority <= this->priority()) return;
+				method_request_base::inherit_priority(priority);
+				BOOST_PP_REPEAT(POET_ACTIVE_FUNCTION_NUM_ARGS, POET_ACTIVE_FUNCTION_INHERIT_PRIORITY, _arg)
+			}
+		protected:
+			// requests created by active functions come from recycled memory
+			virtual void destroy()
+			{
+				recycling_allocator<POET_AF_METHOD_REQUEST_CLASS_NAME> allocator;
+				allocator.destroy(this);
+				allocator.deallocate(this, 1);
+			}
 		private:
+			void run_passive_function()
+			{
+				try
+				{
+					passive_result_type *resolver = 0;
+					m_run(resolver);
+				}
+				catch(...)
+				{
+					_return_value.renege(current_exception());
+				}
+			}
 			void m_run(void *)
 			{
 				(*_passive_function)(
@@ -114,12 +163,12 @@ namespace poet
 			typedef future<passive_result_type> result_type;
 			typedef boost::signals2::slot<Signature> passive_slot_type;
 
-			POET_ACTIVE_FUNCTION_CLASS_NAME()
+			POET_ACTIVE_FUNCTION_CLASS_NAME(): _priority(0), _timeout(boost::posix_time::pos_infin), _inline_calls(false)
 			{}
 			POET_ACTIVE_FUNCTION_CLASS_NAME(const passive_slot_type &passive_function,
 				boost::shared_ptr<scheduler_base> scheduler_in):
 				_passive_function(new passive_slot_type(passive_function)),
-				_scheduler(scheduler_in)
+				_scheduler(scheduler_in), _priority(0), _timeout(boost::posix_time::pos_infin), _inline_calls(false)
 			{
 				if(_scheduler == 0) _scheduler.reset(new scheduler);
 			}
@@ -127,27 +176,109 @@ namespace poet
 			result_type operator ()(POET_ACTIVE_FUNCTION_FULL_ARGS(POET_ACTIVE_FUNCTION_NUM_ARGS, Signature))
 			{
 				promise<passive_result_type> returnValue;
-				boost::shared_ptr<POET_AF_METHOD_REQUEST_CLASS_NAME<Signature> > methodRequest(
-					new POET_AF_METHOD_REQUEST_CLASS_NAME<Signature>(
-					returnValue, POET_REPEATED_ARG_NAMES(POET_ACTIVE_FUNCTION_NUM_ARGS, arg) BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS)
-					_passive_function));
-				_scheduler->post_method_request(methodRequest);
+				call(returnValue BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS) POET_REPEATED_ARG_NAMES(POET_ACTIVE_FUNCTION_NUM_ARGS, arg));
 				return returnValue;
 			}
 			result_type operator ()(POET_ACTIVE_FUNCTION_FULL_ARGS(POET_ACTIVE_FUNCTION_NUM_ARGS, Signature)) const
 			{
 				promise<passive_result_type> returnValue;
-				boost::shared_ptr<POET_AF_METHOD_REQUEST_CLASS_NAME<Signature> > methodRequest(
-					new POET_AF_METHOD_REQUEST_CLASS_NAME<Signature>(
-					returnValue, POET_REPEATED_ARG_NAMES(POET_ACTIVE_FUNCTION_NUM_ARGS, arg) BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS)
-					_passive_function));
-				_scheduler->post_method_request(methodRequest);
+				call(returnValue BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS) POET_REPEATED_ARG_NAMES(POET_ACTIVE_FUNCTION_NUM_ARGS, arg));
 				return returnValue;
 			}
+			/* Calls the active function once for each element of [begin, end), which should be
+			boost::tuples of the arguments (or things convertible to them), and posts all the
+			method requests to the scheduler in one batch. */
+			template<typename InputIterator>
+			std::vector<result_type> call_range(InputIterator begin, InputIterator end) const
+			{
+				std::vector<result_type> results;
+				std::vector<boost::shared_ptr<method_request_base> > methodRequests;
+				for(; begin != end; ++begin)
+				{
+					promise<passive_result_type> returnValue;
+					methodRequests.push_back(create_method_request(returnValue
+						BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS)
+						BOOST_PP_ENUM(POET_ACTIVE_FUNCTION_NUM_ARGS, POET_ACTIVE_FUNCTION_GET_TUPLE_ELEMENT, (*begin))));
+					results.push_back(returnValue);
+				}
+				_scheduler->post_method_requests(methodRequests);
+				return results;
+			}
 			bool expired() const {return _passive_function.expired();}
+			// priority given to the method requests created by subsequent calls
+			void set_priority(int priority) {_priority = priority;}
+			int priority() const {return _priority;}
+			/* ordering key given to the method requests created by subsequent calls, used by
+			keyed_activation_queue.  Copies of an active_function may each have their own key. */
+			void set_ordering_key(const boost::optional<std::size_t> &key) {_ordering_key = key;}
+			const boost::optional<std::size_t>& ordering_key() const {return _ordering_key;}
+			/* method requests created by subsequent calls get a deadline this long after the
+			call is made. */
+			void set_timeout(const boost::posix_time::time_duration &timeout) {_timeout = timeout;}
+			const boost::posix_time::time_duration& timeout() const {return _timeout;}
+			/* If enabled, a call made from a thread which is running one of the scheduler's
+			method requests, with arguments which are all complete, runs the passive function
+			right away instead of posting a method request, and returns a complete future.
+			Such a call jumps ahead of any requests already waiting in the scheduler's
+			activation queue.  Disabled by default. */
+			void set_inline_calls(bool enable) {_inline_calls = enable;}
+			bool inline_calls() const {return _inline_calls;}
 		private:
+			void call(const promise<passive_result_type> &returnValue
+				BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS) POET_ACTIVE_FUNCTION_FULL_ARGS(POET_ACTIVE_FUNCTION_NUM_ARGS, Signature)) const
+			{
+				if(_inline_calls && (true BOOST_PP_REPEAT(POET_ACTIVE_FUNCTION_NUM_ARGS, POET_ACTIVE_FUNCTION_ARG_COMPLETE, arg)) &&
+					_scheduler->running_in_this_thread())
+				{
+					POET_AF_METHOD_REQUEST_CLASS_NAME<Signature> methodRequest(returnValue,
+						POET_REPEATED_ARG_NAMES(POET_ACTIVE_FUNCTION_NUM_ARGS, arg) BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS)
+						_passive_function);
+					methodRequest.run();
+					return;
+				}
+				_scheduler->post_method_request(create_method_request(returnValue
+					BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS) POET_REPEATED_ARG_NAMES(POET_ACTIVE_FUNCTION_NUM_ARGS, arg)));
+			}
+			boost::shared_ptr<method_request_base> create_method_request(const promise<passive_result_type> &returnValue
+				BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS) POET_ACTIVE_FUNCTION_FULL_ARGS(POET_ACTIVE_FUNCTION_NUM_ARGS, Signature)) const
+			{
+				typedef POET_AF_METHOD_REQUEST_CLASS_NAME<Signature> request_type;
+				recycling_allocator<request_type> allocator;
+				request_type *block = allocator.allocate(1);
+				request_type *methodRequest;
+				try
+				{
+					methodRequest = new(block) request_type(returnValue,
+						POET_REPEATED_ARG_NAMES(POET_ACTIVE_FUNCTION_NUM_ARGS, arg) BOOST_PP_COMMA_IF(POET_ACTIVE_FUNCTION_NUM_ARGS)
+						_passive_function);
+				}
+				catch(...)
+				{
+					allocator.deallocate(block, 1);
+					throw;
+				}
+				/* The request is reference counted intrusively, so the result's future body can
+				point back at it without keeping it alive.  The shared_ptr we post holds one
+				reference, and its control block comes from recycled memory too. */
+				methodRequest->add_reference();
+				boost::shared_ptr<method_request_base> result(methodRequest, &intrusive_ptr_release, allocator);
+				methodRequest->set_priority(_priority);
+				methodRequest->set_ordering_key(_ordering_key);
+				// lets threads waiting on the result lend the request their priority
+				get_future_body(future<passive_result_type>(returnValue))->set_producer(methodRequest);
+				if(_timeout.is_pos_infinity() == false)
+				{
+					methodRequest->set_deadline(boost::get_system_time() + _timeout);
+				}
+				return result;
+			}
+
 			boost::shared_ptr<passive_slot_type> _passive_function;
 			boost::shared_ptr<scheduler_base> _scheduler;
+			int _priority;
+			boost::optional<std::size_t> _ordering_key;
+			boost::posix_time::time_duration _timeout;
+			bool _inline_calls;
 		};
 
 		template<unsigned arity, typename Signature> class active_functionN;
@@ -167,4 +298,6 @@ namespace poet
 #undef POET_ACTIVE_FUNCTION_FULL_ARG
 #undef POET_ACTIVE_FUNCTION_FULL_ARGS
 #undef POET_ACTIVE_FUNCTION_ARG_DECLARATION
+#undef POET_ACTIVE_FUNCTION_ARG_COMPLETE
+#undef POET_ACTIVE_FUNCTION_INHERIT_PRIORITY
 #undef POET_ACTIVE_FUNCTION_GET_TUPLE_ELEMENT
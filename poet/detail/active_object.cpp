@@ -10,146 +10,804 @@
 #include <boost/bind.hpp>
 #include <boost/thread/thread_time.hpp>
 #include <cassert>
+#include <poet/detail/future_continuation.hpp>
 #include <poet/detail/nonvoid.hpp>
 #include <poet/future_barrier.hpp>
 #include <poet/future_select.hpp>
 
 namespace poet
 {
-	namespace detail
+	void in_order_activation_queue::push_back(const boost::shared_ptr<method_request_base> &request)
 	{
-		inline boost::shared_ptr<method_request_base> method_request_future_combiner(const boost::shared_ptr<method_request_base> &request, null_type)
-		{
-			return request;
-		};
-		inline exception_ptr method_request_future_exception_handler(const boost::shared_ptr<method_request_base> &request,
-			const exception_ptr &)
-		{
-			exception_ptr ep = poet::copy_exception(request);
-			return ep;
-		};
+		++_size;
+		_queue.push(request);
+		_wakeup->notify();
+		(*_ready_hook)();
+	}
 
-		inline future<boost::shared_ptr<method_request_base> > make_method_request_future(
-			const boost::shared_ptr<method_request_base> &request)
+	void in_order_activation_queue::push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests)
+	{
+		if(requests.empty()) return;
+		_size += requests.size();
+		std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+		for(it = requests.begin(); it != requests.end(); ++it)
 		{
-			BOOST_ASSERT(request);
-			return future_combining_barrier<boost::shared_ptr<method_request_base> >(
-				boost::bind(&method_request_future_combiner, request, _1),
-				boost::bind(&method_request_future_exception_handler, request, _1),
-				request->scheduling_guard());
+			_queue.push(*it);
 		}
+		_wakeup->notify();
+		(*_ready_hook)();
 	}
 
-	void in_order_activation_queue::push_back(const boost::shared_ptr<method_request_base> &request)
+	void in_order_activation_queue::front_guard_completed(const boost::shared_ptr<detail::event_count> &wakeup,
+		const boost::shared_ptr<detail::ready_hook> &ready_hook)
 	{
-		boost::unique_lock<boost::mutex> lock(_mutex);
-		if(_pendingRequests.empty())
-			_next_method_request.fulfill(detail::make_method_request_future(request));
-		_pendingRequests.push_back(request);
+		wakeup->notify();
+		(*ready_hook)();
 	}
 
-	boost::shared_ptr<method_request_base> in_order_activation_queue::get_request()
+	boost::shared_ptr<method_request_base> in_order_activation_queue::try_pop_ready()
 	{
-		future<boost::shared_ptr<method_request_base> > next;
+		method_request_base *front = _queue.front();
+		if(front == 0) return boost::shared_ptr<method_request_base>();
+		if(front != _guarded_front)
 		{
-			boost::unique_lock<boost::mutex> lock(_mutex);
-			next = future_select<boost::shared_ptr<method_request_base> >(_next_method_request, _wake_promise);
+			if(front->scheduling_guard_complete())
+			{
+				boost::shared_ptr<method_request_base> result = _queue.pop();
+				--_size;
+				return result;
+			}
+			_guarded_front = front;
+			_front_guard = front->scheduling_guard();
+			_front_guard_watched = false;
 		}
-		boost::shared_ptr<method_request_base> result;
-		try
+		if(_front_guard.ready() || _front_guard.has_exception())
 		{
-			result = next.get();
+			_guarded_front = 0;
+			_front_guard = future<void>();
+			boost::shared_ptr<method_request_base> result = _queue.pop();
+			--_size;
+			return result;
 		}
-		catch(const boost::shared_ptr<method_request_base> &method_request)
+		if(_front_guard_watched == false)
 		{
-			result = method_request;
+			detail::when_complete(_front_guard,
+				boost::bind(&in_order_activation_queue::front_guard_completed, _wakeup, _ready_hook));
+			_front_guard_watched = true;
 		}
-		catch(const std::exception &err)
+		return boost::shared_ptr<method_request_base>();
+	}
+
+	boost::shared_ptr<method_request_base> in_order_activation_queue::get_request()
+	{
+		while(true)
 		{
-			std::cerr << "caught unexpected exception: " << err.what() << std::endl;
-			BOOST_ASSERT(false);
+			/* read the count before checking anything, so a push, wake, or guard completion
+			which happens after the checks makes the wait return immediately. */
+			const detail::event_count::count_type count = _wakeup->count();
+			/* _wake_pending makes sure a wake() which arrives just before a dispatcher
+			thread starts waiting in get_request() is not lost. */
+			if(_wake_pending.exchange(false))
+			{
+				return boost::shared_ptr<method_request_base>();
+			}
+			boost::shared_ptr<method_request_base> result = try_pop_ready();
+			if(result) return result;
+			_wakeup->wait(count);
 		}
-		catch(...)
+	}
+
+	activation_queue_base::size_type in_order_activation_queue::get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		if(max_requests == 0) return 0;
+		boost::shared_ptr<method_request_base> request = get_request();
+		size_type count = 0;
+		while(request)
 		{
-			BOOST_ASSERT(false);
+			requests.push_back(request);
+			if(++count == max_requests) break;
+			request = try_pop_ready();
 		}
-		if(result)
+		return count;
+	}
+
+	activation_queue_base::size_type in_order_activation_queue::try_get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		size_type count = 0;
+		while(count < max_requests)
 		{
-			boost::unique_lock<boost::mutex> lock(_mutex);
-			_pendingRequests.pop_front();
-			_next_method_request.reset();
-			if(_pendingRequests.empty() == false)
-				_next_method_request.fulfill(detail::make_method_request_future(_pendingRequests.front()));
+			boost::shared_ptr<method_request_base> request = try_pop_ready();
+			if(!request) break;
+			requests.push_back(request);
+			++count;
 		}
-		return result;
+		return count;
 	}
 
 	void in_order_activation_queue::wake()
 	{
-		boost::unique_lock<boost::mutex> lock(_mutex);
-		_wake_promise.fulfill(boost::shared_ptr<method_request_base>());
-		_wake_promise.reset();
+		_wake_pending.store(true);
+		_wakeup->notify();
 	}
 
 	void out_of_order_activation_queue::push_back(const boost::shared_ptr<method_request_base> &request)
 	{
-		_selector.push(detail::make_method_request_future(request));
+		++_size;
+		if(request->scheduling_guard_complete())
+		{
+			_ready->push(request);
+		}else
+		{
+			detail::when_complete(request->scheduling_guard(),
+				boost::bind(&detail::ready_request_queue::push, _ready, request));
+		}
+	}
+
+	void out_of_order_activation_queue::push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests)
+	{
+		if(requests.empty()) return;
+		_size += requests.size();
+		bool pushed_ready = false;
+		std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+		for(it = requests.begin(); it != requests.end(); ++it)
+		{
+			if((*it)->scheduling_guard_complete())
+			{
+				_ready->push_without_notify(*it);
+				pushed_ready = true;
+			}else
+			{
+				detail::when_complete((*it)->scheduling_guard(),
+					boost::bind(&detail::ready_request_queue::push, _ready, *it));
+			}
+		}
+		if(pushed_ready) _ready->notify();
 	}
 
 	boost::shared_ptr<method_request_base> out_of_order_activation_queue::get_request()
 	{
-		future<boost::shared_ptr<method_request_base> > next;
+		while(true)
+		{
+			const detail::event_count::count_type count = _ready->wakeup().count();
+			if(_wake_pending.exchange(false))
+			{
+				return boost::shared_ptr<method_request_base>();
+			}
+			boost::shared_ptr<method_request_base> result = _ready->try_pop();
+			if(result)
+			{
+				--_size;
+				return result;
+			}
+			_ready->wakeup().wait(count);
+		}
+	}
+
+	activation_queue_base::size_type out_of_order_activation_queue::get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		if(max_requests == 0) return 0;
+		boost::shared_ptr<method_request_base> request = get_request();
+		size_type count = 0;
+		while(request)
+		{
+			requests.push_back(request);
+			if(++count == max_requests) break;
+			request = _ready->try_pop();
+			if(request) --_size;
+		}
+		return count;
+	}
+
+	activation_queue_base::size_type out_of_order_activation_queue::try_get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		size_type count = 0;
+		while(count < max_requests)
+		{
+			boost::shared_ptr<method_request_base> request = _ready->try_pop();
+			if(!request) break;
+			--_size;
+			requests.push_back(request);
+			++count;
+		}
+		return count;
+	}
+
+	void out_of_order_activation_queue::wake()
+	{
+		_wake_pending.store(true);
+		_ready->wakeup().notify();
+	}
+
+	void method_request_base::inherit_priority(int priority)
+	{
+		int old_priority = _priority.load();
+		do
+		{
+			if(priority <= old_priority) return;
+		}while(_priority.compare_exchange_weak(old_priority, priority) == false);
+		const boost::shared_ptr<detail::ordered_ready_queue<int, std::less<int> > > queue = _priority_queue.lock();
+		if(queue) queue->raise_key(this, priority);
+	}
+
+	/* The priority may be raised by inherit_priority() while we push.  If it was raised
+	after we read it, but before the request was in the heap, we raise the key ourselves. */
+	void priority_activation_queue::push_ready(const boost::shared_ptr<ready_queue_type> &ready,
+		const boost::shared_ptr<method_request_base> &request, unsigned long sequence)
+	{
+		const int priority = request->priority();
+		ready->push(request, priority, sequence);
+		if(request->priority() != priority) ready->raise_key(request.get(), request->priority());
+	}
+
+	void priority_activation_queue::push_back(const boost::shared_ptr<method_request_base> &request)
+	{
+		++_size;
+		const unsigned long sequence = _sequence++;
+		detail::method_request_access::set_priority_queue(*request, _ready);
+		if(request->scheduling_guard_complete())
+		{
+			push_ready(_ready, request, sequence);
+		}else
+		{
+			// the priority is read when the guard completes, it may have been raised by then
+			detail::when_complete(request->scheduling_guard(),
+				boost::bind(&priority_activation_queue::push_ready, _ready, request, sequence));
+		}
+	}
+
+	void priority_activation_queue::push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests)
+	{
+		if(requests.empty()) return;
+		_size += requests.size();
+		unsigned long sequence = _sequence.fetch_add(requests.size());
+		std::vector<ready_queue_type::entry> ready;
+		std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+		for(it = requests.begin(); it != requests.end(); ++it, ++sequence)
+		{
+			detail::method_request_access::set_priority_queue(**it, _ready);
+			if((*it)->scheduling_guard_complete())
+			{
+				ready_queue_type::entry new_entry;
+				new_entry.key = (*it)->priority();
+				new_entry.sequence = sequence;
+				new_entry.request = *it;
+				ready.push_back(new_entry);
+			}else
+			{
+				detail::when_complete((*it)->scheduling_guard(),
+					boost::bind(&priority_activation_queue::push_ready, _ready, *it, sequence));
+			}
+		}
+		_ready->push_range(ready);
+		// catch up with priorities raised while we were pushing, like push_ready()
+		std::vector<ready_queue_type::entry>::const_iterator entry_it;
+		for(entry_it = ready.begin(); entry_it != ready.end(); ++entry_it)
+		{
+			const int priority = entry_it->request->priority();
+			if(priority != entry_it->key) _ready->raise_key(entry_it->request.get(), priority);
+		}
+	}
+
+	void deadline_activation_queue::push_back(const boost::shared_ptr<method_request_base> &request)
+	{
+		++_size;
+		const unsigned long sequence = _sequence++;
+		if(request->scheduling_guard_complete())
+		{
+			_ready->push(request, request->deadline(), sequence);
+		}else
+		{
+			detail::when_complete(request->scheduling_guard(),
+				boost::bind(&ready_queue_type::push, _ready, request, request->deadline(), sequence));
+		}
+	}
+
+	void deadline_activation_queue::push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests)
+	{
+		if(requests.empty()) return;
+		_size += requests.size();
+		unsigned long sequence = _sequence.fetch_add(requests.size());
+		std::vector<ready_queue_type::entry> ready;
+		std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+		for(it = requests.begin(); it != requests.end(); ++it, ++sequence)
+		{
+			if((*it)->scheduling_guard_complete())
+			{
+				ready_queue_type::entry new_entry;
+				new_entry.key = (*it)->deadline();
+				new_entry.sequence = sequence;
+				new_entry.request = *it;
+				ready.push_back(new_entry);
+			}else
+			{
+				detail::when_complete((*it)->scheduling_guard(),
+					boost::bind(&ready_queue_type::push, _ready, *it, (*it)->deadline(), sequence));
+			}
+		}
+		_ready->push_range(ready);
+	}
+
+	activation_queue_base::size_type deadline_activation_queue::get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		const std::vector<boost::shared_ptr<method_request_base> >::size_type start = requests.size();
+		while(true)
+		{
+			const size_type count = _ready->get_requests(requests, max_requests);
+			_size -= count;
+			// count is zero if we were woken
+			if(count == 0) return 0;
+			// go back to waiting if every request we got was late
+			if(shed_late_requests(requests, start) > 0) return requests.size() - start;
+		}
+	}
+
+	activation_queue_base::size_type deadline_activation_queue::try_get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		const std::vector<boost::shared_ptr<method_request_base> >::size_type start = requests.size();
+		const size_type count = _ready->try_get_requests(requests, max_requests);
+		_size -= count;
+		if(count == 0) return 0;
+		return shed_late_requests(requests, start);
+	}
+
+	/* Cancels and removes the late, cancellable requests from the end of requests, starting at
+	index first.  Returns the number of requests left after first. */
+	activation_queue_base::size_type deadline_activation_queue::shed_late_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests,
+		std::vector<boost::shared_ptr<method_request_base> >::size_type first)
+	{
+		if(_shed_late_requests == false) return requests.size() - first;
+		const boost::system_time now = boost::get_system_time();
+		std::vector<boost::shared_ptr<method_request_base> >::iterator out = requests.begin() + first;
+		std::vector<boost::shared_ptr<method_request_base> >::iterator it;
+		for(it = requests.begin() + first; it != requests.end(); ++it)
+		{
+			if((*it)->deadline() < now && (*it)->cancellable())
+			{
+				(*it)->cancel(poet::copy_exception(deadline_expired()));
+			}else
+			{
+				*out++ = *it;
+			}
+		}
+		requests.erase(out, requests.end());
+		return requests.size() - first;
+	}
+
+	void keyed_activation_queue::push_back(const boost::shared_ptr<method_request_base> &request)
+	{
+		++_size;
+		push(request, _sequence++);
+	}
+
+	void keyed_activation_queue::push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests)
+	{
+		if(requests.empty()) return;
+		_size += requests.size();
+		unsigned long sequence = _sequence.fetch_add(requests.size());
+		std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+		for(it = requests.begin(); it != requests.end(); ++it, ++sequence)
+		{
+			push(*it, sequence);
+		}
+	}
+
+	void keyed_activation_queue::push(const boost::shared_ptr<method_request_base> &request, unsigned long sequence)
+	{
+		const bool guard_complete = request->scheduling_guard_complete();
+		if(!request->ordering_key())
+		{
+			if(guard_complete)
+			{
+				_chains->ready()->push(request, 0, sequence);
+			}else
+			{
+				detail::when_complete(request->scheduling_guard(),
+					boost::bind(&detail::keyed_request_chains::ready_queue_type::push, _chains->ready(), request, 0, sequence));
+			}
+			return;
+		}
+		const std::size_t key = *request->ordering_key();
+		_chains->push(request, key, sequence, guard_complete);
+		// the continuation may run right away, so it is added after the request is in its chain
+		if(guard_complete == false)
+		{
+			detail::when_complete(request->scheduling_guard(),
+				boost::bind(&detail::keyed_request_chains::guard_completed, _chains, request.get(), key));
+		}
+	}
+
+	bounded_activation_queue::bounded_activation_queue(const boost::shared_ptr<activation_queue_base> &queue,
+		size_type capacity, overflow_policy policy):
+		_queue(queue), _capacity(capacity > 0 ? capacity : 1), _policy(policy), _size(0)
+	{}
+
+	void bounded_activation_queue::push_back(const boost::shared_ptr<method_request_base> &request)
+	{
+		std::vector<boost::shared_ptr<method_request_base> > dropped;
 		{
 			boost::unique_lock<boost::mutex> lock(_mutex);
-			next = future_select<boost::shared_ptr<method_request_base> >(_selector.selected(), _wake_promise);
+			make_room(lock, 1, dropped);
+			++_size;
+			if(_policy == drop_oldest_on_overflow)
+			{
+				_queued_index[request.get()] = _queued.insert(_queued.end(), request);
+			}
 		}
-		boost::shared_ptr<method_request_base> result;
-		try
+		cancel_dropped(dropped);
+		_queue->push_back(request);
+	}
+
+	void bounded_activation_queue::push_back_range(const std::vector<boost::shared_ptr<method_request_base> > &requests)
+	{
+		if(requests.empty()) return;
+		std::vector<boost::shared_ptr<method_request_base> > dropped;
 		{
-			result = next.get();
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			make_room(lock, requests.size(), dropped);
+			_size += requests.size();
+			if(_policy == drop_oldest_on_overflow)
+			{
+				std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+				for(it = requests.begin(); it != requests.end(); ++it)
+				{
+					_queued_index[it->get()] = _queued.insert(_queued.end(), *it);
+				}
+			}
 		}
-		catch(const boost::shared_ptr<method_request_base> &method_request)
+		cancel_dropped(dropped);
+		_queue->push_back_range(requests);
+	}
+
+	/* Returns once num_requests more requests fit, after waiting, dropping, or throwing as the
+	overflow policy says.  The dropped requests are appended to dropped, for the caller to cancel
+	once _mutex is unlocked. */
+	void bounded_activation_queue::make_room(boost::unique_lock<boost::mutex> &lock, size_type num_requests,
+		std::vector<boost::shared_ptr<method_request_base> > &dropped)
+	{
+		// it would never fit
+		if(num_requests > _capacity) throw queue_full();
+		while(_size + num_requests > _capacity)
 		{
-			result = method_request;
+			switch(_policy)
+			{
+			case block_on_overflow:
+				break;
+			case fail_on_overflow:
+				throw queue_full();
+				break;
+			case drop_oldest_on_overflow:
+				if(drop_oldest(_size + num_requests - _capacity, dropped)) return;
+				// not enough can be dropped, so wait for space like block_on_overflow
+				break;
+			}
+			_space_condition.wait(lock);
 		}
-		catch(...)
+	}
+
+	/* Drops the num_requests oldest cancellable requests, or none of them if there aren't that
+	many.  Dropped requests stay in _queue until it gives them back, so we also stop dropping
+	once that would leave more than _capacity of them there.  _mutex must be locked. */
+	bool bounded_activation_queue::drop_oldest(size_type num_requests,
+		std::vector<boost::shared_ptr<method_request_base> > &dropped)
+	{
+		if(_dropped.size() + num_requests > _capacity) return false;
+		std::vector<request_list_type::iterator> oldest;
+		request_list_type::iterator it;
+		for(it = _queued.begin(); it != _queued.end() && oldest.size() < num_requests; ++it)
 		{
-			BOOST_ASSERT(false);
+			if((*it)->cancellable()) oldest.push_back(it);
 		}
-		if(result)
+		if(oldest.size() < num_requests) return false;
+		std::vector<request_list_type::iterator>::const_iterator oldest_it;
+		for(oldest_it = oldest.begin(); oldest_it != oldest.end(); ++oldest_it)
 		{
-			_selector.pop_selected();
+			dropped.push_back(**oldest_it);
+			_queued_index.erase((*oldest_it)->get());
+			_dropped.insert((*oldest_it)->get());
+			_queued.erase(*oldest_it);
+			--_size;
 		}
-		return result;
+		return true;
 	}
 
-	void out_of_order_activation_queue::wake()
+	void bounded_activation_queue::cancel_dropped(const std::vector<boost::shared_ptr<method_request_base> > &dropped)
+	{
+		std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+		for(it = dropped.begin(); it != dropped.end(); ++it)
+		{
+			(*it)->cancel(poet::copy_exception(queue_full()));
+		}
+	}
+
+	activation_queue_base::size_type bounded_activation_queue::get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		const std::vector<boost::shared_ptr<method_request_base> >::size_type start = requests.size();
+		while(true)
+		{
+			if(_queue->get_requests(requests, max_requests) == 0) return 0;
+			// go back to waiting if every request we got had been dropped
+			if(account_dequeued(requests, start) > 0) return requests.size() - start;
+		}
+	}
+
+	activation_queue_base::size_type bounded_activation_queue::try_get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		const std::vector<boost::shared_ptr<method_request_base> >::size_type start = requests.size();
+		if(_queue->try_get_requests(requests, max_requests) == 0) return 0;
+		return account_dequeued(requests, start);
+	}
+
+	/* Updates the bookkeeping for the requests taken from _queue, which are at the end of requests
+	starting at index first.  Removes the ones which had been dropped, and returns the number left. */
+	activation_queue_base::size_type bounded_activation_queue::account_dequeued(
+		std::vector<boost::shared_ptr<method_request_base> > &requests,
+		std::vector<boost::shared_ptr<method_request_base> >::size_type first)
+	{
+		std::vector<promise<void> > space_promises;
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			bool dropped_dequeued = false;
+			std::vector<boost::shared_ptr<method_request_base> >::iterator out = requests.begin() + first;
+			std::vector<boost::shared_ptr<method_request_base> >::iterator it;
+			for(it = requests.begin() + first; it != requests.end(); ++it)
+			{
+				if(_policy == drop_oldest_on_overflow)
+				{
+					// dropped requests were already cancelled and uncounted
+					if(_dropped.erase(it->get()))
+					{
+						dropped_dequeued = true;
+						continue;
+					}
+					std::map<const method_request_base *, request_list_type::iterator>::iterator index_it =
+						_queued_index.find(it->get());
+					BOOST_ASSERT(index_it != _queued_index.end());
+					_queued.erase(index_it->second);
+					_queued_index.erase(index_it);
+				}
+				--_size;
+				*out++ = *it;
+			}
+			requests.erase(out, requests.end());
+			if(_size < _capacity)
+			{
+				space_promises.swap(_space_promises);
+				_space_condition.notify_all();
+			}else if(dropped_dequeued)
+			{
+				// pushers which found too many dropped requests still in _queue may drop again
+				_space_condition.notify_all();
+			}
+		}
+		std::vector<promise<void> >::iterator promise_it;
+		for(promise_it = space_promises.begin(); promise_it != space_promises.end(); ++promise_it)
+		{
+			promise_it->fulfill();
+		}
+		return requests.size() - first;
+	}
+
+	future<void> bounded_activation_queue::space_available()
+	{
+		promise<void> space;
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			if(_size >= _capacity)
+			{
+				_space_promises.push_back(space);
+				return space;
+			}
+		}
+		space.fulfill();
+		return space;
+	}
+
+	codel_activation_queue::codel_activation_queue(const boost::shared_ptr<activation_queue_base> &queue,
+		const boost::posix_time::time_duration &target, const boost::posix_time::time_duration &interval):
+		_queue(queue), _target(target), _interval(interval), _drop_count(0),
+		_first_above_time(boost::posix_time::not_a_date_time), _drop_next(boost::posix_time::neg_infin),
+		_count(0), _last_count(0), _dropping(false)
+	{}
+
+	activation_queue_base::size_type codel_activation_queue::get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		const std::vector<boost::shared_ptr<method_request_base> >::size_type start = requests.size();
+		while(true)
+		{
+			if(_queue->get_requests(requests, max_requests) == 0) return 0;
+			if(shed_overload(requests, start) > 0) return requests.size() - start;
+		}
+	}
+
+	activation_queue_base::size_type codel_activation_queue::try_get_requests(
+		std::vector<boost::shared_ptr<method_request_base> > &requests, size_type max_requests)
+	{
+		const std::vector<boost::shared_ptr<method_request_base> >::size_type start = requests.size();
+		if(_queue->try_get_requests(requests, max_requests) == 0) return 0;
+		return shed_overload(requests, start);
+	}
+
+	/* Cancels and removes the requests CoDel decides to drop from the end of requests, starting
+	at index first.  Returns the number of requests left after first. */
+	activation_queue_base::size_type codel_activation_queue::shed_overload(
+		std::vector<boost::shared_ptr<method_request_base> > &requests,
+		std::vector<boost::shared_ptr<method_request_base> >::size_type first)
+	{
+		const boost::system_time now = boost::get_system_time();
+		std::vector<boost::shared_ptr<method_request_base> >::iterator out = requests.begin() + first;
+		std::vector<boost::shared_ptr<method_request_base> >::iterator it;
+		for(it = requests.begin() + first; it != requests.end(); ++it)
+		{
+			if(should_drop(now, now - (*it)->enqueue_time(), (*it)->cancellable()))
+			{
+				++_drop_count;
+				(*it)->cancel(poet::copy_exception(overloaded()));
+			}else
+			{
+				*out++ = *it;
+			}
+		}
+		requests.erase(out, requests.end());
+		return requests.size() - first;
+	}
+
+	/* Requests which aren't cancellable still count towards whether the queue is overloaded,
+	but are never dropped.  The drop CoDel would have made is left for the next cancellable request. */
+	bool codel_activation_queue::should_drop(const boost::system_time &now,
+		const boost::posix_time::time_duration &sojourn_time, bool cancellable)
+	{
+		bool ok_to_drop = false;
+		if(sojourn_time < _target || _queue->empty())
+		{
+			// the queue is draining fine, or there is nothing left behind this request
+			_first_above_time = boost::posix_time::not_a_date_time;
+		}else if(_first_above_time.is_not_a_date_time())
+		{
+			_first_above_time = now + _interval;
+		}else if(now >= _first_above_time)
+		{
+			ok_to_drop = true;
+		}
+
+		if(_dropping)
+		{
+			if(ok_to_drop == false)
+			{
+				_dropping = false;
+				return false;
+			}
+			if(now >= _drop_next && cancellable)
+			{
+				++_count;
+				_drop_next = control_law(_drop_next);
+				return true;
+			}
+			return false;
+		}
+		if(ok_to_drop && cancellable)
+		{
+			_dropping = true;
+			/* As in RFC 8289, if we were dropping recently, start again from the number of
+			drops made during the last dropping state instead of starting over. */
+			const unsigned delta = _count - _last_count;
+			if(delta > 1 && now - _drop_next < _interval * 16)
+			{
+				_count = delta;
+			}else
+			{
+				_count = 1;
+			}
+			_drop_next = control_law(now);
+			_last_count = _count;
+			return true;
+		}
+		return false;
+	}
+
+	boost::system_time codel_activation_queue::control_law(const boost::system_time &t) const
 	{
-		boost::unique_lock<boost::mutex> lock(_mutex);
-		_wake_promise.fulfill(boost::shared_ptr<method_request_base>());
-		_wake_promise.reset();
+		return t + boost::posix_time::microseconds(
+			static_cast<long>(_interval.total_microseconds() / std::sqrt(static_cast<double>(_count))));
 	}
 
 	namespace detail
 	{
+		// keyed_request_chains
+
+		void keyed_request_chains::push(const boost::shared_ptr<method_request_base> &request, std::size_t key,
+			unsigned long sequence, bool guard_complete)
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			chain_map_type::iterator chain = _chains.find(key);
+			if(chain == _chains.end())
+			{
+				// nothing with the same key is waiting ahead of the request
+				if(guard_complete)
+				{
+					_ready->push(request, 0, sequence);
+					return;
+				}
+				chain = _chains.insert(chain_map_type::value_type(key, std::deque<link>())).first;
+			}
+			link new_link;
+			new_link.request = request;
+			new_link.sequence = sequence;
+			new_link.guard_complete = guard_complete;
+			chain->second.push_back(new_link);
+		}
+
+		void keyed_request_chains::guard_completed(const boost::shared_ptr<keyed_request_chains> &chains,
+			const method_request_base *request, std::size_t key)
+		{
+			boost::unique_lock<boost::mutex> lock(chains->_mutex);
+			chain_map_type::iterator chain = chains->_chains.find(key);
+			BOOST_ASSERT(chain != chains->_chains.end());
+			std::deque<link>::iterator it;
+			for(it = chain->second.begin(); it != chain->second.end(); ++it)
+			{
+				if(it->request.get() == request)
+				{
+					it->guard_complete = true;
+					break;
+				}
+			}
+			BOOST_ASSERT(it != chain->second.end());
+			chains->release_ready_front(chain);
+		}
+
+		/* _mutex must be locked.  The released requests are pushed onto the ready queue
+		before we unlock, so a later request with the same key can't get there first. */
+		void keyed_request_chains::release_ready_front(chain_map_type::iterator chain)
+		{
+			std::deque<link> &links = chain->second;
+			while(links.empty() == false && links.front().guard_complete)
+			{
+				_ready->push(links.front().request, 0, links.front().sequence);
+				links.pop_front();
+			}
+			if(links.empty()) _chains.erase(chain);
+		}
+
 		// scheduler_impl
 
-		scheduler_impl::scheduler_impl(const boost::shared_ptr<activation_queue_base> &activationQueue):
-			_activationQueue(activationQueue), _mortallyWounded(false),
-			_detached(false)
+		scheduler_impl::scheduler_impl(const boost::shared_ptr<activation_queue_base> &activationQueue,
+			const scheduler_attributes &attributes):
+			_activationQueue(activationQueue), _attributes(attributes), _dispatch_slot(new dispatch_slot()),
+			_mortallyWounded(false), _detached(false)
 		{
 		}
 
 		void scheduler_impl::post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
 		{
+			if(_attributes.get_statistics())
+			{
+				methodRequest->set_enqueue_time(boost::get_system_time());
+			}
 			_activationQueue->push_back(methodRequest);
 		}
 
-		bool scheduler_impl::dispatch()
+		void scheduler_impl::post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
 		{
-			boost::shared_ptr<method_request_base> methodRequest = _activationQueue->get_request();
-			if(methodRequest) methodRequest->run();
-			return methodRequest.get() != 0;
+			if(_attributes.get_statistics())
+			{
+				const boost::system_time now = boost::get_system_time();
+				std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+				for(it = methodRequests.begin(); it != methodRequests.end(); ++it)
+				{
+					(*it)->set_enqueue_time(now);
+				}
+			}
+			_activationQueue->push_back_range(methodRequests);
 		}
 
 		void scheduler_impl::dispatcherThreadFunction(const boost::shared_ptr<scheduler_impl> &shared_this_in)
@@ -157,54 +815,181 @@ namespace poet
 			/* shared_this insures scheduler_impl object is not destroyed while its scheduler thread is still
 			running. */
 			boost::shared_ptr<scheduler_impl> shared_this = shared_this_in;
-			while(shared_this->mortallyWounded() == false)
+			if(shared_this->_attributes.get_cpu_set().empty() == false)
+			{
+				/* Pinning is best effort.  Since Linux allocates memory pages on the node of
+				the thread which first touches them, memory allocated by method requests
+				running here is node-local too. */
+				set_current_thread_affinity(shared_this->_attributes.get_cpu_set());
+			}
+			current_scheduler().reset(shared_this.get());
+			if(shared_this->_attributes.get_help_while_waiting())
+			{
+				current_wait_helper().reset(shared_this.get());
+			}
+			const unsigned batch_size = shared_this->_attributes.get_batch_size();
+			scheduler_statistics *const statistics = shared_this->_attributes.get_statistics().get();
+			std::vector<boost::shared_ptr<method_request_base> > batch;
+			batch.reserve(batch_size);
+			while(true)
 			{
-				boost::shared_ptr<method_request_base> next_request = shared_this->_activationQueue->get_request();
-				if(shared_this->mortallyWounded()) break;
-				try
 				{
-					if(next_request) next_request->run();
+					dispatch_slot::scoped_acquire dispatch_lock(*shared_this->_dispatch_slot);
+					if(shared_this->should_exit()) break;
+					shared_this->wait_for_requests(batch, batch_size, statistics);
 				}
-				catch(...)
+				std::vector<boost::shared_ptr<method_request_base> >::iterator it;
+				if(statistics)
 				{
-					BOOST_ASSERT(false);
+					statistics->record_wakeup(batch.empty());
+					statistics->queue_depth().record(shared_this->_activationQueue->size());
+					const boost::system_time now = boost::get_system_time();
+					for(it = batch.begin(); it != batch.end(); ++it)
+					{
+						statistics->queue_wait().record(elapsed_microseconds((*it)->enqueue_time(), now));
+					}
 				}
-				if(shared_this->detached() && shared_this->_activationQueue->empty())
+				for(it = batch.begin(); it != batch.end(); ++it)
 				{
-					break;
+					if(shared_this->mortallyWounded()) break;
+					run_request(**it, statistics);
+					// release each request as soon as it has run
+					it->reset();
 				}
+				batch.clear();
 			}
+			current_wait_helper().reset();
+			current_scheduler().reset();
 		}
 
-		void scheduler_impl::kill()
+		void scheduler_impl::run_request(method_request_base &request, scheduler_statistics *statistics)
+		{
+			try
+			{
+				if(statistics)
+				{
+					const boost::system_time start = boost::get_system_time();
+					request.run();
+					statistics->run_time().record(elapsed_microseconds(start, boost::get_system_time()));
+				}else
+				{
+					request.run();
+				}
+			}
+			catch(...)
+			{
+				BOOST_ASSERT(false);
+			}
+		}
+
+		/* Called on a dispatcher thread whose method request is waiting on done.  If
+		another thread holds the dispatch slot, it will pick up the next ready request, so we
+		wait for it to give the slot up.  Otherwise we wait in the activation queue ourselves.
+		Either way, a continuation on done wakes us up. */
+		void scheduler_impl::help_until(const future<void> &done)
+		{
+			scheduler_statistics *const statistics = _attributes.get_statistics().get();
+			std::vector<boost::shared_ptr<method_request_base> > batch;
+			bool watching = false;
+			while(true)
+			{
+				const unsigned long epoch = _dispatch_slot->wake_epoch();
+				if(done.ready() || done.has_exception() || mortallyWounded()) return;
+				const bool dispatching = _dispatch_slot->try_acquire();
+				if(dispatching)
+				{
+					// only block in the activation queue once something will wake us when done completes
+					if(_activationQueue->try_get_requests(batch, 1) == 0 && watching)
+					{
+						_activationQueue->get_requests(batch, 1);
+					}
+					_dispatch_slot->release();
+					if(batch.empty() == false)
+					{
+						if(statistics) statistics->queue_wait().record(elapsed_microseconds(batch.front()->enqueue_time(),
+							boost::get_system_time()));
+						run_request(*batch.front(), statistics);
+						batch.clear();
+						continue;
+					}
+				}
+				if(watching == false)
+				{
+					// a dispatcher thread woken by this instead of us just goes back to waiting
+					when_complete(done, boost::bind(&scheduler_impl::wake_helper,
+						boost::weak_ptr<activation_queue_base>(_activationQueue),
+						boost::weak_ptr<dispatch_slot>(_dispatch_slot)));
+					watching = true;
+					continue;
+				}
+				if(dispatching == false) _dispatch_slot->wait_for_release(epoch);
+			}
+		}
+
+		void scheduler_impl::wake_helper(const boost::weak_ptr<activation_queue_base> &weak_queue,
+			const boost::weak_ptr<dispatch_slot> &weak_slot)
 		{
+			dispatch_slot::wake_helpers(weak_slot);
+			boost::shared_ptr<activation_queue_base> queue = weak_queue.lock();
+			if(queue) queue->wake();
+		}
+
+		// the dispatch slot must be held
+		void scheduler_impl::wait_for_requests(std::vector<boost::shared_ptr<method_request_base> > &batch,
+			unsigned batch_size, scheduler_statistics *statistics)
+		{
+			const boost::posix_time::time_duration &spin_duration = _attributes.get_spin_duration();
+			if(spin_duration > boost::posix_time::seconds(0))
 			{
-				boost::mutex::scoped_lock lock(_mutex);
-				_mortallyWounded = true;
+				const boost::system_time spin_end = boost::get_system_time() + spin_duration;
+				do
+				{
+					if(_activationQueue->try_get_requests(batch, batch_size) > 0)
+					{
+						if(statistics) statistics->record_spin_hit();
+						return;
+					}
+					if(should_exit()) return;
+				}while(boost::get_system_time() < spin_end);
 			}
+			unsigned i;
+			for(i = 0; i < _attributes.get_yield_count(); ++i)
+			{
+				if(_activationQueue->try_get_requests(batch, batch_size) > 0)
+				{
+					if(statistics) statistics->record_yield_hit();
+					return;
+				}
+				if(should_exit()) return;
+				boost::this_thread::yield();
+			}
+			if(statistics) statistics->record_park();
+			_activationQueue->get_requests(batch, batch_size);
+		}
+
+		void scheduler_impl::kill()
+		{
+			_mortallyWounded.store(true);
 			_activationQueue->wake();
 		}
 
 		bool scheduler_impl::mortallyWounded() const
 		{
-			boost::mutex::scoped_lock lock(_mutex);
-			return _mortallyWounded;
+			return _mortallyWounded.load();
 		}
 
 		void scheduler_impl::detach()
 		{
-			{
-				boost::mutex::scoped_lock lock(_mutex);
-				_detached = true;
-			}
+			_detached.store(true);
 			_activationQueue->wake();
 		}
 	} // namespace detail
 
 	// scheduler
 
-	scheduler::scheduler(const boost::shared_ptr<activation_queue_base> &activationQueue):
-		_pimpl(new detail::scheduler_impl(activationQueue))
+	scheduler::scheduler(const boost::shared_ptr<activation_queue_base> &activationQueue,
+		const scheduler_attributes &attributes):
+		_pimpl(new detail::scheduler_impl(activationQueue, attributes))
 	{
 		_dispatcherThread.reset(new boost::thread(boost::bind(&detail::scheduler_impl::dispatcherThreadFunction, _pimpl)));
 	}
@@ -219,4 +1004,37 @@ namespace poet
 		}
 		_dispatcherThread->join();
 	}
+
+	// thread_pool_scheduler
+
+	thread_pool_scheduler::thread_pool_scheduler(unsigned num_threads, const boost::shared_ptr<activation_queue_base> &activationQueue,
+		const scheduler_attributes &attributes):
+		_pimpl(new detail::scheduler_impl(activationQueue, attributes))
+	{
+		if(num_threads == 0) num_threads = boost::thread::hardware_concurrency();
+		if(num_threads == 0) num_threads = 1;
+		unsigned i;
+		for(i = 0; i < num_threads; ++i)
+		{
+			_dispatcherThreads.push_back(boost::shared_ptr<boost::thread>(
+				new boost::thread(boost::bind(&detail::scheduler_impl::dispatcherThreadFunction, _pimpl))));
+		}
+	}
+
+	void thread_pool_scheduler::join()
+	{
+		BOOST_ASSERT(_pimpl->mortallyWounded());
+		thread_container_type::iterator it;
+		for(it = _dispatcherThreads.begin(); it != _dispatcherThreads.end(); ++it)
+		{
+			if((*it)->get_id() == boost::this_thread::get_id())
+			{
+				throw std::invalid_argument("Cannot join thread_pool_scheduler thread from one of its own threads.");
+			}
+		}
+		for(it = _dispatcherThreads.begin(); it != _dispatcherThreads.end(); ++it)
+		{
+			(*it)->join();
+		}
+	}
 }	// namespace poet
@@ -0,0 +1,291 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <poet/elastic_thread_pool_scheduler.hpp>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <stdexcept>
+
+namespace poet
+{
+	namespace detail
+	{
+		elastic_pool_impl::elastic_pool_impl(const boost::shared_ptr<activation_queue_base> &activationQueue,
+			const elastic_pool_attributes &attributes):
+			_activationQueue(activationQueue), _attributes(attributes), _start(boost::get_system_time()),
+			_num_threads(0), _num_blocked(0), _peak_threads(0), _retiring(0),
+			_grown_for_blocking(0), _grown_for_wait(0), _shrunk(0), _surplus_idle_since(-1),
+			_num_busy(0), _last_dequeue(0), _mortallyWounded(false), _detached(false)
+		{
+			if(!_activationQueue) throw std::invalid_argument("poet::elastic_thread_pool_scheduler requires an activation queue.");
+			if(_attributes.get_core_threads() == 0)
+			{
+				_attributes.set_core_threads(std::max(boost::thread::hardware_concurrency(), 1u));
+			}
+			if(_attributes.get_max_threads() == 0)
+			{
+				_attributes.set_max_threads(4 * _attributes.get_core_threads());
+			}
+			_attributes.set_max_threads(std::max(_attributes.get_max_threads(), _attributes.get_core_threads()));
+		}
+
+		elastic_pool_impl::~elastic_pool_impl()
+		{
+			_check_timer.cancel();
+		}
+
+		void elastic_pool_impl::start()
+		{
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				unsigned i;
+				for(i = 0; i < _attributes.get_core_threads(); ++i)
+				{
+					spawn_thread();
+				}
+			}
+			const boost::posix_time::time_duration period =
+				std::max(std::min(_attributes.get_wait_threshold(), _attributes.get_idle_timeout()) / 2,
+				boost::posix_time::time_duration(boost::posix_time::milliseconds(1)));
+			/* The timer only holds a weak reference, and the destructor cancels it, so
+			a detached pool doesn't leave a periodic timer behind. */
+			_check_timer = timer_service::default_service().schedule_every(period,
+				boost::bind(&elastic_pool_impl::check, boost::weak_ptr<elastic_pool_impl>(shared_from_this())));
+		}
+
+		void elastic_pool_impl::post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			if(mortallyWounded()) return;
+			_activationQueue->push_back(methodRequest);
+		}
+
+		void elastic_pool_impl::post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			if(mortallyWounded()) return;
+			_activationQueue->push_back_range(methodRequests);
+		}
+
+		// _mutex must be locked.  Growing is best effort, returns false if no thread was created.
+		bool elastic_pool_impl::spawn_thread()
+		{
+			// threads which have exited are reaped here, joining them doesn't block for long
+			std::list<boost::shared_ptr<boost::thread> >::iterator it;
+			for(it = _threads.begin(); it != _threads.end() && _exited_threads.empty() == false;)
+			{
+				std::vector<boost::thread::id>::iterator found =
+					std::find(_exited_threads.begin(), _exited_threads.end(), (*it)->get_id());
+				if(found == _exited_threads.end())
+				{
+					++it;
+					continue;
+				}
+				_exited_threads.erase(found);
+				(*it)->join();
+				it = _threads.erase(it);
+			}
+			try
+			{
+				_threads.push_back(boost::shared_ptr<boost::thread>(
+					new boost::thread(boost::bind(&elastic_pool_impl::dispatcherThreadFunction, shared_from_this()))));
+			}
+			catch(const boost::thread_resource_error &)
+			{
+				return false;
+			}
+			++_num_threads;
+			_peak_threads = std::max(_peak_threads, _num_threads);
+			return true;
+		}
+
+		void elastic_pool_impl::dispatcherThreadFunction(const boost::shared_ptr<elastic_pool_impl> &shared_this_in)
+		{
+			/* shared_this insures elastic_pool_impl object is not destroyed while its threads are still
+			running. */
+			boost::shared_ptr<elastic_pool_impl> shared_this = shared_this_in;
+			worker_state state(shared_this.get());
+			current_worker().reset(&state);
+			if(shared_this->_attributes.get_grow_while_waiting())
+			{
+				current_wait_helper().reset(shared_this.get());
+			}
+			std::vector<boost::shared_ptr<method_request_base> > batch;
+			bool retired = false;
+			while(true)
+			{
+				{
+					boost::unique_lock<boost::mutex> dispatch_lock(shared_this->_dispatch_mutex);
+					if(shared_this->should_exit()) break;
+					retired = shared_this->retire_if_requested();
+					if(retired) break;
+					shared_this->_activationQueue->get_requests(batch, 1);
+				}
+				if(batch.empty()) continue;
+				shared_this->_last_dequeue.store(shared_this->now_microseconds());
+				++shared_this->_num_busy;
+				try
+				{
+					batch.front()->run();
+				}
+				catch(...)
+				{
+					BOOST_ASSERT(false);
+				}
+				--shared_this->_num_busy;
+				batch.clear();
+			}
+			current_wait_helper().reset();
+			current_worker().reset();
+			shared_this->thread_exited(retired);
+		}
+
+		// _dispatch_mutex must be locked
+		bool elastic_pool_impl::retire_if_requested()
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			if(_retiring == 0) return false;
+			--_retiring;
+			// blocked threads may have come back since the retirement was requested
+			if(_num_threads - _num_blocked <= _attributes.get_core_threads()) return false;
+			return true;
+		}
+
+		void elastic_pool_impl::thread_exited(bool retired)
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			--_num_threads;
+			if(retired) ++_shrunk;
+			_exited_threads.push_back(boost::this_thread::get_id());
+			if(_num_threads == 0) _check_timer.cancel();
+		}
+
+		void elastic_pool_impl::check(const boost::weak_ptr<elastic_pool_impl> &weak_this)
+		{
+			boost::shared_ptr<elastic_pool_impl> shared_this = weak_this.lock();
+			if(shared_this) shared_this->adjust();
+		}
+
+		// called periodically from the timer thread
+		void elastic_pool_impl::adjust()
+		{
+			const boost::int64_t now = now_microseconds();
+			const bool queue_empty = _activationQueue->empty();
+			// the wait threshold is measured from when the queue was last seen empty, at the earliest
+			if(queue_empty) _last_dequeue.store(now);
+			bool wake = false;
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				// checked with the lock held, so join() sees every thread we create
+				if(mortallyWounded() || detached()) return;
+				const unsigned num_busy = _num_busy.load();
+				if(queue_empty == false && num_busy >= _num_threads &&
+					now - _last_dequeue.load() >= _attributes.get_wait_threshold().total_microseconds() &&
+					_num_threads < _attributes.get_max_threads())
+				{
+					if(spawn_thread()) ++_grown_for_wait;
+					// give the new thread a chance before growing again
+					_last_dequeue.store(now);
+					_surplus_idle_since = -1;
+					return;
+				}
+				const unsigned num_needed = _attributes.get_core_threads() + _num_blocked;
+				if(num_busy < _num_threads && _num_threads > num_needed)
+				{
+					if(_surplus_idle_since < 0)
+					{
+						_surplus_idle_since = now;
+					}else if(now - _surplus_idle_since >= _attributes.get_idle_timeout().total_microseconds())
+					{
+						_retiring = std::min(_num_threads - num_busy, _num_threads - num_needed);
+						_surplus_idle_since = -1;
+						wake = true;
+					}
+				}else
+				{
+					_surplus_idle_since = -1;
+				}
+			}
+			// the thread waiting in the activation queue retires, then the next one to get the dispatch mutex
+			if(wake) _activationQueue->wake();
+		}
+
+		void elastic_pool_impl::enter_blocking_region()
+		{
+			worker_state *state = current_worker().get();
+			if(state == 0 || state->blocking_depth++ > 0) return;
+			elastic_pool_impl &pool = *state->pool;
+			boost::unique_lock<boost::mutex> lock(pool._mutex);
+			++pool._num_blocked;
+			if(pool.mortallyWounded() || pool.detached()) return;
+			if(pool._num_threads - pool._num_blocked < pool._attributes.get_core_threads() &&
+				pool._num_threads < pool._attributes.get_max_threads())
+			{
+				if(pool.spawn_thread()) ++pool._grown_for_blocking;
+			}
+		}
+
+		void elastic_pool_impl::leave_blocking_region()
+		{
+			worker_state *state = current_worker().get();
+			if(state == 0 || --state->blocking_depth > 0) return;
+			elastic_pool_impl &pool = *state->pool;
+			boost::unique_lock<boost::mutex> lock(pool._mutex);
+			--pool._num_blocked;
+		}
+
+		/* We don't run other method requests while waiting, we let the pool make up
+		for the waiting thread instead. */
+		void elastic_pool_impl::help_until(const future<void> &done)
+		{
+			blocking_region region;
+			get_future_body(done)->wait();
+		}
+
+		elastic_pool_snapshot elastic_pool_impl::snapshot() const
+		{
+			elastic_pool_snapshot result;
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			result.num_threads = _num_threads;
+			result.num_busy = std::min(_num_busy.load(), _num_threads);
+			result.num_blocked = _num_blocked;
+			result.peak_threads = _peak_threads;
+			result.grown_for_blocking = _grown_for_blocking;
+			result.grown_for_wait = _grown_for_wait;
+			result.shrunk = _shrunk;
+			return result;
+		}
+
+		void elastic_pool_impl::kill()
+		{
+			_mortallyWounded.store(true);
+			_check_timer.cancel();
+			_activationQueue->wake();
+		}
+
+		void elastic_pool_impl::detach()
+		{
+			_detached.store(true);
+			_activationQueue->wake();
+		}
+
+		void elastic_pool_impl::join()
+		{
+			BOOST_ASSERT(mortallyWounded());
+			std::list<boost::shared_ptr<boost::thread> > threads;
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				if(running_in_this_thread())
+				{
+					throw std::invalid_argument("Cannot join elastic_thread_pool_scheduler thread from one of its own threads.");
+				}
+				// no threads are created once we are killed
+				threads = _threads;
+			}
+			std::list<boost::shared_ptr<boost::thread> >::iterator it;
+			for(it = threads.begin(); it != threads.end(); ++it)
+			{
+				(*it)->join();
+			}
+		}
+	} // namespace detail
+}	// namespace poet
@@ -0,0 +1,64 @@
+/*
+	An "event count", which lets a thread park until something changes
+	without the notifying threads needing to take a lock when nobody
+	is parked.  Waiters read the count, check their condition, then wait
+	for the count to move on from the value they read.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_DETAIL_EVENT_COUNT_HPP
+#define _POET_DETAIL_EVENT_COUNT_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace poet
+{
+	namespace detail
+	{
+		class event_count: boost::noncopyable
+		{
+		public:
+			typedef unsigned long count_type;
+
+			event_count(): _count(0), _waiters(0)
+			{}
+			count_type count() const
+			{
+				return _count.load();
+			}
+			void notify()
+			{
+				++_count;
+				if(_waiters.load() > 0)
+				{
+					boost::unique_lock<boost::mutex> lock(_mutex);
+					_condition.notify_all();
+				}
+			}
+			// blocks until notify() has been called since count() returned old_count
+			void wait(count_type old_count)
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				++_waiters;
+				while(_count.load() == old_count)
+				{
+					_condition.wait(lock);
+				}
+				--_waiters;
+			}
+		private:
+			boost::atomic<count_type> _count;
+			boost::atomic<unsigned> _waiters;
+			boost::mutex _mutex;
+			boost::condition _condition;
+		};
+	}
+}
+
+#endif // _POET_DETAIL_EVENT_COUNT_HPP
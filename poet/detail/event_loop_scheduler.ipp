@@ -0,0 +1,244 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <poet/event_loop_scheduler.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/system/system_error.hpp>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace poet
+{
+	namespace detail
+	{
+		event_loop_scheduler_impl::event_loop_scheduler_impl(const boost::shared_ptr<activation_queue_base> &activationQueue):
+			_activationQueue(activationQueue), _event_fd(-1), _epoll_fd(-1),
+			_signalled(false), _mortallyWounded(false), _running(false)
+		{
+			if(!_activationQueue) throw std::invalid_argument("poet::event_loop_scheduler requires an activation queue.");
+			_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if(_event_fd < 0)
+			{
+				throw boost::system::system_error(errno, boost::system::system_category(), "eventfd");
+			}
+			_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+			if(_epoll_fd < 0)
+			{
+				const int error = errno;
+				close(_event_fd);
+				throw boost::system::system_error(error, boost::system::system_category(), "epoll_create1");
+			}
+			epoll_event event = epoll_event();
+			event.events = EPOLLIN;
+			event.data.fd = _event_fd;
+			if(epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _event_fd, &event) != 0)
+			{
+				const int error = errno;
+				close(_epoll_fd);
+				close(_event_fd);
+				throw boost::system::system_error(error, boost::system::system_category(), "epoll_ctl");
+			}
+		}
+
+		event_loop_scheduler_impl::~event_loop_scheduler_impl()
+		{
+			close(_epoll_fd);
+			close(_event_fd);
+		}
+
+		/* The hook only holds a weak reference, since the activation queue and the continuations
+		which call the hook may outlive the scheduler. */
+		void event_loop_scheduler_impl::watch_activation_queue()
+		{
+			if(_activationQueue->set_ready_hook(boost::bind(&event_loop_scheduler_impl::request_ready,
+				boost::weak_ptr<event_loop_scheduler_impl>(shared_from_this()))) == false)
+			{
+				throw std::invalid_argument("poet::event_loop_scheduler requires an activation queue with a ready hook.");
+			}
+		}
+
+		void event_loop_scheduler_impl::post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			if(mortallyWounded()) return;
+			_activationQueue->push_back(methodRequest);
+		}
+
+		void event_loop_scheduler_impl::post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			if(mortallyWounded() || methodRequests.empty()) return;
+			_activationQueue->push_back_range(methodRequests);
+		}
+
+		void event_loop_scheduler_impl::request_ready(const boost::weak_ptr<event_loop_scheduler_impl> &weak_this)
+		{
+			boost::shared_ptr<event_loop_scheduler_impl> shared_this = weak_this.lock();
+			if(shared_this) shared_this->signal();
+		}
+
+		void event_loop_scheduler_impl::signal()
+		{
+			if(_signalled.exchange(true)) return;
+			const boost::uint64_t one = 1;
+			ssize_t result;
+			do
+			{
+				result = write(_event_fd, &one, sizeof(one));
+			}while(result < 0 && errno == EINTR);
+		}
+
+		/* Clears _signalled before draining the queue, so a signal() made after we look at the
+		queue writes to the eventfd again.  The eventfd is read even if _signalled was already
+		clear, since the write of a signal() which set it before we cleared it may land after
+		our read. */
+		void event_loop_scheduler_impl::clear_signal()
+		{
+			_signalled.store(false);
+			drain_event_fd();
+		}
+
+		void event_loop_scheduler_impl::drain_event_fd()
+		{
+			boost::uint64_t value;
+			ssize_t result;
+			do
+			{
+				result = read(_event_fd, &value, sizeof(value));
+			}while(result < 0 && errno == EINTR);
+		}
+
+		std::size_t event_loop_scheduler_impl::run_ready(std::size_t max_requests)
+		{
+			if(mortallyWounded())
+			{
+				// don't leave ready_fd() readable for a host loop which keeps polling it
+				drain_event_fd();
+				return 0;
+			}
+			if(max_requests == 0) return 0;
+			clear_signal();
+			std::vector<boost::shared_ptr<method_request_base> > batch;
+			const std::size_t num_taken = _activationQueue->try_get_requests(batch, max_requests);
+			if(num_taken == 0) return 0;
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				_running = true;
+				_running_thread = boost::this_thread::get_id();
+			}
+			std::size_t count = 0;
+			std::vector<boost::shared_ptr<method_request_base> >::iterator it;
+			for(it = batch.begin(); it != batch.end(); ++it)
+			{
+				if(mortallyWounded()) break;
+				try
+				{
+					(*it)->run();
+				}
+				catch(...)
+				{
+					BOOST_ASSERT(false);
+				}
+				// release each request as soon as it has run
+				it->reset();
+				++count;
+			}
+			batch.clear();
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				_running = false;
+				_running_thread = boost::thread::id();
+				_run_finished.notify_all();
+			}
+			// there may be more ready requests than we were allowed to run
+			if(num_taken == max_requests && _activationQueue->empty() == false) signal();
+			return count;
+		}
+
+		std::size_t event_loop_scheduler_impl::poll(std::size_t max_requests)
+		{
+			if(mortallyWounded()) return run_ready(max_requests);
+			static const int max_events = 32;
+			epoll_event events[max_events];
+			int num_events;
+			do
+			{
+				num_events = epoll_wait(_epoll_fd, events, max_events, 0);
+			}while(num_events < 0 && errno == EINTR);
+			std::size_t count = 0;
+			int i;
+			for(i = 0; i < num_events; ++i)
+			{
+				if(events[i].data.fd == _event_fd) continue;
+				boost::shared_ptr<fd_callback_type> callback;
+				{
+					boost::unique_lock<boost::mutex> lock(_mutex);
+					std::map<int, boost::shared_ptr<fd_callback_type> >::const_iterator found =
+						_fd_callbacks.find(events[i].data.fd);
+					// it may have been unwatched by an earlier callback
+					if(found == _fd_callbacks.end()) continue;
+					callback = found->second;
+				}
+				(*callback)();
+				++count;
+			}
+			return count + run_ready(max_requests);
+		}
+
+		void event_loop_scheduler_impl::watch_fd(int fd, const fd_callback_type &callback)
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			const bool watched = _fd_callbacks.find(fd) != _fd_callbacks.end();
+			epoll_event event = epoll_event();
+			event.events = EPOLLIN;
+			event.data.fd = fd;
+			if(epoll_ctl(_epoll_fd, watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) != 0)
+			{
+				throw boost::system::system_error(errno, boost::system::system_category(), "epoll_ctl");
+			}
+			_fd_callbacks[fd].reset(new fd_callback_type(callback));
+		}
+
+		void event_loop_scheduler_impl::unwatch_fd(int fd)
+		{
+			// destroyed after the lock is released
+			boost::shared_ptr<fd_callback_type> callback;
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			std::map<int, boost::shared_ptr<fd_callback_type> >::iterator found = _fd_callbacks.find(fd);
+			if(found == _fd_callbacks.end()) return;
+			callback.swap(found->second);
+			_fd_callbacks.erase(found);
+			// fails harmlessly if fd was already closed, which removes it from the epoll set anyway
+			epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, 0);
+		}
+
+		void event_loop_scheduler_impl::kill()
+		{
+			_mortallyWounded.store(true);
+			// leaving _signalled set keeps later signal()s from writing to the eventfd
+			_signalled.store(true);
+			drain_event_fd();
+			_activationQueue->wake();
+		}
+
+		void event_loop_scheduler_impl::join()
+		{
+			BOOST_ASSERT(mortallyWounded());
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			if(_running && _running_thread == boost::this_thread::get_id())
+			{
+				throw std::invalid_argument("Cannot join event_loop_scheduler from one of its own method requests.");
+			}
+			while(_running) _run_finished.wait(lock);
+		}
+
+		bool event_loop_scheduler_impl::running_in_this_thread() const
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			return _running && _running_thread == boost::this_thread::get_id();
+		}
+	} // namespace detail
+}	// namespace poet
@@ -14,7 +14,7 @@
 
 #include <boost/function.hpp>
 #include <boost/thread/mutex.hpp>
-#include <deque>
+#include <list>
 namespace poet
 {
 	namespace detail
@@ -55,7 +55,8 @@ namespace poet
 				_queue.push_back(event);
 			}
 		private:
-			std::deque<event_type> _queue;
+			// a list, since an empty deque still allocates and most queues never see an event
+			std::list<event_type> _queue;
 			boost::mutex _mutex;
 		};
 	}
@@ -0,0 +1,118 @@
+/*
+	Runs a callback as soon as a future becomes ready or gets an exception,
+	without needing a thread to block in future::join().  Used by schedulers
+	to find out when the scheduling guard of a method request completes.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_DETAIL_FUTURE_CONTINUATION_HPP
+#define _POET_DETAIL_FUTURE_CONTINUATION_HPP
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <poet/future.hpp>
+
+namespace poet
+{
+	namespace detail
+	{
+		/* A future_continuation acts like a thread waiting on a future.  Its
+		waiter_event_queue observes the future's waiter callbacks, but instead of
+		being polled by a waiting thread, it is polled immediately by whichever thread
+		posts an event to it.  That means the deferred work of lazy futures (for example
+		the combiner of a future_combining_barrier) gets run by the thread which
+		completed the last input future.  The callback is called exactly once, and
+		must not throw. */
+		class future_continuation
+		{
+		public:
+			typedef boost::function<void ()> callback_type;
+
+			static void create(const future<void> &f, const callback_type &callback)
+			{
+				const boost::shared_ptr<future_body_untyped_base> &body = get_future_body(f);
+				if(body->ready() || body->get_exception_ptr())
+				{
+					callback();
+					return;
+				}
+
+				boost::shared_ptr<future_continuation> new_object(new future_continuation(body, callback));
+				new_object->_waiter_callbacks.set_owner(new_object);
+				new_object->_waiter_callbacks.connect_event_posted(
+					boost::bind(&future_continuation::poll_waiter_callbacks, new_object.get()));
+
+				/* The update slot owns the continuation, and the continuation owns the future body,
+				so both stay alive until the future completes even if nobody else holds the future. */
+				typedef future_body_untyped_base::update_slot_type slot_type;
+				slot_type update_slot(&future_continuation::check_body, new_object, body.get());
+				boost::signals2::connection conn;
+				conn = body->connectUpdate(update_slot);
+				try
+				{
+					update_slot();
+				}
+				catch(const boost::signals2::expired_slot &)
+				{
+					conn.disconnect();
+					return;
+				}
+				new_object->_waiter_callbacks.observe(body->waiter_callbacks());
+			}
+		private:
+			future_continuation(const boost::shared_ptr<future_body_untyped_base> &body, const callback_type &callback):
+				_waiter_callbacks(_mutex, _condition),
+				_body(body),
+				_callback(callback),
+				_fired(false)
+			{}
+
+			void poll_waiter_callbacks()
+			{
+				_waiter_callbacks.poll();
+			}
+			void check_body(const future_body_untyped_base *body)
+			{
+				if(!(body->ready() || body->get_exception_ptr())) return;
+				{
+					boost::unique_lock<boost::mutex> lock(_mutex);
+					if(_fired) throw boost::signals2::expired_slot();
+					_fired = true;
+				}
+				_waiter_callbacks.close_posting();
+				_callback();
+				_callback.clear();
+				/* Whatever is signalling completion holds its own reference to the body
+				(slot tracking or its waiter_event_queue's owner), so it is safe to
+				drop ours here. */
+				_body.reset();
+				throw boost::signals2::expired_slot();
+			}
+
+			boost::mutex _mutex;
+			boost::condition _condition;
+			waiter_event_queue _waiter_callbacks;
+			boost::shared_ptr<future_body_untyped_base> _body;
+			callback_type _callback;
+			bool _fired;
+		};
+
+		// calls callback once, when f becomes ready or gets an exception
+		inline void when_complete(const future<void> &f, const future_continuation::callback_type &callback)
+		{
+			future_continuation::create(f, callback);
+		}
+	}
+}
+
+#ifdef POET_HAS_NATIVE_WAIT_HANDLE
+#include <poet/detail/native_wait_handle.hpp>
+#endif
+
+#endif // _POET_DETAIL_FUTURE_CONTINUATION_HPP
@@ -0,0 +1,121 @@
+/*
+	An intrusive, lock-free, multiple-producer single-consumer queue.
+	Pushing never allocates; each node carries its own link and
+	a shared_ptr to itself which keeps it alive while it is queued.
+	The algorithm is Dmitry Vyukov's intrusive MPSC node-based queue.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_DETAIL_INTRUSIVE_MPSC_QUEUE_HPP
+#define _POET_DETAIL_INTRUSIVE_MPSC_QUEUE_HPP
+
+#include <boost/assert.hpp>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace poet
+{
+	namespace detail
+	{
+		template<typename T>
+		class intrusive_mpsc_hook
+		{
+		public:
+			intrusive_mpsc_hook(): next(0)
+			{}
+			// copying a node does not copy its queue membership
+			intrusive_mpsc_hook(const intrusive_mpsc_hook &): next(0)
+			{}
+			intrusive_mpsc_hook& operator=(const intrusive_mpsc_hook &)
+			{
+				return *this;
+			}
+
+			boost::atomic<T*> next;
+			boost::shared_ptr<T> self;
+		};
+
+		/* HookAccess::hook(T&) must return the intrusive_mpsc_hook<T> embedded in a node.
+		A node may only be in one queue at a time.  Any thread may push(), but only one thread
+		at a time may call front() or pop(). */
+		template<typename T, typename HookAccess>
+		class intrusive_mpsc_queue: boost::noncopyable
+		{
+		public:
+			// stub is a dummy node owned by the caller which must outlive the queue
+			explicit intrusive_mpsc_queue(T &stub): _stub(&stub), _head(&stub), _tail(&stub)
+			{
+				HookAccess::hook(stub).next.store(0, boost::memory_order_relaxed);
+			}
+			~intrusive_mpsc_queue()
+			{
+				while(front()) pop();
+			}
+			void push(const boost::shared_ptr<T> &node)
+			{
+				// a node whose hook still holds itself is already queued somewhere
+				BOOST_ASSERT(!HookAccess::hook(*node).self);
+				HookAccess::hook(*node).self = node;
+				push_node(node.get());
+			}
+			// returns the oldest node in the queue without removing it, or null
+			T* front()
+			{
+				T *tail = _tail;
+				if(tail == _stub)
+				{
+					T *next = HookAccess::hook(*tail).next.load(boost::memory_order_acquire);
+					if(next == 0) return 0;
+					_tail = next;
+					tail = next;
+				}
+				return tail;
+			}
+			// removes the node returned by front(), which must not have been null
+			boost::shared_ptr<T> pop()
+			{
+				T *tail = _tail;
+				BOOST_ASSERT(tail != _stub);
+				T *next = HookAccess::hook(*tail).next.load(boost::memory_order_acquire);
+				if(next == 0)
+				{
+					/* tail is the last node, so put the stub back in the queue behind it
+					before unlinking it. */
+					if(tail == _head.load(boost::memory_order_acquire))
+					{
+						push_node(_stub);
+					}
+					/* either a producer is between exchanging _head and linking its node,
+					or we just pushed the stub.  Either way the link shows up shortly. */
+					while((next = HookAccess::hook(*tail).next.load(boost::memory_order_acquire)) == 0)
+					{
+						boost::this_thread::yield();
+					}
+				}
+				_tail = next;
+				boost::shared_ptr<T> result;
+				result.swap(HookAccess::hook(*tail).self);
+				return result;
+			}
+		private:
+			void push_node(T *node)
+			{
+				HookAccess::hook(*node).next.store(0, boost::memory_order_relaxed);
+				T *prev = _head.exchange(node, boost::memory_order_acq_rel);
+				HookAccess::hook(*prev).next.store(node, boost::memory_order_release);
+			}
+
+			T *_stub;
+			boost::atomic<T*> _head;
+			// only touched by the consumer
+			T *_tail;
+		};
+	}
+}
+
+#endif // _POET_DETAIL_INTRUSIVE_MPSC_QUEUE_HPP
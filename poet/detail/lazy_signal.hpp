@@ -0,0 +1,68 @@
+/*
+	A signals2 signal which isn't constructed until something connects
+	to it.  Constructing a signal allocates, and most futures are complete
+	before anything ever connects to their signals.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_DETAIL_LAZY_SIGNAL_HPP
+#define _POET_DETAIL_LAZY_SIGNAL_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/signals2/signal.hpp>
+
+namespace poet
+{
+	namespace detail
+	{
+		template<typename Signature>
+		class lazy_signal: boost::noncopyable
+		{
+		public:
+			typedef boost::signals2::signal<Signature> signal_type;
+			typedef typename signal_type::slot_type slot_type;
+
+			lazy_signal(): _signal(0)
+			{}
+			~lazy_signal()
+			{
+				delete _signal.load();
+			}
+			boost::signals2::connection connect(const slot_type &slot)
+			{
+				return get().connect(slot);
+			}
+			/* The signal, or null if nothing ever connected to it.  Once created it stays
+			until the lazy_signal is destroyed. */
+			signal_type* created() const
+			{
+				return _signal.load();
+			}
+			// emits the signal, if anything ever connected to it
+			void operator()() const
+			{
+				signal_type *signal = created();
+				if(signal) (*signal)();
+			}
+		private:
+			signal_type& get()
+			{
+				signal_type *signal = _signal.load();
+				if(signal) return *signal;
+				signal_type *new_signal = new signal_type;
+				if(_signal.compare_exchange_strong(signal, new_signal)) return *new_signal;
+				// another thread created it first
+				delete new_signal;
+				return *signal;
+			}
+
+			boost::atomic<signal_type *> _signal;
+		};
+	}
+}
+
+#endif // _POET_DETAIL_LAZY_SIGNAL_HPP
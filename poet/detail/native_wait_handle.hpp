@@ -0,0 +1,81 @@
+/*
+	The eventfd behind future::native_wait_handle().  It is written to once,
+	by a future_continuation, when the future completes.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_DETAIL_NATIVE_WAIT_HANDLE_HPP
+#define _POET_DETAIL_NATIVE_WAIT_HANDLE_HPP
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/pointer_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/weak_ptr.hpp>
+#include <cerrno>
+#include <poet/detail/future_continuation.hpp>
+#include <poet/future.hpp>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace poet
+{
+	namespace detail
+	{
+		class eventfd_wait_handle: public boost::noncopyable
+		{
+		public:
+			eventfd_wait_handle(): _fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+			{
+				if(_fd < 0)
+				{
+					throw boost::system::system_error(errno, boost::system::system_category(), "eventfd");
+				}
+			}
+			~eventfd_wait_handle()
+			{
+				close(_fd);
+			}
+			int fd() const
+			{
+				return _fd;
+			}
+			static void signal(const boost::weak_ptr<eventfd_wait_handle> &weak_handle)
+			{
+				boost::shared_ptr<eventfd_wait_handle> handle = weak_handle.lock();
+				if(!handle) return;
+				const boost::uint64_t one = 1;
+				ssize_t result;
+				do
+				{
+					result = write(handle->_fd, &one, sizeof(one));
+				}while(result < 0 && errno == EINTR);
+			}
+		private:
+			const int _fd;
+		};
+
+		int future_body_untyped_base::native_wait_handle() const
+		{
+			boost::shared_ptr<eventfd_wait_handle> handle;
+			{
+				boost::unique_lock<boost::mutex> lock(mutex());
+				if(_native_wait_handle) return _native_wait_handle->fd();
+				handle.reset(new eventfd_wait_handle());
+				_native_wait_handle = handle;
+			}
+			/* The continuation may run right away, and it locks our mutex.  It only holds
+			a weak reference to the handle, since we own the handle. */
+			when_complete(create_future<void>(boost::const_pointer_cast<future_body_untyped_base>(shared_from_this())),
+				boost::bind(&eventfd_wait_handle::signal, boost::weak_ptr<eventfd_wait_handle>(handle)));
+			return handle->fd();
+		}
+	}
+}
+
+#endif // _POET_DETAIL_NATIVE_WAIT_HANDLE_HPP
@@ -0,0 +1,235 @@
+/*
+	An allocator which recycles the memory blocks it frees, instead of
+	returning them to operator delete.  Freed blocks go onto a free list
+	of the freeing thread, per block size, and are handed out again by
+	later allocations of the same size.  Threads exchange blocks through
+	a shared list in batches, so memory allocated by one thread (for
+	example, a method request created by a thread calling an active_function)
+	and freed by another (the scheduler thread which ran it) gets back to the
+	allocating thread without taking a lock for every block.  Promise and
+	future bodies come from here as well.
+
+	Each block size keeps at most max_cached_blocks free blocks per thread,
+	plus max_shared_blocks on the shared list.  Blocks freed beyond that
+	go back to operator delete, so a burst of allocations doesn't pin its
+	peak memory forever.  The shared lists themselves are never destroyed,
+	so blocks can still be freed while static objects are destroyed at exit.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_DETAIL_RECYCLING_ALLOCATOR_HPP
+#define _POET_DETAIL_RECYCLING_ALLOCATOR_HPP
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <cstddef>
+#include <new>
+
+namespace poet
+{
+	namespace detail
+	{
+		template<std::size_t BlockSize>
+		class recycling_pool
+		{
+		public:
+			// the most free blocks a thread keeps to itself
+			static const unsigned max_cached_blocks = 256;
+			// the number of blocks moved between a thread's free list and the shared list at a time
+			static const unsigned batch_size = max_cached_blocks / 2;
+			// the most free blocks kept on the shared list, the rest are deleted
+			static const unsigned max_shared_blocks = 64 * batch_size;
+
+			static void* allocate()
+			{
+				thread_cache &cache = local_cache();
+				if(cache.head == 0) cache.refill();
+				if(cache.head == 0) return ::operator new(block_size);
+				node *result = cache.head;
+				cache.head = result->next;
+				--cache.count;
+				return result;
+			}
+			static void deallocate(void *block)
+			{
+				thread_cache &cache = local_cache();
+				node *freed = static_cast<node *>(block);
+				freed->next = cache.head;
+				cache.head = freed;
+				if(++cache.count > max_cached_blocks) cache.spill(batch_size);
+			}
+		private:
+			struct node
+			{
+				node *next;
+			};
+			static const std::size_t block_size = BlockSize < sizeof(node) ? sizeof(node) : BlockSize;
+
+			// blocks moved from thread caches, in chains of up to batch_size
+			struct shared_list
+			{
+				shared_list(): head(0), count(0)
+				{}
+				boost::mutex mutex;
+				node *head;
+				unsigned count;
+			};
+			/* The pool's statics are leaked on purpose, so blocks may still be freed
+			while static objects are being destroyed at exit. */
+			static shared_list& shared()
+			{
+				static shared_list *list = new shared_list();
+				return *list;
+			}
+
+			struct thread_cache
+			{
+				thread_cache(): head(0), count(0)
+				{}
+				~thread_cache()
+				{
+					spill(count);
+				}
+				void refill()
+				{
+					shared_list &list = shared();
+					boost::unique_lock<boost::mutex> lock(list.mutex);
+					while(list.head != 0 && count < batch_size)
+					{
+						node *moved = list.head;
+						list.head = moved->next;
+						--list.count;
+						moved->next = head;
+						head = moved;
+						++count;
+					}
+				}
+				void spill(unsigned num_blocks)
+				{
+					if(num_blocks == 0) return;
+					// unlink the chain before taking the lock
+					node *chain_head = head;
+					node *chain_tail = head;
+					unsigned i;
+					for(i = 1; i < num_blocks; ++i) chain_tail = chain_tail->next;
+					head = chain_tail->next;
+					count -= num_blocks;
+					{
+						shared_list &list = shared();
+						boost::unique_lock<boost::mutex> lock(list.mutex);
+						if(list.count + num_blocks <= max_shared_blocks)
+						{
+							chain_tail->next = list.head;
+							list.head = chain_head;
+							list.count += num_blocks;
+							return;
+						}
+					}
+					// the shared list is full, so the chain goes back to operator delete
+					for(i = 0; i < num_blocks; ++i)
+					{
+						node *next = chain_head->next;
+						::operator delete(chain_head);
+						chain_head = next;
+					}
+				}
+				node *head;
+				unsigned count;
+			};
+			static thread_cache& local_cache()
+			{
+				static boost::thread_specific_ptr<thread_cache> *cache = new boost::thread_specific_ptr<thread_cache>();
+				thread_cache *result = cache->get();
+				if(result == 0)
+				{
+					result = new thread_cache();
+					cache->reset(result);
+				}
+				return *result;
+			}
+		};
+
+		// rounds sizes up so similar types share a pool
+		template<std::size_t Size>
+		class recycling_size_class
+		{
+		public:
+			static const std::size_t granularity = 16;
+			static const std::size_t value = (Size + granularity - 1) / granularity * granularity;
+		};
+
+		/* A standard allocator using recycling_pool for single objects.  Meant for use with
+		boost::allocate_shared, so an object and its shared_ptr control block come out of
+		one recycled block. */
+		template<typename T>
+		class recycling_allocator
+		{
+		public:
+			typedef T value_type;
+			typedef T* pointer;
+			typedef const T* const_pointer;
+			typedef T& reference;
+			typedef const T& const_reference;
+			typedef std::size_t size_type;
+			typedef std::ptrdiff_t difference_type;
+			template<typename U>
+			struct rebind
+			{
+				typedef recycling_allocator<U> other;
+			};
+
+			recycling_allocator()
+			{}
+			template<typename U>
+			recycling_allocator(const recycling_allocator<U> &)
+			{}
+
+			T* allocate(size_type n, const void * = 0)
+			{
+				if(n != 1) return static_cast<T*>(::operator new(n * sizeof(T)));
+				return static_cast<T*>(pool_type::allocate());
+			}
+			void deallocate(T *p, size_type n)
+			{
+				if(n != 1)
+				{
+					::operator delete(p);
+					return;
+				}
+				pool_type::deallocate(p);
+			}
+			void construct(T *p, const T &value)
+			{
+				new(p) T(value);
+			}
+			void destroy(T *p)
+			{
+				p->~T();
+			}
+			size_type max_size() const
+			{
+				return static_cast<size_type>(-1) / sizeof(T);
+			}
+			pointer address(reference x) const {return &x;}
+			const_pointer address(const_reference x) const {return &x;}
+		private:
+			typedef recycling_pool<recycling_size_class<sizeof(T)>::value> pool_type;
+		};
+
+		template<typename T, typename U>
+		bool operator==(const recycling_allocator<T> &, const recycling_allocator<U> &)
+		{
+			return true;
+		}
+		template<typename T, typename U>
+		bool operator!=(const recycling_allocator<T> &, const recycling_allocator<U> &)
+		{
+			return false;
+		}
+	}
+}
+
+#endif // _POET_DETAIL_RECYCLING_ALLOCATOR_HPP
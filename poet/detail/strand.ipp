@@ -0,0 +1,161 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <poet/strand.hpp>
+#include <boost/bind.hpp>
+#include <poet/detail/future_continuation.hpp>
+#include <stdexcept>
+
+namespace poet
+{
+	namespace detail
+	{
+		// posted to the pool to give a strand a turn on one of the pool's threads
+		class strand_impl::turn_request: public method_request_base
+		{
+		public:
+			turn_request(const boost::shared_ptr<strand_impl> &strand): _strand(strand)
+			{}
+			virtual void run()
+			{
+				_strand->run_turn();
+			}
+			virtual future<void> scheduling_guard() const
+			{
+				return ready_scheduling_guard();
+			}
+		private:
+			boost::shared_ptr<strand_impl> _strand;
+		};
+
+		strand_impl::strand_impl(const boost::shared_ptr<scheduler_base> &pool):
+			_pool(pool), _state(idle), _running(false), _mortallyWounded(false)
+		{
+			if(!_pool) throw std::invalid_argument("poet::strand requires a pool scheduler.");
+		}
+
+		void strand_impl::post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				if(_mortallyWounded) return;
+				_requests.push_back(methodRequest);
+				if(_state != idle) return;
+				_state = scheduled;
+			}
+			schedule_turn();
+		}
+
+		void strand_impl::post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			if(methodRequests.empty()) return;
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				if(_mortallyWounded) return;
+				_requests.insert(_requests.end(), methodRequests.begin(), methodRequests.end());
+				if(_state != idle) return;
+				_state = scheduled;
+			}
+			schedule_turn();
+		}
+
+		void strand_impl::schedule_turn()
+		{
+			_pool->post_method_request(boost::shared_ptr<method_request_base>(new turn_request(shared_from_this())));
+		}
+
+		void strand_impl::run_turn()
+		{
+			unsigned count = 0;
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			while(true)
+			{
+				if(_mortallyWounded || _requests.empty())
+				{
+					_state = idle;
+					return;
+				}
+				if(count == max_requests_per_turn)
+				{
+					// give the pool thread back, we stay scheduled
+					lock.unlock();
+					schedule_turn();
+					return;
+				}
+				boost::shared_ptr<method_request_base> request = _requests.front();
+				if(request->scheduling_guard_complete() == false)
+				{
+					_state = waiting;
+					lock.unlock();
+					/* The continuation may run (and schedule another turn) before when_complete
+					returns, so we must not touch our state after this. */
+					when_complete(request->scheduling_guard(), boost::bind(&strand_impl::guard_completed, shared_from_this()));
+					return;
+				}
+				_requests.pop_front();
+				_running = true;
+				_running_thread = boost::this_thread::get_id();
+				lock.unlock();
+				try
+				{
+					request->run();
+				}
+				catch(...)
+				{
+					BOOST_ASSERT(false);
+				}
+				request.reset();
+				lock.lock();
+				_running = false;
+				_running_thread = boost::thread::id();
+				_turn_finished.notify_all();
+				++count;
+			}
+		}
+
+		void strand_impl::guard_completed()
+		{
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				BOOST_ASSERT(_state == waiting);
+				_state = scheduled;
+			}
+			schedule_turn();
+		}
+
+		void strand_impl::kill()
+		{
+			std::deque<boost::shared_ptr<method_request_base> > abandoned;
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				_mortallyWounded = true;
+				abandoned.swap(_requests);
+			}
+			// abandoned requests are destroyed outside the lock, their destructors may post to us
+		}
+
+		void strand_impl::join()
+		{
+			BOOST_ASSERT(mortallyWounded());
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			if(_running && _running_thread == boost::this_thread::get_id())
+			{
+				throw std::invalid_argument("Cannot join strand from one of its own method requests.");
+			}
+			while(_running) _turn_finished.wait(lock);
+		}
+
+		bool strand_impl::mortallyWounded() const
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			return _mortallyWounded;
+		}
+
+		bool strand_impl::running_in_this_thread() const
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			return _running && _running_thread == boost::this_thread::get_id();
+		}
+	} // namespace detail
+}	// namespace poet
@@ -0,0 +1,90 @@
+/*
+	Helpers for pinning scheduler threads to CPUs.  Only implemented on
+	Linux, elsewhere pinning is silently skipped.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_DETAIL_THREAD_AFFINITY_HPP
+#define _POET_DETAIL_THREAD_AFFINITY_HPP
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace poet
+{
+	namespace detail
+	{
+		/* Parses a Linux cpu list such as "0-3,8,10-11". */
+		inline std::vector<unsigned> parse_cpu_list(const std::string &list)
+		{
+			std::vector<unsigned> cpus;
+			std::istringstream stream(list);
+			std::string range;
+			while(std::getline(stream, range, ','))
+			{
+				if(range.empty() || range == "\n") continue;
+				const std::string::size_type dash = range.find('-');
+				const unsigned first = std::strtoul(range.c_str(), 0, 10);
+				const unsigned last = dash == std::string::npos ? first :
+					std::strtoul(range.c_str() + dash + 1, 0, 10);
+				unsigned cpu;
+				for(cpu = first; cpu <= last; ++cpu)
+				{
+					cpus.push_back(cpu);
+				}
+			}
+			return cpus;
+		}
+
+		// throws std::invalid_argument if the node doesn't exist
+		inline std::vector<unsigned> numa_node_cpus(unsigned node)
+		{
+			std::ostringstream path;
+			path << "/sys/devices/system/node/node" << node << "/cpulist";
+			std::ifstream file(path.str().c_str());
+			std::string list;
+			if(!file || !std::getline(file, list))
+			{
+				throw std::invalid_argument("poet: unknown NUMA node");
+			}
+			const std::vector<unsigned> cpus = parse_cpu_list(list);
+			if(cpus.empty())
+			{
+				throw std::invalid_argument("poet: NUMA node has no CPUs");
+			}
+			return cpus;
+		}
+
+		/* Returns false if the affinity could not be set, for example because none of the cpus
+		exist, or the platform is not supported. */
+		inline bool set_current_thread_affinity(const std::vector<unsigned> &cpus)
+		{
+#ifdef __linux__
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			std::vector<unsigned>::const_iterator it;
+			for(it = cpus.begin(); it != cpus.end(); ++it)
+			{
+				if(*it < CPU_SETSIZE) CPU_SET(*it, &cpu_set);
+			}
+			return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+			return false;
+#endif
+		}
+	}
+}
+
+#endif // _POET_DETAIL_THREAD_AFFINITY_HPP
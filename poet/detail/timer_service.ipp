@@ -0,0 +1,285 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <poet/timer_service.hpp>
+#include <boost/integer_traits.hpp>
+#include <algorithm>
+
+namespace poet
+{
+	namespace detail
+	{
+		// timer_wheel
+
+		timer_wheel::timer_wheel(): _current(0), _size(0)
+		{
+			unsigned level;
+			for(level = 0; level < num_levels; ++level)
+			{
+				std::fill(_slots[level], _slots[level] + num_slots, static_cast<timer_entry *>(0));
+				_level_sizes[level] = 0;
+			}
+		}
+
+		timer_wheel::~timer_wheel()
+		{
+			unsigned level;
+			for(level = 0; level < num_levels; ++level)
+			{
+				unsigned index;
+				for(index = 0; index < num_slots; ++index)
+				{
+					while(_slots[level][index] != 0) remove(_slots[level][index]);
+				}
+			}
+		}
+
+		void timer_wheel::insert(const boost::shared_ptr<timer_entry> &entry)
+		{
+			BOOST_ASSERT(entry->bucket == 0);
+			entry->self = entry;
+			if(entry->expiry <= _current) entry->expiry = _current + 1;
+			place(entry.get());
+			++_size;
+		}
+
+		void timer_wheel::place(timer_entry *entry)
+		{
+			BOOST_ASSERT(entry->expiry >= _current);
+			const boost::uint64_t delta = entry->expiry - _current;
+			unsigned level;
+			for(level = 0; level < num_levels - 1; ++level)
+			{
+				if(delta < (static_cast<boost::uint64_t>(1) << (slot_bits * (level + 1)))) break;
+			}
+			/* Entries too far in the future for the top level go in the slot which will be
+			cascaded last, and are reinserted from there. */
+			const boost::uint64_t horizon = _current + (static_cast<boost::uint64_t>(1) << (slot_bits * num_levels)) - 1;
+			link(entry, level, slot_index(std::min(entry->expiry, horizon), level));
+		}
+
+		boost::shared_ptr<timer_entry> timer_wheel::remove(timer_entry *entry)
+		{
+			unlink(entry);
+			--_size;
+			boost::shared_ptr<timer_entry> result;
+			result.swap(entry->self);
+			return result;
+		}
+
+		void timer_wheel::link(timer_entry *entry, unsigned level, unsigned index)
+		{
+			timer_entry **bucket = &_slots[level][index];
+			entry->bucket = bucket;
+			entry->prev = 0;
+			entry->next = *bucket;
+			if(*bucket) (*bucket)->prev = entry;
+			*bucket = entry;
+			++_level_sizes[level];
+		}
+
+		void timer_wheel::unlink(timer_entry *entry)
+		{
+			BOOST_ASSERT(entry->bucket != 0);
+			if(entry->prev) entry->prev->next = entry->next;
+			else *entry->bucket = entry->next;
+			if(entry->next) entry->next->prev = entry->prev;
+			const std::size_t level = (entry->bucket - &_slots[0][0]) / num_slots;
+			--_level_sizes[level];
+			entry->bucket = 0;
+			entry->prev = 0;
+			entry->next = 0;
+		}
+
+		void timer_wheel::cascade(unsigned level)
+		{
+			/* Entries expiring on the current tick land in the level 0 slot which advance
+			is about to expire. */
+			timer_entry **bucket = &_slots[level][slot_index(_current, level)];
+			while(*bucket)
+			{
+				timer_entry *entry = *bucket;
+				unlink(entry);
+				place(entry);
+			}
+		}
+
+		void timer_wheel::advance(boost::uint64_t tick, std::vector<boost::shared_ptr<timer_entry> > &expired)
+		{
+			while(_current < tick)
+			{
+				if(_size == 0)
+				{
+					_current = tick;
+					return;
+				}
+				// skip straight to the next cascade if there is nothing on level 0
+				if(_level_sizes[0] == 0)
+				{
+					const boost::uint64_t last_before_cascade = _current | (num_slots - 1);
+					if(last_before_cascade > _current)
+					{
+						_current = std::min(last_before_cascade, tick);
+						continue;
+					}
+				}
+				++_current;
+				if(slot_index(_current, 0) == 0)
+				{
+					unsigned level;
+					for(level = 1; level < num_levels - 1 && slot_index(_current, level) == 0; ++level);
+					for(; level > 0; --level) cascade(level);
+				}
+				// entries expiring on the same tick come out in no particular order
+				timer_entry **bucket = &_slots[0][slot_index(_current, 0)];
+				while(*bucket)
+				{
+					BOOST_ASSERT((*bucket)->expiry <= _current);
+					expired.push_back(remove(*bucket));
+				}
+			}
+		}
+
+		boost::uint64_t timer_wheel::next_wake_tick() const
+		{
+			if(_size == 0) return boost::integer_traits<boost::uint64_t>::const_max;
+			const boost::uint64_t next_cascade = (_current | (num_slots - 1)) + 1;
+			if(_level_sizes[0] != 0)
+			{
+				boost::uint64_t tick;
+				for(tick = _current + 1; tick < next_cascade; ++tick)
+				{
+					if(_slots[0][slot_index(tick, 0)] != 0) return tick;
+				}
+			}
+			return next_cascade;
+		}
+
+		// timer_service_impl
+
+		timer_service_impl::timer_service_impl(const boost::posix_time::time_duration &resolution):
+			_start(boost::get_system_time()),
+			_resolution(resolution.total_microseconds() > 0 ? resolution : boost::posix_time::microseconds(1)),
+			_next_wake(0), _shutting_down(false)
+		{}
+
+		void timer_service_impl::start()
+		{
+			_thread = boost::thread(boost::bind(&timer_service_impl::thread_function, shared_from_this()));
+		}
+
+		void timer_service_impl::shutdown()
+		{
+			{
+				boost::unique_lock<boost::mutex> lock(_mutex);
+				_shutting_down = true;
+				_condition.notify_one();
+			}
+			// the last reference to the timer_service may be dropped by one of its own callbacks
+			if(boost::this_thread::get_id() == _thread.get_id()) _thread.detach();
+			else _thread.join();
+		}
+
+		boost::shared_ptr<timer_entry> timer_service_impl::schedule(const boost::system_time &expiration,
+			const boost::posix_time::time_duration &period, const boost::function<void ()> &callback)
+		{
+			boost::uint64_t period_ticks = 0;
+			if(period.total_microseconds() > 0)
+			{
+				period_ticks = std::max<boost::uint64_t>(
+					(period.total_microseconds() + _resolution.total_microseconds() - 1) / _resolution.total_microseconds(), 1);
+			}
+			boost::shared_ptr<timer_entry> entry(new timer_entry(callback, ticks_until(expiration), period_ticks));
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			if(_shutting_down) return entry;
+			_wheel.insert(entry);
+			if(_next_wake != 0 && entry->expiry < _next_wake) _condition.notify_one();
+			return entry;
+		}
+
+		void timer_service_impl::cancel(const boost::shared_ptr<timer_entry> &entry)
+		{
+			// destroyed after the lock is released, along with the callback
+			boost::shared_ptr<timer_entry> released;
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			entry->cancelled = true;
+			if(entry->bucket) released = _wheel.remove(entry.get());
+		}
+
+		std::size_t timer_service_impl::size() const
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			return _wheel.size();
+		}
+
+		void timer_service_impl::thread_function(const boost::shared_ptr<timer_service_impl> &shared_this)
+		{
+			shared_this->run();
+		}
+
+		void timer_service_impl::run()
+		{
+			std::vector<boost::shared_ptr<timer_entry> > expired;
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			while(_shutting_down == false)
+			{
+				_wheel.advance(elapsed_ticks(boost::get_system_time()), expired);
+				if(expired.empty())
+				{
+					_next_wake = _wheel.next_wake_tick();
+					if(_next_wake == boost::integer_traits<boost::uint64_t>::const_max) _condition.wait(lock);
+					else _condition.timed_wait(lock, time_of_tick(_next_wake));
+					_next_wake = 0;
+					continue;
+				}
+				lock.unlock();
+				std::vector<boost::shared_ptr<timer_entry> >::iterator it;
+				for(it = expired.begin(); it != expired.end(); ++it)
+				{
+					try
+					{
+						(*it)->callback();
+					}
+					catch(...)
+					{
+						// a throwing callback must not take down the timer thread
+					}
+				}
+				lock.lock();
+				for(it = expired.begin(); it != expired.end(); ++it)
+				{
+					if((*it)->period == 0 || (*it)->cancelled || _shutting_down) continue;
+					(*it)->expiry += (*it)->period;
+					_wheel.insert(*it);
+				}
+				lock.unlock();
+				// one-shot timers are freed here, outside the lock
+				expired.clear();
+				lock.lock();
+			}
+		}
+
+		boost::uint64_t timer_service_impl::elapsed_ticks(const boost::system_time &time) const
+		{
+			const boost::int64_t elapsed = (time - _start).total_microseconds();
+			if(elapsed <= 0) return 0;
+			return elapsed / _resolution.total_microseconds();
+		}
+
+		boost::uint64_t timer_service_impl::ticks_until(const boost::system_time &time) const
+		{
+			if(time.is_pos_infinity()) return boost::integer_traits<boost::uint64_t>::const_max;
+			if(time.is_special()) return 0;
+			const boost::int64_t elapsed = (time - _start).total_microseconds();
+			if(elapsed <= 0) return 0;
+			const boost::int64_t resolution = _resolution.total_microseconds();
+			return (elapsed + resolution - 1) / resolution;
+		}
+
+		boost::system_time timer_service_impl::time_of_tick(boost::uint64_t tick) const
+		{
+			return _start + boost::posix_time::microseconds(tick * _resolution.total_microseconds());
+		}
+	} // namespace detail
+}	// namespace poet
@@ -0,0 +1,128 @@
+/*
+	Thread-specific hooks called before a thread waits on a future.  One
+	lets the threads of a scheduler run other method requests while they
+	wait, instead of blocking.  The other lends the waiting thread's priority
+	to the method request which will fulfill the future.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_DETAIL_WAIT_HELPER_HPP
+#define _POET_DETAIL_WAIT_HELPER_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace poet
+{
+	template <typename T>
+	class future;
+
+	namespace detail
+	{
+		class wait_helper
+		{
+		public:
+			virtual ~wait_helper() {}
+			/* Runs other work until done is ready or has an exception.  It may give up
+			early, the caller then falls back on blocking. */
+			virtual void help_until(const future<void> &done) = 0;
+		};
+
+		inline void null_wait_helper_cleanup(wait_helper *)
+		{}
+		// the wait_helper installed for the current thread, if any
+		inline boost::thread_specific_ptr<wait_helper>& current_wait_helper()
+		{
+			static boost::thread_specific_ptr<wait_helper> current(&null_wait_helper_cleanup);
+			return current;
+		}
+
+		// installs a wait_helper for the current thread until it is destroyed
+		class scoped_wait_helper: public boost::noncopyable
+		{
+		public:
+			explicit scoped_wait_helper(wait_helper *helper): _previous(current_wait_helper().get())
+			{
+				current_wait_helper().reset(helper);
+			}
+			~scoped_wait_helper()
+			{
+				current_wait_helper().reset(_previous);
+			}
+		private:
+			wait_helper *_previous;
+		};
+
+		/* Something which will complete a future, and can be hurried along by a thread
+		waiting on the future.  Implemented by method_request_base.
+
+		Future bodies only keep a plain pointer to the producer they were given, so a
+		future doesn't keep its finished producer around.  Producers which set themselves
+		on a future body have to be reference counted intrusively: the body takes a
+		reference while it lends the producer a waiting thread's priority, and only
+		while there is still one.  Objects whose count stays zero, for example those
+		owned by a shared_ptr, never lend themselves out. */
+		class priority_inheritor
+		{
+		public:
+			priority_inheritor(): _references(0)
+			{}
+			virtual ~priority_inheritor() {}
+			virtual void inherit_priority(int priority) = 0;
+
+			void add_reference()
+			{
+				_references.fetch_add(1, boost::memory_order_relaxed);
+			}
+			// adds a reference unless the last one is already gone
+			bool try_add_reference()
+			{
+				unsigned references = _references.load(boost::memory_order_relaxed);
+				do
+				{
+					if(references == 0) return false;
+				}while(_references.compare_exchange_weak(references, references + 1, boost::memory_order_relaxed) == false);
+				return true;
+			}
+			void release_reference()
+			{
+				if(_references.fetch_sub(1, boost::memory_order_release) == 1)
+				{
+					boost::atomic_thread_fence(boost::memory_order_acquire);
+					destroy();
+				}
+			}
+		protected:
+			// called once the last reference is released
+			virtual void destroy()
+			{
+				delete this;
+			}
+		private:
+			boost::atomic<unsigned> _references;
+		};
+		inline void intrusive_ptr_add_ref(priority_inheritor *producer)
+		{
+			producer->add_reference();
+		}
+		inline void intrusive_ptr_release(priority_inheritor *producer)
+		{
+			producer->release_reference();
+		}
+
+		inline void null_wait_priority_cleanup(int *)
+		{}
+		// the priority the current thread lends to the futures it waits on, if any
+		inline boost::thread_specific_ptr<int>& current_wait_priority()
+		{
+			static boost::thread_specific_ptr<int> current(&null_wait_priority_cleanup);
+			return current;
+		}
+	}
+}
+
+#endif // _POET_DETAIL_WAIT_HELPER_HPP
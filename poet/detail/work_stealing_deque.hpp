@@ -0,0 +1,162 @@
+/*
+	A Chase-Lev work stealing deque of pointers.  The owning thread pushes
+	and pops at the bottom, other threads steal from the top.  See
+	"Dynamic Circular Work-Stealing Deque" by David Chase and Yossi Lev, and
+	"Correct and Efficient Work-Stealing for Weak Memory Models" by
+	Nhat Minh Le, Antoniu Pop, Albert Cohen and Francesco Zappa Nardelli
+	(which the memory orderings below follow).
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_DETAIL_WORK_STEALING_DEQUE_HPP
+#define _POET_DETAIL_WORK_STEALING_DEQUE_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace poet
+{
+	namespace detail
+	{
+		template<typename T>
+		class work_stealing_deque: boost::noncopyable
+		{
+			class circular_array: boost::noncopyable
+			{
+			public:
+				explicit circular_array(unsigned log_size):
+					_log_size(log_size), _items(new boost::atomic<T*>[std::size_t(1) << log_size])
+				{}
+				~circular_array()
+				{
+					delete [] _items;
+				}
+				long size() const
+				{
+					return long(1) << _log_size;
+				}
+				T* get(long i) const
+				{
+					return _items[i & (size() - 1)].load(boost::memory_order_relaxed);
+				}
+				void put(long i, T *item)
+				{
+					_items[i & (size() - 1)].store(item, boost::memory_order_relaxed);
+				}
+				circular_array* grow(long bottom, long top) const
+				{
+					circular_array *new_array = new circular_array(_log_size + 1);
+					long i;
+					for(i = top; i < bottom; ++i)
+					{
+						new_array->put(i, get(i));
+					}
+					return new_array;
+				}
+			private:
+				unsigned _log_size;
+				boost::atomic<T*> *_items;
+			};
+		public:
+			explicit work_stealing_deque(unsigned initial_log_size = 6):
+				_top(0), _bottom(0), _array(new circular_array(initial_log_size))
+			{
+				_retired.push_back(_array.load(boost::memory_order_relaxed));
+			}
+			~work_stealing_deque()
+			{
+				/* Arrays replaced by grow() may still be read by a concurrent steal(),
+				so they are only deleted along with the deque. */
+				typename std::vector<circular_array*>::iterator it;
+				for(it = _retired.begin(); it != _retired.end(); ++it)
+				{
+					delete *it;
+				}
+			}
+			// only the owning thread may call push_bottom
+			void push_bottom(T *item)
+			{
+				const long bottom = _bottom.load(boost::memory_order_relaxed);
+				const long top = _top.load(boost::memory_order_acquire);
+				circular_array *array = _array.load(boost::memory_order_relaxed);
+				if(bottom - top > array->size() - 1)
+				{
+					array = array->grow(bottom, top);
+					_retired.push_back(array);
+					_array.store(array, boost::memory_order_release);
+				}
+				array->put(bottom, item);
+				boost::atomic_thread_fence(boost::memory_order_release);
+				_bottom.store(bottom + 1, boost::memory_order_relaxed);
+			}
+			// only the owning thread may call pop_bottom.  Returns null if empty.
+			T* pop_bottom()
+			{
+				const long bottom = _bottom.load(boost::memory_order_relaxed) - 1;
+				circular_array *array = _array.load(boost::memory_order_relaxed);
+				_bottom.store(bottom, boost::memory_order_relaxed);
+				boost::atomic_thread_fence(boost::memory_order_seq_cst);
+				long top = _top.load(boost::memory_order_relaxed);
+				T *item = 0;
+				if(top <= bottom)
+				{
+					item = array->get(bottom);
+					if(top == bottom)
+					{
+						// last item, race against thieves for it
+						if(_top.compare_exchange_strong(top, top + 1,
+							boost::memory_order_seq_cst, boost::memory_order_relaxed) == false)
+						{
+							item = 0;
+						}
+						_bottom.store(bottom + 1, boost::memory_order_relaxed);
+					}
+				}else
+				{
+					_bottom.store(bottom + 1, boost::memory_order_relaxed);
+				}
+				return item;
+			}
+			/* May be called by any thread.  Returns null if the deque was empty,
+			or if another thread won the race for the top item. */
+			T* steal()
+			{
+				long top = _top.load(boost::memory_order_acquire);
+				boost::atomic_thread_fence(boost::memory_order_seq_cst);
+				const long bottom = _bottom.load(boost::memory_order_acquire);
+				if(top >= bottom) return 0;
+				circular_array *array = _array.load(boost::memory_order_acquire);
+				T *item = array->get(top);
+				if(_top.compare_exchange_strong(top, top + 1,
+					boost::memory_order_seq_cst, boost::memory_order_relaxed) == false)
+				{
+					return 0;
+				}
+				return item;
+			}
+			// approximate, when other threads are modifying the deque
+			std::size_t size() const
+			{
+				const long bottom = _bottom.load(boost::memory_order_relaxed);
+				const long top = _top.load(boost::memory_order_relaxed);
+				return bottom > top ? bottom - top : 0;
+			}
+			bool empty() const
+			{
+				return size() == 0;
+			}
+		private:
+			boost::atomic<long> _top;
+			boost::atomic<long> _bottom;
+			boost::atomic<circular_array*> _array;
+			std::vector<circular_array*> _retired;
+		};
+	}
+}
+
+#endif // _POET_DETAIL_WORK_STEALING_DEQUE_HPP
@@ -0,0 +1,332 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <poet/work_stealing_scheduler.hpp>
+#include <boost/bind.hpp>
+#include <poet/detail/future_continuation.hpp>
+#include <stdexcept>
+
+namespace poet
+{
+	namespace detail
+	{
+		// work_stealing_scheduler_impl
+
+		work_stealing_scheduler_impl::work_stealing_scheduler_impl(unsigned num_threads, const scheduler_attributes &attributes):
+			_injected_size(0), _sleepers(0), _work_epoch(0), _outstanding(0),
+			_mortallyWounded(false), _detached(false), _attributes(attributes)
+		{
+			unsigned i;
+			for(i = 0; i < num_threads; ++i)
+			{
+				_workers.push_back(boost::shared_ptr<worker>(new worker(this, 2 * i + 1)));
+			}
+		}
+
+		work_stealing_scheduler_impl::~work_stealing_scheduler_impl()
+		{
+			// free requests which were abandoned by a kill()
+			std::vector<boost::shared_ptr<worker> >::iterator it;
+			for(it = _workers.begin(); it != _workers.end(); ++it)
+			{
+				method_request_base *request;
+				while((request = (*it)->deque.steal()) != 0)
+				{
+					claim(request);
+				}
+			}
+		}
+
+		void work_stealing_scheduler_impl::post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			++_outstanding;
+			if(methodRequest->scheduling_guard_complete())
+			{
+				enqueue_ready(methodRequest);
+			}else
+			{
+				when_complete(methodRequest->scheduling_guard(), boost::bind(&work_stealing_scheduler_impl::guard_completed,
+					boost::weak_ptr<work_stealing_scheduler_impl>(shared_from_this()), methodRequest));
+			}
+		}
+
+		/* Pushes the ready requests onto the caller's deque, or the injection queue, all at once,
+		then wakes as many parked workers as there are requests. */
+		void work_stealing_scheduler_impl::post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			if(methodRequests.empty()) return;
+			_outstanding += methodRequests.size();
+			// the continuations are added before taking the injection lock, since they may run right away
+			std::vector<boost::shared_ptr<method_request_base> > ready;
+			ready.reserve(methodRequests.size());
+			std::vector<boost::shared_ptr<method_request_base> >::const_iterator it;
+			for(it = methodRequests.begin(); it != methodRequests.end(); ++it)
+			{
+				if((*it)->scheduling_guard_complete())
+				{
+					ready.push_back(*it);
+				}else
+				{
+					when_complete((*it)->scheduling_guard(), boost::bind(&work_stealing_scheduler_impl::guard_completed,
+						boost::weak_ptr<work_stealing_scheduler_impl>(shared_from_this()), *it));
+				}
+			}
+			if(ready.empty()) return;
+			worker *self = current_worker().get();
+			if(self && self->owner == this)
+			{
+				for(it = ready.begin(); it != ready.end(); ++it)
+				{
+					BOOST_ASSERT(!method_request_access::hook(**it).self);
+					method_request_access::hook(**it).self = *it;
+					self->deque.push_bottom(it->get());
+				}
+			}else
+			{
+				boost::unique_lock<boost::mutex> lock(_injection_mutex);
+				_injected.insert(_injected.end(), ready.begin(), ready.end());
+				_injected_size += ready.size();
+			}
+			notify_work_available(ready.size());
+		}
+
+		/* The continuation only holds a weak reference, otherwise a guard which never
+		completes would keep the scheduler alive. */
+		void work_stealing_scheduler_impl::guard_completed(const boost::weak_ptr<work_stealing_scheduler_impl> &weak_this,
+			const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			boost::shared_ptr<work_stealing_scheduler_impl> shared_this = weak_this.lock();
+			if(shared_this) shared_this->enqueue_ready(methodRequest);
+		}
+
+		void work_stealing_scheduler_impl::enqueue_ready(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			worker *self = current_worker().get();
+			if(self && self->owner == this)
+			{
+				// the request's queue hook keeps it alive while the deque holds a raw pointer to it
+				BOOST_ASSERT(!method_request_access::hook(*methodRequest).self);
+				method_request_access::hook(*methodRequest).self = methodRequest;
+				self->deque.push_bottom(methodRequest.get());
+			}else
+			{
+				boost::unique_lock<boost::mutex> lock(_injection_mutex);
+				_injected.push_back(methodRequest);
+				++_injected_size;
+			}
+			notify_work_available(1);
+		}
+
+		// wakes one parked worker for each of num_requests new requests, as far as there are any
+		void work_stealing_scheduler_impl::notify_work_available(std::size_t num_requests)
+		{
+			++_work_epoch;
+			if(_sleepers.load() > 0)
+			{
+				boost::unique_lock<boost::mutex> lock(_idle_mutex);
+				if(num_requests >= _sleepers.load())
+				{
+					_idle_condition.notify_all();
+				}else
+				{
+					std::size_t i;
+					for(i = 0; i < num_requests; ++i) _idle_condition.notify_one();
+				}
+			}
+		}
+
+		// takes back the reference enqueue_ready() left in the request's queue hook
+		boost::shared_ptr<method_request_base> work_stealing_scheduler_impl::claim(method_request_base *request)
+		{
+			boost::shared_ptr<method_request_base> result;
+			if(request) result.swap(method_request_access::hook(*request).self);
+			return result;
+		}
+
+		boost::shared_ptr<method_request_base> work_stealing_scheduler_impl::find_work(worker &self)
+		{
+			method_request_base *request = self.deque.pop_bottom();
+			if(request) return claim(request);
+
+			if(_injected_size.load() > 0)
+			{
+				boost::unique_lock<boost::mutex> lock(_injection_mutex);
+				if(_injected.empty() == false)
+				{
+					boost::shared_ptr<method_request_base> injected;
+					injected.swap(_injected.front());
+					_injected.pop_front();
+					--_injected_size;
+					return injected;
+				}
+			}
+
+			/* Try each of the other workers, starting at a random one.  A steal can fail
+			because it lost a race rather than because the victim was empty, so make two passes. */
+			const unsigned num_workers = _workers.size();
+			if(num_workers < 2) return boost::shared_ptr<method_request_base>();
+			self.random_state ^= self.random_state << 13;
+			self.random_state ^= self.random_state >> 17;
+			self.random_state ^= self.random_state << 5;
+			const unsigned start = self.random_state % num_workers;
+			unsigned i;
+			for(i = 0; i < 2 * num_workers; ++i)
+			{
+				worker &victim = *_workers.at((start + i) % num_workers);
+				if(&victim == &self) continue;
+				request = victim.deque.steal();
+				if(request) return claim(request);
+			}
+			return boost::shared_ptr<method_request_base>();
+		}
+
+		void work_stealing_scheduler_impl::run_request(boost::shared_ptr<method_request_base> &request)
+		{
+			try
+			{
+				request->run();
+			}
+			catch(...)
+			{
+				BOOST_ASSERT(false);
+			}
+			request.reset();
+			if(--_outstanding == 0 && _detached.load())
+			{
+				boost::unique_lock<boost::mutex> lock(_idle_mutex);
+				_idle_condition.notify_all();
+			}
+		}
+
+		void work_stealing_scheduler_impl::dispatcherThreadFunction(const boost::shared_ptr<work_stealing_scheduler_impl> &shared_this_in,
+			unsigned worker_index)
+		{
+			/* shared_this insures work_stealing_scheduler_impl object is not destroyed while its threads are still
+			running. */
+			boost::shared_ptr<work_stealing_scheduler_impl> shared_this = shared_this_in;
+			worker &self = *shared_this->_workers.at(worker_index);
+			current_worker().reset(&self);
+			if(shared_this->_attributes.get_cpu_set().empty() == false)
+			{
+				set_current_thread_affinity(shared_this->_attributes.get_cpu_set());
+			}
+			if(shared_this->_attributes.get_help_while_waiting())
+			{
+				current_wait_helper().reset(shared_this.get());
+			}
+			while(shared_this->mortallyWounded() == false)
+			{
+				const unsigned long epoch = shared_this->_work_epoch.load();
+				boost::shared_ptr<method_request_base> request = shared_this->find_work(self);
+				if(request)
+				{
+					shared_this->run_request(request);
+					continue;
+				}
+				if(shared_this->should_exit()) break;
+				{
+					boost::unique_lock<boost::mutex> lock(shared_this->_idle_mutex);
+					++shared_this->_sleepers;
+					while(shared_this->_work_epoch.load() == epoch && shared_this->should_exit() == false)
+					{
+						shared_this->_idle_condition.wait(lock);
+					}
+					--shared_this->_sleepers;
+				}
+			}
+			current_wait_helper().reset();
+			current_worker().reset();
+		}
+
+		/* Called on a worker whose method request is waiting on done.  Runs requests from
+		its own deque first, which are usually the ones done depends on. */
+		void work_stealing_scheduler_impl::help_until(const future<void> &done)
+		{
+			worker *self = current_worker().get();
+			if(self == 0 || self->owner != this) return;
+			bool watching = false;
+			while(mortallyWounded() == false)
+			{
+				const unsigned long epoch = _work_epoch.load();
+				if(done.ready() || done.has_exception()) return;
+				boost::shared_ptr<method_request_base> request = find_work(*self);
+				if(request)
+				{
+					run_request(request);
+					continue;
+				}
+				if(watching == false)
+				{
+					when_complete(done, boost::bind(&work_stealing_scheduler_impl::wake_waiters,
+						boost::weak_ptr<work_stealing_scheduler_impl>(shared_from_this())));
+					watching = true;
+					continue;
+				}
+				boost::unique_lock<boost::mutex> lock(_idle_mutex);
+				++_sleepers;
+				while(_work_epoch.load() == epoch && mortallyWounded() == false)
+				{
+					_idle_condition.wait(lock);
+				}
+				--_sleepers;
+			}
+		}
+
+		// wakes the idle workers, including any helping while they wait on a future which just completed
+		void work_stealing_scheduler_impl::wake_waiters(const boost::weak_ptr<work_stealing_scheduler_impl> &weak_this)
+		{
+			boost::shared_ptr<work_stealing_scheduler_impl> shared_this = weak_this.lock();
+			if(!shared_this) return;
+			boost::unique_lock<boost::mutex> lock(shared_this->_idle_mutex);
+			++shared_this->_work_epoch;
+			shared_this->_idle_condition.notify_all();
+		}
+
+		void work_stealing_scheduler_impl::kill()
+		{
+			_mortallyWounded.store(true);
+			boost::unique_lock<boost::mutex> lock(_idle_mutex);
+			_idle_condition.notify_all();
+		}
+
+		void work_stealing_scheduler_impl::detach()
+		{
+			_detached.store(true);
+			boost::unique_lock<boost::mutex> lock(_idle_mutex);
+			_idle_condition.notify_all();
+		}
+	} // namespace detail
+
+	// work_stealing_scheduler
+
+	work_stealing_scheduler::work_stealing_scheduler(unsigned num_threads, const scheduler_attributes &attributes)
+	{
+		if(num_threads == 0) num_threads = boost::thread::hardware_concurrency();
+		if(num_threads == 0) num_threads = 1;
+		_pimpl.reset(new detail::work_stealing_scheduler_impl(num_threads, attributes));
+		unsigned i;
+		for(i = 0; i < num_threads; ++i)
+		{
+			_dispatcherThreads.push_back(boost::shared_ptr<boost::thread>(
+				new boost::thread(boost::bind(&detail::work_stealing_scheduler_impl::dispatcherThreadFunction, _pimpl, i))));
+		}
+	}
+
+	void work_stealing_scheduler::join()
+	{
+		BOOST_ASSERT(_pimpl->mortallyWounded());
+		thread_container_type::iterator it;
+		for(it = _dispatcherThreads.begin(); it != _dispatcherThreads.end(); ++it)
+		{
+			if((*it)->get_id() == boost::this_thread::get_id())
+			{
+				throw std::invalid_argument("Cannot join work_stealing_scheduler thread from one of its own threads.");
+			}
+		}
+		for(it = _dispatcherThreads.begin(); it != _dispatcherThreads.end(); ++it)
+		{
+			(*it)->join();
+		}
+	}
+}	// namespace poet
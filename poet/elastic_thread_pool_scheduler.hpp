@@ -0,0 +1,288 @@
+/*
+	A thread pool scheduler which grows when its threads are tied up in
+	blocking calls, and shrinks back when it is idle.  A method request
+	declares that it is about to block (on file I/O, say) with a
+	blocking_region, and optionally waiting on a future in future::get()
+	or future::join() counts as blocking too.  The pool also grows if ready
+	method requests sit in its activation queue too long while every thread
+	is busy.  Threads beyond the core size exit after being idle for a while.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_ELASTIC_THREAD_POOL_SCHEDULER_HPP
+#define _POET_ELASTIC_THREAD_POOL_SCHEDULER_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/weak_ptr.hpp>
+#include <list>
+#include <vector>
+#include <poet/active_object.hpp>
+#include <poet/timer_service.hpp>
+
+namespace poet
+{
+	class elastic_pool_attributes
+	{
+	public:
+		elastic_pool_attributes(): _core_threads(0), _max_threads(0),
+			_wait_threshold(boost::posix_time::milliseconds(100)), _idle_timeout(boost::posix_time::seconds(1)),
+			_grow_while_waiting(false)
+		{}
+		/* The number of threads the pool starts with, and keeps when idle.  Zero, the
+		default, means boost::thread::hardware_concurrency(). */
+		void set_core_threads(unsigned core_threads)
+		{
+			_core_threads = core_threads;
+		}
+		unsigned get_core_threads() const
+		{
+			return _core_threads;
+		}
+		/* The pool never grows beyond this many threads.  Zero, the default, means four
+		times the core threads. */
+		void set_max_threads(unsigned max_threads)
+		{
+			_max_threads = max_threads;
+		}
+		unsigned get_max_threads() const
+		{
+			return _max_threads;
+		}
+		/* If the activation queue isn't empty, every thread is busy, and no thread has taken
+		a method request from the queue for this long, the pool adds a thread. */
+		void set_wait_threshold(const boost::posix_time::time_duration &wait_threshold)
+		{
+			_wait_threshold = wait_threshold;
+		}
+		const boost::posix_time::time_duration& get_wait_threshold() const
+		{
+			return _wait_threshold;
+		}
+		// threads beyond the core threads exit after the pool has been idle this long
+		void set_idle_timeout(const boost::posix_time::time_duration &idle_timeout)
+		{
+			_idle_timeout = idle_timeout;
+		}
+		const boost::posix_time::time_duration& get_idle_timeout() const
+		{
+			return _idle_timeout;
+		}
+		/* If enabled, a method request waiting on a future in future::get() or future::join()
+		counts as blocked, as if the wait were in a blocking_region.  It costs a thread-specific
+		lookup each time a pool thread waits on a future.  Defaults to false. */
+		void set_grow_while_waiting(bool enable)
+		{
+			_grow_while_waiting = enable;
+		}
+		bool get_grow_while_waiting() const
+		{
+			return _grow_while_waiting;
+		}
+	private:
+		unsigned _core_threads;
+		unsigned _max_threads;
+		boost::posix_time::time_duration _wait_threshold;
+		boost::posix_time::time_duration _idle_timeout;
+		bool _grow_while_waiting;
+	};
+
+	class elastic_pool_snapshot
+	{
+	public:
+		elastic_pool_snapshot(): num_threads(0), num_busy(0), num_blocked(0), peak_threads(0),
+			grown_for_blocking(0), grown_for_wait(0), shrunk(0)
+		{}
+		unsigned num_threads;
+		// threads running a method request, including the blocked ones
+		unsigned num_busy;
+		// threads inside a blocking_region, or waiting on a future if the pool grows while waiting
+		unsigned num_blocked;
+		unsigned peak_threads;
+		// threads added to make up for blocked threads
+		boost::uint64_t grown_for_blocking;
+		// threads added because method requests waited longer than the wait threshold
+		boost::uint64_t grown_for_wait;
+		// idle threads which exited
+		boost::uint64_t shrunk;
+	};
+
+	namespace detail
+	{
+		class elastic_pool_impl: public boost::enable_shared_from_this<elastic_pool_impl>,
+			public wait_helper
+		{
+		public:
+			inline elastic_pool_impl(const boost::shared_ptr<activation_queue_base> &activationQueue,
+				const elastic_pool_attributes &attributes);
+			inline ~elastic_pool_impl();
+			inline void start();
+			inline void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest);
+			inline void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests);
+			inline void kill();
+			inline void detach();
+			inline void join();
+			bool mortallyWounded() const
+			{
+				return _mortallyWounded.load();
+			}
+			bool running_in_this_thread() const
+			{
+				const worker_state *state = current_worker().get();
+				return state && state->pool == this;
+			}
+			inline elastic_pool_snapshot snapshot() const;
+			const elastic_pool_attributes& attributes() const
+			{
+				return _attributes;
+			}
+			inline virtual void help_until(const future<void> &done);
+			static inline void enter_blocking_region();
+			static inline void leave_blocking_region();
+			static inline void dispatcherThreadFunction(const boost::shared_ptr<elastic_pool_impl> &shared_this);
+			static inline void check(const boost::weak_ptr<elastic_pool_impl> &weak_this);
+		private:
+			struct worker_state
+			{
+				worker_state(elastic_pool_impl *pool_in): pool(pool_in), blocking_depth(0)
+				{}
+				elastic_pool_impl *pool;
+				// blocking regions may nest, only the outermost one counts
+				unsigned blocking_depth;
+			};
+
+			static void null_cleanup(worker_state *)
+			{}
+			static boost::thread_specific_ptr<worker_state>& current_worker()
+			{
+				static boost::thread_specific_ptr<worker_state> current(&null_cleanup);
+				return current;
+			}
+			bool detached() const
+			{
+				return _detached.load();
+			}
+			bool should_exit() const
+			{
+				return mortallyWounded() || (detached() && _activationQueue->empty());
+			}
+			boost::int64_t now_microseconds() const
+			{
+				return (boost::get_system_time() - _start).total_microseconds();
+			}
+			inline bool spawn_thread();
+			inline bool retire_if_requested();
+			inline void thread_exited(bool retired);
+			inline void adjust();
+
+			boost::shared_ptr<activation_queue_base> _activationQueue;
+			elastic_pool_attributes _attributes;
+			const boost::system_time _start;
+			// leader/followers, like scheduler_impl
+			boost::mutex _dispatch_mutex;
+			// protects everything below which isn't atomic
+			mutable boost::mutex _mutex;
+			std::list<boost::shared_ptr<boost::thread> > _threads;
+			std::vector<boost::thread::id> _exited_threads;
+			unsigned _num_threads;
+			unsigned _num_blocked;
+			unsigned _peak_threads;
+			// the number of idle threads asked to exit
+			unsigned _retiring;
+			boost::uint64_t _grown_for_blocking;
+			boost::uint64_t _grown_for_wait;
+			boost::uint64_t _shrunk;
+			// -1 unless the pool has had surplus idle threads since the last check
+			boost::int64_t _surplus_idle_since;
+			boost::atomic<unsigned> _num_busy;
+			// microseconds since _start
+			boost::atomic<boost::int64_t> _last_dequeue;
+			boost::atomic<bool> _mortallyWounded;
+			boost::atomic<bool> _detached;
+			timer_handle _check_timer;
+		};
+	}
+
+	class elastic_thread_pool_scheduler: public scheduler_base
+	{
+	public:
+		explicit elastic_thread_pool_scheduler(const elastic_pool_attributes &attributes = elastic_pool_attributes(),
+			const boost::shared_ptr<activation_queue_base> &activationQueue =
+			boost::shared_ptr<activation_queue_base>(new out_of_order_activation_queue)):
+			_pimpl(new detail::elastic_pool_impl(activationQueue, attributes))
+		{
+			_pimpl->start();
+		}
+		/* The threads keep running until every method request posted to the scheduler has run,
+		like with a thread_pool_scheduler. */
+		virtual ~elastic_thread_pool_scheduler()
+		{
+			_pimpl->detach();
+		}
+		virtual void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			_pimpl->post_method_request(methodRequest);
+		}
+		using scheduler_base::post_method_requests;
+		virtual void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			_pimpl->post_method_requests(methodRequests);
+		}
+		virtual void kill()
+		{
+			_pimpl->kill();
+		}
+		virtual void join()
+		{
+			_pimpl->join();
+		}
+		virtual bool running_in_this_thread() const
+		{
+			return _pimpl->running_in_this_thread();
+		}
+		// the current number of threads, and counts of how the pool has grown and shrunk
+		elastic_pool_snapshot snapshot() const
+		{
+			return _pimpl->snapshot();
+		}
+		unsigned num_threads() const
+		{
+			return snapshot().num_threads;
+		}
+		// with the defaults filled in
+		const elastic_pool_attributes& attributes() const
+		{
+			return _pimpl->attributes();
+		}
+	private:
+		boost::shared_ptr<detail::elastic_pool_impl> _pimpl;
+	};
+
+	/* Declares that the current thread is about to block, for example on file I/O.  If it is
+	one of the threads of an elastic_thread_pool_scheduler, the pool may add a thread to make
+	up for it.  On other threads it does nothing. */
+	class blocking_region: public boost::noncopyable
+	{
+	public:
+		blocking_region()
+		{
+			detail::elastic_pool_impl::enter_blocking_region();
+		}
+		~blocking_region()
+		{
+			detail::elastic_pool_impl::leave_blocking_region();
+		}
+	};
+}
+
+#include <poet/detail/elastic_thread_pool_scheduler.ipp>
+
+#endif // _POET_ELASTIC_THREAD_POOL_SCHEDULER_HPP
@@ -0,0 +1,169 @@
+/*
+	A scheduler which doesn't own any threads, for applications built around
+	an epoll (or poll, or select) event loop.  The host loop watches a file
+	descriptor which becomes readable when method requests are ready, and
+	calls run_ready() to run them on its own thread.  The scheduler can also
+	run callbacks when other file descriptors become readable, so active
+	objects can live on the I/O thread without hopping between threads.
+
+	Linux only, it uses eventfd and epoll.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_EVENT_LOOP_SCHEDULER_HPP
+#define _POET_EVENT_LOOP_SCHEDULER_HPP
+
+#ifndef __linux__
+#error "poet/event_loop_scheduler.hpp requires Linux (eventfd and epoll)."
+#endif
+
+#include <boost/atomic.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/weak_ptr.hpp>
+#include <cstddef>
+#include <map>
+#include <vector>
+#include <poet/active_object.hpp>
+
+namespace poet
+{
+	namespace detail
+	{
+		class event_loop_scheduler_impl: public boost::enable_shared_from_this<event_loop_scheduler_impl>
+		{
+		public:
+			typedef boost::function<void ()> fd_callback_type;
+
+			inline event_loop_scheduler_impl(const boost::shared_ptr<activation_queue_base> &activationQueue);
+			inline ~event_loop_scheduler_impl();
+			inline void watch_activation_queue();
+			inline void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest);
+			inline void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests);
+			inline std::size_t run_ready(std::size_t max_requests);
+			inline std::size_t poll(std::size_t max_requests);
+			inline void watch_fd(int fd, const fd_callback_type &callback);
+			inline void unwatch_fd(int fd);
+			inline void kill();
+			inline void join();
+			inline bool running_in_this_thread() const;
+			bool mortallyWounded() const
+			{
+				return _mortallyWounded.load();
+			}
+			int ready_fd() const
+			{
+				return _event_fd;
+			}
+			int poll_fd() const
+			{
+				return _epoll_fd;
+			}
+			static inline void request_ready(const boost::weak_ptr<event_loop_scheduler_impl> &weak_this);
+		private:
+			inline void signal();
+			inline void clear_signal();
+			inline void drain_event_fd();
+
+			boost::shared_ptr<activation_queue_base> _activationQueue;
+			int _event_fd;
+			int _epoll_fd;
+			// true while the eventfd has been written to and not read back, and forever once killed
+			boost::atomic<bool> _signalled;
+			boost::atomic<bool> _mortallyWounded;
+			mutable boost::mutex _mutex;
+			boost::condition _run_finished;
+			std::map<int, boost::shared_ptr<fd_callback_type> > _fd_callbacks;
+			bool _running;
+			boost::thread::id _running_thread;
+		};
+	}
+
+	/* Runs method requests on whichever thread calls run_ready() or poll(), usually the
+	thread running an event loop.  Method requests may be posted from any thread. */
+	class event_loop_scheduler: public scheduler_base
+	{
+	public:
+		/* The activation queue must implement activation_queue_base::try_get_requests and
+		activation_queue_base::set_ready_hook, as all the queues provided by libpoet do. */
+		explicit event_loop_scheduler(const boost::shared_ptr<activation_queue_base> &activationQueue =
+			boost::shared_ptr<activation_queue_base>(new out_of_order_activation_queue)):
+			_pimpl(new detail::event_loop_scheduler_impl(activationQueue))
+		{
+			_pimpl->watch_activation_queue();
+		}
+		virtual ~event_loop_scheduler()
+		{}
+		virtual void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			_pimpl->post_method_request(methodRequest);
+		}
+		using scheduler_base::post_method_requests;
+		virtual void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			_pimpl->post_method_requests(methodRequests);
+		}
+		// run_ready and poll do nothing after the scheduler is killed
+		virtual void kill()
+		{
+			_pimpl->kill();
+		}
+		// waits until a run_ready or poll call in progress on another thread returns
+		virtual void join()
+		{
+			_pimpl->join();
+		}
+		// true while called from a method request run by run_ready() or poll()
+		virtual bool running_in_this_thread() const
+		{
+			return _pimpl->running_in_this_thread();
+		}
+		/* An eventfd which is readable when method requests may be ready to run.  The host
+		loop should call run_ready() when it becomes readable. */
+		int ready_fd() const
+		{
+			return _pimpl->ready_fd();
+		}
+		/* Runs up to max_requests method requests which are ready, without blocking, and
+		returns how many it ran.  Leaves ready_fd() readable if ready requests remain. */
+		std::size_t run_ready(std::size_t max_requests = static_cast<std::size_t>(-1))
+		{
+			return _pimpl->run_ready(max_requests);
+		}
+		/* Calls callback from poll() whenever fd is readable, until unwatch_fd is called.
+		The scheduler doesn't take ownership of fd. */
+		void watch_fd(int fd, const boost::function<void ()> &callback)
+		{
+			_pimpl->watch_fd(fd, callback);
+		}
+		void unwatch_fd(int fd)
+		{
+			_pimpl->unwatch_fd(fd);
+		}
+		/* An epoll file descriptor which is readable when ready_fd() or any watched file
+		descriptor is.  A host loop which uses watch_fd should wait on this one, and call poll(). */
+		int poll_fd() const
+		{
+			return _pimpl->poll_fd();
+		}
+		/* Calls the callbacks of the watched file descriptors which are readable, then
+		run_ready(max_requests).  Never blocks.  Returns the number of callbacks and method
+		requests run. */
+		std::size_t poll(std::size_t max_requests = static_cast<std::size_t>(-1))
+		{
+			return _pimpl->poll(max_requests);
+		}
+	private:
+		boost::shared_ptr<detail::event_loop_scheduler_impl> _pimpl;
+	};
+}
+
+#include <poet/detail/event_loop_scheduler.ipp>
+
+#endif // _POET_EVENT_LOOP_SCHEDULER_HPP
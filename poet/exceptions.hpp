@@ -34,6 +34,27 @@ namespace poet
 		{}
 		virtual ~uncertain_future() throw() {}
 	};
+	class deadline_expired: public std::runtime_error
+	{
+	public:
+		deadline_expired(): std::runtime_error("poet::deadline_expired")
+		{}
+		virtual ~deadline_expired() throw() {}
+	};
+	class queue_full: public std::runtime_error
+	{
+	public:
+		queue_full(): std::runtime_error("poet::queue_full")
+		{}
+		virtual ~queue_full() throw() {}
+	};
+	class overloaded: public std::runtime_error
+	{
+	public:
+		overloaded(): std::runtime_error("poet::overloaded")
+		{}
+		virtual ~overloaded() throw() {}
+	};
 	class unknown_exception: public std::runtime_error
 	{
 	public:
@@ -22,6 +22,9 @@
 #include <boost/assert.hpp>
 #include <boost/bind.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/optional.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
@@ -32,8 +35,11 @@
 #include <boost/weak_ptr.hpp>
 #include <poet/detail/condition.hpp>
 #include <poet/detail/event_queue.hpp>
+#include <poet/detail/lazy_signal.hpp>
 #include <poet/detail/nonvoid.hpp>
+#include <poet/detail/recycling_allocator.hpp>
 #include <poet/detail/utility.hpp>
+#include <poet/detail/wait_helper.hpp>
 #include <poet/exception_ptr.hpp>
 #include <poet/exceptions.hpp>
 #include <iostream>
@@ -42,6 +48,12 @@
 #include <stdexcept>
 #include <typeinfo>
 
+/* Futures can provide a file descriptor for waiting with select, poll or epoll,
+where eventfd is available. */
+#if defined(__linux__) && !defined(POET_NO_NATIVE_WAIT_HANDLE)
+#define POET_HAS_NATIVE_WAIT_HANDLE
+#endif
+
 namespace poet
 {
 	template <typename T>
@@ -51,6 +63,9 @@ namespace poet
 	{
 		// forward declarations
 		class future_body_untyped_base;
+#ifdef POET_HAS_NATIVE_WAIT_HANDLE
+		class eventfd_wait_handle;
+#endif
 		template<typename T>
 			class future_body_base;
 		template<typename T>
@@ -67,12 +82,16 @@ namespace poet
 		};
 		template<typename T>
 			const boost::shared_ptr<typename nonvoid_future_body_base<T>::type>& get_future_body(const poet::future<T> &f);
+		template<typename T>
+			inline void prepare_to_wait(const poet::future<T> &f);
+		template<typename T>
+			inline void inherit_priority(const poet::future<T> &f, int priority);
 
 		/* class for holding wait callbacks.  Any thread can post a functor to the waiter_event_queue,
 		but only future-waiting threads should pop them off and execute them. */
 		class waiter_event_queue
 		{
-			typedef boost::signals2::signal<void (const event_queue::event_type &)> event_posted_type;
+			typedef lazy_signal<void (const event_queue::event_type &)> event_posted_type;
 			typedef event_posted_type::slot_type slot_type;
 			typedef std::vector<boost::signals2::connection> connections_type;
 		public:
@@ -95,7 +114,9 @@ namespace poet
 					if(_posting_closed) return;
 				}
 				_events.post(event);
-				_event_posted(create_poll_event());
+				// nothing but waiting threads polls us, unless something observes us
+				event_posted_type::signal_type *event_posted = _event_posted.created();
+				if(event_posted) (*event_posted)(create_poll_event());
 				{
 					boost::unique_lock<boost::mutex> lock(_condition_mutex);
 					_condition.notify_all();
@@ -125,6 +146,12 @@ namespace poet
 				post(other.create_poll_event());
 				return connection;
 			}
+			/* lets an object which is not a waiting thread find out when it has events
+			that need polling. */
+			boost::signals2::connection connect_event_posted(const slot_type &slot)
+			{
+				return _event_posted.connect(slot);
+			}
 			void close_posting()
 			{
 				boost::unique_lock<boost::mutex> lock(_mutex);
@@ -167,7 +194,7 @@ namespace poet
 			typedef boost::signals2::signal<void ()> update_signal_type;
 			typedef update_signal_type::slot_type update_slot_type;
 
-			future_body_untyped_base()
+			future_body_untyped_base(): _producer(0)
 			{
 			}
 			virtual ~future_body_untyped_base()
@@ -179,6 +206,24 @@ namespace poet
 			virtual void cancel(const poet::exception_ptr &) = 0;
 			virtual exception_ptr get_exception_ptr() const = 0;
 			virtual waiter_event_queue& waiter_callbacks() const = 0;
+			/* Blocks until the body is complete, like join(), but doesn't throw the body's
+			exception.  Unlike future::join(), it never calls the current thread's wait helper,
+			so wait helpers can use it. */
+			void wait() const
+			{
+				try
+				{
+					join();
+				}
+				catch(...)
+				{
+					if(!get_exception_ptr()) throw;
+				}
+			}
+#ifdef POET_HAS_NATIVE_WAIT_HANDLE
+			// defined in poet/detail/native_wait_handle.hpp
+			inline int native_wait_handle() const;
+#endif
 			boost::signals2::connection connectUpdate(const update_signal_type::slot_type &slot)
 			{
 				return _updateSignal.connect(slot);
@@ -191,12 +236,40 @@ namespace poet
 			{
 				return _condition;
 			}
+			/* The method request which will fulfill the future, if it is known, so threads
+			waiting on the future can lend it their priority.  Set it before the future
+			is shared with other threads.  The body doesn't keep its producer alive, the
+			producer has to call clear_producer() before it is destroyed. */
+			void set_producer(priority_inheritor *producer)
+			{
+				boost::unique_lock<boost::mutex> lock(mutex());
+				_producer = producer;
+			}
+			void clear_producer()
+			{
+				set_producer(0);
+			}
+			virtual boost::intrusive_ptr<priority_inheritor> producer() const
+			{
+				boost::unique_lock<boost::mutex> lock(mutex());
+				// a producer whose last reference is gone is already on its way to clear_producer()
+				if(_producer == 0 || _producer->try_add_reference() == false)
+				{
+					return boost::intrusive_ptr<priority_inheritor>();
+				}
+				return boost::intrusive_ptr<priority_inheritor>(_producer, false);
+			}
 		protected:
-			update_signal_type _updateSignal;
+			lazy_signal<void ()> _updateSignal;
 			mutable poet::exception_ptr _exception;
 		private:
 			mutable boost::mutex _mutex;
 			mutable boost::condition _condition;
+			priority_inheritor *_producer;
+#ifdef POET_HAS_NATIVE_WAIT_HANDLE
+			// created the first time native_wait_handle() is called
+			mutable boost::shared_ptr<eventfd_wait_handle> _native_wait_handle;
+#endif
 		};
 
 		template <typename T> class future_body_base: public virtual future_body_untyped_base
@@ -208,19 +281,30 @@ namespace poet
 
 		template <typename T> class future_body: public future_body_base<T>
 		{
+			// only create() can name it, so only create() can call the public constructors
+			struct create_tag
+			{};
 		public:
+			// the body and its shared_ptr control block share one recycled block
 			static boost::shared_ptr<future_body> create()
 			{
-				boost::shared_ptr<future_body> new_object(new future_body);
+				boost::shared_ptr<future_body> new_object =
+					boost::allocate_shared<future_body>(recycling_allocator<future_body>(), create_tag());
 				new_object->_waiter_callbacks.set_owner(new_object);
 				return new_object;
 			}
 			static boost::shared_ptr<future_body> create(const T &value)
 			{
-				boost::shared_ptr<future_body> new_object(new future_body(value));
+				boost::shared_ptr<future_body> new_object =
+					boost::allocate_shared<future_body>(recycling_allocator<future_body>(), create_tag(), value);
 				new_object->_waiter_callbacks.set_owner(new_object);
 				return new_object;
 			}
+			explicit future_body(const create_tag &): _waiter_callbacks(future_body_untyped_base::mutex(), future_body_untyped_base::condition())
+			{}
+			future_body(const create_tag &, const T &value): _value(value),
+				_waiter_callbacks(future_body_untyped_base::mutex(), future_body_untyped_base::condition())
+			{}
 
 			virtual ~future_body() {}
 			virtual void setValue(const T &value)
@@ -306,12 +390,6 @@ namespace poet
 				_dependencies.push_back(dependency);
 			}
 		private:
-			future_body(): _waiter_callbacks(future_body_untyped_base::mutex(), future_body_untyped_base::condition())
-			{}
-			future_body(const T &value): _value(value),
-				_waiter_callbacks(future_body_untyped_base::mutex(), future_body_untyped_base::condition())
-			{}
-
 			bool check_if_complete(boost::unique_lock<boost::mutex> *lock) const
 			{
 				// do initial check to make sure we don't run any wait callbacks if we are already complete
@@ -430,6 +508,10 @@ namespace poet
 			{
 				return _waiter_callbacks;
 			}
+			virtual boost::intrusive_ptr<priority_inheritor> producer() const
+			{
+				return _actualFutureBody->producer();
+			}
 		private:
 			future_body_proxy(boost::shared_ptr<future_body_base<ActualType> > actualFutureBody,
 				const boost::function<ProxyType (const ActualType&)> &conversionFunction):
@@ -508,6 +590,8 @@ namespace poet
 			{}
 			~promise_body()
 			{
+				// don't bother creating the exception when the future is already complete
+				if(_future_body->ready() || _future_body->get_exception_ptr()) return;
 				renege(poet::copy_exception(uncertain_future()));
 			}
 
@@ -598,7 +682,8 @@ namespace poet
 		friend class promise<void>;
 	public:
 		typedef T value_type;
-		promise(): _pimpl(new detail::promise_body<T>)
+		promise(): _pimpl(boost::allocate_shared<detail::promise_body<T> >(
+			detail::recycling_allocator<detail::promise_body<T> >()))
 		{}
 		virtual ~promise() {}
 		template<typename U>
@@ -649,7 +734,8 @@ namespace poet
 	public:
 		typedef void value_type;
 
-		promise(): _pimpl(new detail::promise_body<detail::nonvoid<void>::type>)
+		promise(): _pimpl(boost::allocate_shared<detail::promise_body<detail::nonvoid<void>::type> >(
+			detail::recycling_allocator<detail::promise_body<detail::nonvoid<void>::type> >()))
 		{}
 		// allow conversion from a promise with any template type to a promise<void>
 		template <typename OtherType>
@@ -764,6 +850,7 @@ namespace poet
 			{
 				throw uncertain_future();
 			}
+			detail::prepare_to_wait(*this);
 			return _future_body->getValue();
 		}
 		operator const T&() const
@@ -776,6 +863,7 @@ namespace poet
 			{
 				return;
 			}
+			detail::prepare_to_wait(*this);
 			_future_body->join();
 		}
 		bool timed_join(const boost::system_time &absolute_time) const
@@ -797,6 +885,16 @@ namespace poet
 			_future_body->waiter_callbacks().poll();
 			return _future_body->get_exception_ptr().get() != 0;
 		}
+#ifdef POET_HAS_NATIVE_WAIT_HANDLE
+		/* An eventfd which becomes readable when the future is ready or has an exception, for
+		waiting on the future alongside sockets with select, poll or epoll.  It is created on
+		the first call, and closed when the last future sharing it is destroyed.  It stays
+		readable, don't read from it. */
+		int native_wait_handle() const
+		{
+			return detail::get_future_body(*this)->native_wait_handle();
+		}
+#endif
 		void swap(future &other)
 		{
 			using std::swap;
@@ -849,6 +947,7 @@ namespace poet
 			{
 				throw uncertain_future();
 			}
+			detail::prepare_to_wait(*this);
 			_future_body->join();
 			exception_ptr ep = _future_body->get_exception_ptr();
 			if(ep) rethrow_exception(ep);
@@ -869,6 +968,7 @@ namespace poet
 			{
 				return;
 			}
+			detail::prepare_to_wait(*this);
 			_future_body->join();
 		}
 		bool timed_join(const boost::system_time &absolute_time) const
@@ -891,6 +991,12 @@ namespace poet
 			_future_body->waiter_callbacks().poll();
 			return _future_body->get_exception_ptr().get() != 0;
 		}
+#ifdef POET_HAS_NATIVE_WAIT_HANDLE
+		int native_wait_handle() const
+		{
+			return detail::get_future_body(*this)->native_wait_handle();
+		}
+#endif
 		void swap(future &other)
 		{
 			using std::swap;
@@ -903,6 +1009,27 @@ namespace poet
 		future_body_type _future_body;
 	};
 
+	/* While it exists, the current thread lends the given priority to the method requests
+	which will fulfill the futures it waits on with future::get() or future::join().  A
+	method request with a lower priority, still waiting in a priority_activation_queue,
+	has its priority raised to match, as do the requests producing its inputs. */
+	class scoped_wait_priority: public boost::noncopyable
+	{
+	public:
+		explicit scoped_wait_priority(int priority): _priority(priority),
+			_previous(detail::current_wait_priority().get())
+		{
+			detail::current_wait_priority().reset(&_priority);
+		}
+		~scoped_wait_priority()
+		{
+			detail::current_wait_priority().reset(_previous);
+		}
+	private:
+		int _priority;
+		int *_previous;
+	};
+
 	template<typename T>
 	void swap(future<T> &a, future<T> &b)
 	{
@@ -977,8 +1104,44 @@ namespace poet
 			if(!f._future_body) return shared_uncertain_future_body<T>::value;
 			return f._future_body;
 		}
+
+		// the part of prepare_to_wait() which only runs if the future isn't complete yet
+		inline void prepare_to_wait_incomplete(const boost::shared_ptr<future_body_untyped_base> &body)
+		{
+			const int *priority = current_wait_priority().get();
+			if(priority)
+			{
+				const boost::intrusive_ptr<priority_inheritor> producer = body->producer();
+				if(producer) producer->inherit_priority(*priority);
+			}
+			wait_helper *helper = current_wait_helper().get();
+			if(helper) helper->help_until(create_future<void>(body));
+		}
+
+		/* Lends the current thread's wait priority to the method request which will fulfill f, if
+		one is set.  Then if the current thread belongs to a scheduler which helps while waiting,
+		runs its other method requests until f is complete.  Does nothing if f is already complete. */
+		template<typename T>
+			void prepare_to_wait(const poet::future<T> &f)
+		{
+			// the body, since converting f to a future<void> may itself wait when T is a future
+			const boost::shared_ptr<typename nonvoid_future_body_base<T>::type> &body = get_future_body(f);
+			if(body->ready() || body->get_exception_ptr()) return;
+			prepare_to_wait_incomplete(body);
+		}
+
+		// lends priority to the method request which will fulfill f, if it is known
+		template<typename T>
+			void inherit_priority(const poet::future<T> &f, int priority)
+		{
+			const boost::intrusive_ptr<priority_inheritor> producer = get_future_body(f)->producer();
+			if(producer) producer->inherit_priority(priority);
+		}
 	} // namespace detail
 }
 
 
+// defines the when_complete continuations native_wait_handle() relies on
+#include <poet/detail/future_continuation.hpp>
+
 #endif // _POET_FUTURE_H
@@ -467,6 +467,14 @@ namespace poet
 		{
 			_selector_body->pop_selected();
 		}
+#ifdef POET_HAS_NATIVE_WAIT_HANDLE
+		/* The native_wait_handle() of selected().  pop_selected() moves on to a different
+		future with a different handle, so re-register with epoll after each pop_selected(). */
+		int native_wait_handle() const
+		{
+			return selected().native_wait_handle();
+		}
+#endif
 		void push(const future<T> &f)
 		{
 			_selector_body->push(f);
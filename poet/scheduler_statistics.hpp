@@ -0,0 +1,204 @@
+/*
+	Optional instrumentation for schedulers.  A scheduler_statistics object
+	is handed to a scheduler through scheduler_attributes, and its dispatcher
+	threads record how long method requests wait in the activation queue,
+	how long they take to run, how deep the queue is, and how often the
+	threads wake up.  The values are recorded in lock-free log-linear
+	histograms, and snapshot() copies them out for reporting.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_SCHEDULER_STATISTICS_HPP
+#define _POET_SCHEDULER_STATISTICS_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <utility>
+#include <vector>
+
+namespace poet
+{
+	/* A copy of the contents of a histogram at one point in time. */
+	class histogram_snapshot
+	{
+	public:
+		typedef boost::uint64_t value_type;
+		// lower bound of a bucket, and its count
+		typedef std::pair<value_type, value_type> bucket_type;
+
+		histogram_snapshot(): _count(0), _sum(0), _max(0)
+		{}
+		histogram_snapshot(const std::vector<bucket_type> &buckets, value_type count, value_type sum, value_type max):
+			_buckets(buckets), _count(count), _sum(sum), _max(max)
+		{}
+		// the non-empty buckets, in increasing order
+		const std::vector<bucket_type>& buckets() const {return _buckets;}
+		value_type count() const {return _count;}
+		value_type sum() const {return _sum;}
+		value_type max() const {return _max;}
+		double mean() const
+		{
+			return _count ? static_cast<double>(_sum) / _count : 0.;
+		}
+		/* The lower bound of the bucket containing the given fraction (between 0 and 1)
+		of the recorded values. */
+		value_type percentile(double fraction) const
+		{
+			const value_type target = static_cast<value_type>(fraction * _count);
+			value_type seen = 0;
+			std::vector<bucket_type>::const_iterator it;
+			for(it = _buckets.begin(); it != _buckets.end(); ++it)
+			{
+				seen += it->second;
+				if(seen > target) return it->first;
+			}
+			return _buckets.empty() ? 0 : _buckets.back().first;
+		}
+	private:
+		std::vector<bucket_type> _buckets;
+		value_type _count;
+		value_type _sum;
+		value_type _max;
+	};
+
+	/* A histogram whose buckets grow exponentially, with each power of two
+	split into sub_buckets linear buckets, so the relative error of a
+	recorded value is at most 1/sub_buckets.  record() is lock-free and may be
+	called from any number of threads at once. */
+	class histogram: boost::noncopyable
+	{
+	public:
+		typedef histogram_snapshot::value_type value_type;
+
+		histogram(): _count(0), _sum(0), _max(0)
+		{
+			unsigned i;
+			for(i = 0; i < num_buckets; ++i) _buckets[i].store(0, boost::memory_order_relaxed);
+		}
+		void record(value_type value)
+		{
+			_buckets[bucket_index(value)].fetch_add(1, boost::memory_order_relaxed);
+			_count.fetch_add(1, boost::memory_order_relaxed);
+			_sum.fetch_add(value, boost::memory_order_relaxed);
+			value_type old_max = _max.load(boost::memory_order_relaxed);
+			while(value > old_max &&
+				_max.compare_exchange_weak(old_max, value, boost::memory_order_relaxed) == false)
+			{}
+		}
+		/* The counts are read one at a time while other threads may be recording, so the
+		snapshot may be off by the values being recorded while it is taken. */
+		histogram_snapshot snapshot() const
+		{
+			std::vector<histogram_snapshot::bucket_type> buckets;
+			unsigned i;
+			for(i = 0; i < num_buckets; ++i)
+			{
+				const value_type count = _buckets[i].load(boost::memory_order_relaxed);
+				if(count) buckets.push_back(histogram_snapshot::bucket_type(bucket_lower_bound(i), count));
+			}
+			return histogram_snapshot(buckets, _count.load(boost::memory_order_relaxed),
+				_sum.load(boost::memory_order_relaxed), _max.load(boost::memory_order_relaxed));
+		}
+
+		static const unsigned sub_bucket_bits = 3;
+		static const unsigned sub_buckets = 1 << sub_bucket_bits;
+		static const unsigned num_buckets = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+		static unsigned bucket_index(value_type value)
+		{
+			if(value < 2 * sub_buckets) return static_cast<unsigned>(value);
+			unsigned msb = 0;
+			value_type shifted = value;
+			while(shifted >>= 1) ++msb;
+			const unsigned shift = msb - sub_bucket_bits;
+			return (shift + 1) * sub_buckets + static_cast<unsigned>((value >> shift) & (sub_buckets - 1));
+		}
+		static value_type bucket_lower_bound(unsigned index)
+		{
+			if(index < 2 * sub_buckets) return index;
+			const unsigned shift = index / sub_buckets - 1;
+			return static_cast<value_type>(sub_buckets + index % sub_buckets) << shift;
+		}
+	private:
+		boost::atomic<value_type> _buckets[num_buckets];
+		boost::atomic<value_type> _count;
+		boost::atomic<value_type> _sum;
+		boost::atomic<value_type> _max;
+	};
+
+	class scheduler_statistics_snapshot
+	{
+	public:
+		// microseconds from push onto the activation queue until dispatch
+		histogram_snapshot queue_wait;
+		// microseconds spent in method_request_base::run()
+		histogram_snapshot run_time;
+		// size of the activation queue, sampled every time a dispatcher thread wakes up
+		histogram_snapshot queue_depth;
+		// number of times a dispatcher thread returned from waiting on the activation queue
+		boost::uint64_t wakeups;
+		// wakeups which didn't get any method requests, for example because of a wake()
+		boost::uint64_t empty_wakeups;
+		/* How idle dispatcher threads found their next method requests (see
+		scheduler_attributes::set_spin_duration()): while spinning, while yielding,
+		or by parking in the activation queue. */
+		boost::uint64_t spin_hits;
+		boost::uint64_t yield_hits;
+		boost::uint64_t parks;
+	};
+
+	class scheduler_statistics: boost::noncopyable
+	{
+	public:
+		scheduler_statistics(): _wakeups(0), _empty_wakeups(0), _spin_hits(0), _yield_hits(0), _parks(0)
+		{}
+		histogram& queue_wait() {return _queue_wait;}
+		histogram& run_time() {return _run_time;}
+		histogram& queue_depth() {return _queue_depth;}
+		void record_wakeup(bool empty)
+		{
+			_wakeups.fetch_add(1, boost::memory_order_relaxed);
+			if(empty) _empty_wakeups.fetch_add(1, boost::memory_order_relaxed);
+		}
+		void record_spin_hit()
+		{
+			_spin_hits.fetch_add(1, boost::memory_order_relaxed);
+		}
+		void record_yield_hit()
+		{
+			_yield_hits.fetch_add(1, boost::memory_order_relaxed);
+		}
+		void record_park()
+		{
+			_parks.fetch_add(1, boost::memory_order_relaxed);
+		}
+		scheduler_statistics_snapshot snapshot() const
+		{
+			scheduler_statistics_snapshot result;
+			result.queue_wait = _queue_wait.snapshot();
+			result.run_time = _run_time.snapshot();
+			result.queue_depth = _queue_depth.snapshot();
+			result.wakeups = _wakeups.load(boost::memory_order_relaxed);
+			result.empty_wakeups = _empty_wakeups.load(boost::memory_order_relaxed);
+			result.spin_hits = _spin_hits.load(boost::memory_order_relaxed);
+			result.yield_hits = _yield_hits.load(boost::memory_order_relaxed);
+			result.parks = _parks.load(boost::memory_order_relaxed);
+			return result;
+		}
+	private:
+		histogram _queue_wait;
+		histogram _run_time;
+		histogram _queue_depth;
+		boost::atomic<boost::uint64_t> _wakeups;
+		boost::atomic<boost::uint64_t> _empty_wakeups;
+		boost::atomic<boost::uint64_t> _spin_hits;
+		boost::atomic<boost::uint64_t> _yield_hits;
+		boost::atomic<boost::uint64_t> _parks;
+	};
+}
+
+#endif // _POET_SCHEDULER_STATISTICS_HPP
@@ -0,0 +1,122 @@
+/*
+	A strand is a scheduler which doesn't own any threads.  It runs its method
+	requests one at a time, in the order they were posted, by posting itself as
+	a method request to a shared pool scheduler whenever it has work to do.
+	Thousands of active objects, each with its own strand, can share a handful
+	of pool threads, and an idle strand costs no thread at all.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_STRAND_HPP
+#define _POET_STRAND_HPP
+
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <deque>
+#include <vector>
+#include <poet/active_object.hpp>
+
+namespace poet
+{
+	namespace detail
+	{
+		class strand_impl: public boost::enable_shared_from_this<strand_impl>
+		{
+		public:
+			/* The most method requests a strand runs each time it gets a pool thread, before
+			it gives the thread back to the pool so other strands get a turn. */
+			static const unsigned max_requests_per_turn = 16;
+
+			inline strand_impl(const boost::shared_ptr<scheduler_base> &pool);
+			inline void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest);
+			inline void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests);
+			inline void kill();
+			inline void join();
+			inline bool mortallyWounded() const;
+			inline bool running_in_this_thread() const;
+			const boost::shared_ptr<scheduler_base>& pool() const
+			{
+				return _pool;
+			}
+		private:
+			enum state_type
+			{
+				// no turn is scheduled on the pool
+				idle,
+				// a turn is posted to the pool or running
+				scheduled,
+				// the front request's scheduling guard is incomplete, and a continuation will schedule a turn
+				waiting
+			};
+
+			class turn_request;
+
+			inline void schedule_turn();
+			inline void run_turn();
+			inline void guard_completed();
+
+			boost::shared_ptr<scheduler_base> _pool;
+			mutable boost::mutex _mutex;
+			boost::condition _turn_finished;
+			std::deque<boost::shared_ptr<method_request_base> > _requests;
+			state_type _state;
+			bool _running;
+			boost::thread::id _running_thread;
+			bool _mortallyWounded;
+		};
+	}
+
+	/* Runs method requests serially, in the order they are posted, on the threads of another
+	scheduler such as a thread_pool_scheduler.  A request whose scheduling guard is not complete
+	holds up the requests posted after it, like in_order_activation_queue, but it doesn't hold
+	up a pool thread. */
+	class strand: public scheduler_base
+	{
+	public:
+		explicit strand(const boost::shared_ptr<scheduler_base> &pool): _pimpl(new detail::strand_impl(pool))
+		{}
+		/* Requests which are already posted still run after the strand is destroyed,
+		like with a detached scheduler. */
+		virtual ~strand()
+		{}
+		virtual void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			_pimpl->post_method_request(methodRequest);
+		}
+		using scheduler_base::post_method_requests;
+		virtual void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			_pimpl->post_method_requests(methodRequests);
+		}
+		/* Discards the requests which haven't started running yet.  The pool is not
+		killed, it may be shared by other strands. */
+		virtual void kill()
+		{
+			_pimpl->kill();
+		}
+		// waits until the request which was running when the strand was killed (if any) returns
+		virtual void join()
+		{
+			_pimpl->join();
+		}
+		virtual bool running_in_this_thread() const
+		{
+			return _pimpl->running_in_this_thread();
+		}
+		const boost::shared_ptr<scheduler_base>& pool() const
+		{
+			return _pimpl->pool();
+		}
+	private:
+		boost::shared_ptr<detail::strand_impl> _pimpl;
+	};
+}
+
+#include <poet/detail/strand.ipp>
+
+#endif // _POET_STRAND_HPP
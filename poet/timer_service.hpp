@@ -0,0 +1,314 @@
+/*
+	A timer_service runs callbacks at given times, from a single thread
+	of its own.  Pending timers are kept in a hierarchical timing wheel, so
+	adding, cancelling and expiring a timer are all constant time no matter
+	how many timers are pending.  On top of it are post_at, post_after and
+	post_every, which post method requests to a scheduler later (or
+	periodically) without tying up one of the scheduler's threads,
+	delay, which returns a future that becomes ready after a given time,
+	and with_deadline, which puts a deadline on a future.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_TIMER_SERVICE_HPP
+#define _POET_TIMER_SERVICE_HPP
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/weak_ptr.hpp>
+#include <cstddef>
+#include <vector>
+#include <poet/active_object.hpp>
+#include <poet/detail/future_continuation.hpp>
+#include <poet/exceptions.hpp>
+#include <poet/future.hpp>
+
+namespace poet
+{
+	namespace detail
+	{
+		struct timer_entry
+		{
+			timer_entry(const boost::function<void ()> &callback_in, boost::uint64_t expiry_in, boost::uint64_t period_in):
+				bucket(0), prev(0), next(0), expiry(expiry_in), period(period_in), callback(callback_in), cancelled(false)
+			{}
+			// the wheel slot the entry is linked into, or null if it isn't linked
+			timer_entry **bucket;
+			timer_entry *prev;
+			timer_entry *next;
+			// in ticks
+			boost::uint64_t expiry;
+			// in ticks, zero for a timer which only expires once
+			boost::uint64_t period;
+			boost::function<void ()> callback;
+			// keeps the entry alive while it is linked into a wheel
+			boost::shared_ptr<timer_entry> self;
+			bool cancelled;
+		};
+
+		/* A hierarchical timing wheel.  Level 0 has a slot for each of the next 256 ticks, and each
+		higher level has slots covering 256 times as many ticks as the level below it.  An entry is
+		put on the lowest level it fits in, and when the current tick reaches the start of a higher level
+		slot, its entries are cascaded down.  Not thread-safe, timer_service_impl locks around it. */
+		class timer_wheel: public boost::noncopyable
+		{
+		public:
+			static const unsigned slot_bits = 8;
+			static const unsigned num_slots = 1 << slot_bits;
+			static const unsigned num_levels = 4;
+
+			inline timer_wheel();
+			inline ~timer_wheel();
+			// entries which are already due are moved to the next tick
+			inline void insert(const boost::shared_ptr<timer_entry> &entry);
+			// returns the reference which kept the entry alive, so it may be destroyed outside any lock
+			inline boost::shared_ptr<timer_entry> remove(timer_entry *entry);
+			/* Advances the current tick to tick, appending the entries which expire along the
+			way to expired, in order of expiration. */
+			inline void advance(boost::uint64_t tick, std::vector<boost::shared_ptr<timer_entry> > &expired);
+			/* A tick which is no later than the earliest expiration of any entry, and no earlier
+			than the next tick.  Returns the maximum tick if the wheel is empty. */
+			inline boost::uint64_t next_wake_tick() const;
+			boost::uint64_t current_tick() const
+			{
+				return _current;
+			}
+			std::size_t size() const
+			{
+				return _size;
+			}
+		private:
+			inline void place(timer_entry *entry);
+			inline void link(timer_entry *entry, unsigned level, unsigned index);
+			inline void unlink(timer_entry *entry);
+			inline void cascade(unsigned level);
+			static unsigned slot_index(boost::uint64_t tick, unsigned level)
+			{
+				return (tick >> (slot_bits * level)) & (num_slots - 1);
+			}
+
+			timer_entry *_slots[num_levels][num_slots];
+			std::size_t _level_sizes[num_levels];
+			boost::uint64_t _current;
+			std::size_t _size;
+		};
+
+		class timer_service_impl: public boost::enable_shared_from_this<timer_service_impl>
+		{
+		public:
+			inline timer_service_impl(const boost::posix_time::time_duration &resolution);
+			inline void start();
+			inline void shutdown();
+			inline boost::shared_ptr<timer_entry> schedule(const boost::system_time &expiration,
+				const boost::posix_time::time_duration &period, const boost::function<void ()> &callback);
+			inline void cancel(const boost::shared_ptr<timer_entry> &entry);
+			inline std::size_t size() const;
+			const boost::posix_time::time_duration& resolution() const
+			{
+				return _resolution;
+			}
+			static inline void thread_function(const boost::shared_ptr<timer_service_impl> &shared_this);
+		private:
+			inline void run();
+			inline boost::uint64_t elapsed_ticks(const boost::system_time &time) const;
+			inline boost::uint64_t ticks_until(const boost::system_time &time) const;
+			inline boost::system_time time_of_tick(boost::uint64_t tick) const;
+
+			const boost::system_time _start;
+			const boost::posix_time::time_duration _resolution;
+			mutable boost::mutex _mutex;
+			boost::condition _condition;
+			timer_wheel _wheel;
+			// the tick the timer thread is sleeping until, zero while it is awake
+			boost::uint64_t _next_wake;
+			bool _shutting_down;
+			boost::thread _thread;
+		};
+
+		// a method request which calls a function
+		class function_request: public method_request_base
+		{
+		public:
+			function_request(const boost::function<void ()> &function): _function(function)
+			{}
+			virtual void run()
+			{
+				_function();
+			}
+			virtual future<void> scheduling_guard() const
+			{
+				return ready_scheduling_guard();
+			}
+		private:
+			boost::function<void ()> _function;
+		};
+	}
+
+	/* Refers to a timer added to a timer_service, so it can be cancelled.  Handles don't keep
+	timers alive, a timer which isn't cancelled expires whether or not any handles to it remain. */
+	class timer_handle
+	{
+	public:
+		timer_handle()
+		{}
+		timer_handle(const boost::shared_ptr<detail::timer_service_impl> &service,
+			const boost::shared_ptr<detail::timer_entry> &entry):
+			_service(service), _entry(entry)
+		{}
+		/* Removes the timer, if it hasn't expired yet.  A periodic timer stops repeating.
+		Doesn't wait for a callback which the timer thread has already started. */
+		void cancel()
+		{
+			boost::shared_ptr<detail::timer_service_impl> service = _service.lock();
+			boost::shared_ptr<detail::timer_entry> entry = _entry.lock();
+			if(service && entry) service->cancel(entry);
+		}
+	private:
+		boost::weak_ptr<detail::timer_service_impl> _service;
+		boost::weak_ptr<detail::timer_entry> _entry;
+	};
+
+	class timer_service: public boost::noncopyable
+	{
+	public:
+		/* Expiration times are rounded up to a multiple of the resolution, and the timer thread
+		wakes up at most once per resolution. */
+		explicit timer_service(const boost::posix_time::time_duration &resolution = boost::posix_time::milliseconds(1)):
+			_pimpl(new detail::timer_service_impl(resolution))
+		{
+			_pimpl->start();
+		}
+		// pending timers are discarded without running
+		~timer_service()
+		{
+			_pimpl->shutdown();
+		}
+		timer_handle schedule_at(const boost::system_time &expiration, const boost::function<void ()> &callback)
+		{
+			return timer_handle(_pimpl, _pimpl->schedule(expiration, boost::posix_time::seconds(0), callback));
+		}
+		timer_handle schedule_after(const boost::posix_time::time_duration &delay, const boost::function<void ()> &callback)
+		{
+			return schedule_at(boost::get_system_time() + delay, callback);
+		}
+		// calls callback every period, starting one period from now, until cancelled
+		timer_handle schedule_every(const boost::posix_time::time_duration &period, const boost::function<void ()> &callback)
+		{
+			return timer_handle(_pimpl, _pimpl->schedule(boost::get_system_time() + period, period, callback));
+		}
+		// the number of pending timers
+		std::size_t size() const
+		{
+			return _pimpl->size();
+		}
+		const boost::posix_time::time_duration& resolution() const
+		{
+			return _pimpl->resolution();
+		}
+		/* A timer service shared by everything which doesn't specify one.  It is created the first
+		time it is used, and never destroyed. */
+		static timer_service& default_service()
+		{
+			static timer_service *service = new timer_service();
+			return *service;
+		}
+	private:
+		boost::shared_ptr<detail::timer_service_impl> _pimpl;
+	};
+
+	namespace detail
+	{
+		inline void post_timed_request(const boost::weak_ptr<scheduler_base> &weak_scheduler,
+			const boost::shared_ptr<method_request_base> &request)
+		{
+			boost::shared_ptr<scheduler_base> scheduler = weak_scheduler.lock();
+			if(scheduler) scheduler->post_method_request(request);
+		}
+		inline void post_periodic_request(const boost::weak_ptr<scheduler_base> &weak_scheduler,
+			const boost::function<void ()> &function)
+		{
+			boost::shared_ptr<scheduler_base> scheduler = weak_scheduler.lock();
+			if(scheduler) scheduler->post_method_request(boost::shared_ptr<method_request_base>(new function_request(function)));
+		}
+		inline void fulfill_delay(promise<void> &delayed)
+		{
+			delayed.fulfill();
+		}
+		template<typename T>
+		void meet_deadline(promise<T> &result, const future<T> &input, timer_handle &timer)
+		{
+			timer.cancel();
+			// does nothing if the deadline already reneged on the result
+			result.fulfill(input);
+		}
+		template<typename T>
+		void expire_deadline(promise<T> &result, const future<T> &input, bool cancel_upstream)
+		{
+			result.renege(deadline_expired());
+			if(cancel_upstream)
+			{
+				get_future_body(input)->cancel(poet::copy_exception(deadline_expired()));
+			}
+		}
+	}
+
+	/* Posts request to scheduler at the given time.  The timer only holds a weak reference to the
+	scheduler, if the scheduler is gone by then the request is dropped. */
+	inline timer_handle post_at(const boost::shared_ptr<scheduler_base> &scheduler, const boost::system_time &time,
+		const boost::shared_ptr<method_request_base> &request, timer_service &service = timer_service::default_service())
+	{
+		return service.schedule_at(time,
+			boost::bind(&detail::post_timed_request, boost::weak_ptr<scheduler_base>(scheduler), request));
+	}
+	inline timer_handle post_after(const boost::shared_ptr<scheduler_base> &scheduler, const boost::posix_time::time_duration &delay,
+		const boost::shared_ptr<method_request_base> &request, timer_service &service = timer_service::default_service())
+	{
+		return post_at(scheduler, boost::get_system_time() + delay, request, service);
+	}
+	/* Posts a method request which calls function to scheduler every period, until the timer
+	is cancelled or the scheduler is destroyed. */
+	inline timer_handle post_every(const boost::shared_ptr<scheduler_base> &scheduler, const boost::posix_time::time_duration &period,
+		const boost::function<void ()> &function, timer_service &service = timer_service::default_service())
+	{
+		return service.schedule_every(period,
+			boost::bind(&detail::post_periodic_request, boost::weak_ptr<scheduler_base>(scheduler), function));
+	}
+
+	/* Returns a future which becomes ready after the given delay.  Combine it with future_select
+	to give up waiting on another future after a timeout. */
+	inline future<void> delay(const boost::posix_time::time_duration &duration,
+		timer_service &service = timer_service::default_service())
+	{
+		promise<void> delayed;
+		service.schedule_after(duration, boost::bind(&detail::fulfill_delay, delayed));
+		return delayed;
+	}
+
+	/* Returns a future which completes like input, unless deadline passes first, in which case it gets
+	a deadline_expired exception.  With cancel_upstream, input gets the deadline_expired exception too,
+	which stops an active_function from running a method request which hasn't started yet. */
+	template<typename T>
+	future<T> with_deadline(const future<T> &input, const boost::system_time &deadline,
+		bool cancel_upstream = false, timer_service &service = timer_service::default_service())
+	{
+		if(input.ready() || input.has_exception()) return input;
+		promise<T> result;
+		timer_handle timer = service.schedule_at(deadline,
+			boost::bind(&detail::expire_deadline<T>, result, input, cancel_upstream));
+		detail::when_complete(input, boost::bind(&detail::meet_deadline<T>, result, input, timer));
+		return result;
+	}
+}
+
+#include <poet/detail/timer_service.ipp>
+
+#endif // _POET_TIMER_SERVICE_HPP
@@ -0,0 +1,152 @@
+/*
+	A scheduler which runs method requests on a pool of threads, each of
+	which has its own work stealing deque.  Method requests posted from one
+	of the pool's own threads (for example, nested active_function calls)
+	go onto that thread's deque, so recursive divide-and-conquer algorithms
+	don't all contend for one shared activation queue.  Idle threads steal
+	work from the other threads' deques.
+*/
+
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef _POET_WORK_STEALING_SCHEDULER_HPP
+#define _POET_WORK_STEALING_SCHEDULER_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/weak_ptr.hpp>
+#include <deque>
+#include <poet/active_object.hpp>
+#include <poet/detail/work_stealing_deque.hpp>
+#include <vector>
+
+namespace poet
+{
+	namespace detail
+	{
+		class work_stealing_scheduler_impl: public boost::enable_shared_from_this<work_stealing_scheduler_impl>,
+			public wait_helper
+		{
+		public:
+			inline work_stealing_scheduler_impl(unsigned num_threads, const scheduler_attributes &attributes);
+			inline ~work_stealing_scheduler_impl();
+			inline void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest);
+			inline void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests);
+			inline void kill();
+			inline void detach();
+			bool mortallyWounded() const
+			{
+				return _mortallyWounded.load();
+			}
+			unsigned num_threads() const
+			{
+				return _workers.size();
+			}
+			bool running_in_this_thread() const
+			{
+				const worker *self = current_worker().get();
+				return self && self->owner == this;
+			}
+			static inline void dispatcherThreadFunction(const boost::shared_ptr<work_stealing_scheduler_impl> &shared_this,
+				unsigned worker_index);
+			inline virtual void help_until(const future<void> &done);
+		private:
+			struct worker
+			{
+				worker(work_stealing_scheduler_impl *owner_in, unsigned seed):
+					owner(owner_in), random_state(seed)
+				{}
+				work_stealing_deque<method_request_base> deque;
+				work_stealing_scheduler_impl *owner;
+				unsigned random_state;
+			};
+
+			static void null_cleanup(worker *)
+			{}
+			static boost::thread_specific_ptr<worker>& current_worker()
+			{
+				static boost::thread_specific_ptr<worker> current(&null_cleanup);
+				return current;
+			}
+			inline void enqueue_ready(const boost::shared_ptr<method_request_base> &methodRequest);
+			static inline boost::shared_ptr<method_request_base> claim(method_request_base *request);
+			inline boost::shared_ptr<method_request_base> find_work(worker &self);
+			inline void run_request(boost::shared_ptr<method_request_base> &request);
+			inline void notify_work_available(std::size_t num_requests);
+			static inline void guard_completed(const boost::weak_ptr<work_stealing_scheduler_impl> &weak_this,
+				const boost::shared_ptr<method_request_base> &methodRequest);
+			static inline void wake_waiters(const boost::weak_ptr<work_stealing_scheduler_impl> &weak_this);
+			bool should_exit() const
+			{
+				return _mortallyWounded.load() || (_detached.load() && _outstanding.load() == 0);
+			}
+
+			std::vector<boost::shared_ptr<worker> > _workers;
+			/* method requests posted from threads outside the pool are "injected" here,
+			since only a worker may push onto its own deque. */
+			boost::mutex _injection_mutex;
+			std::deque<boost::shared_ptr<method_request_base> > _injected;
+			boost::atomic<std::size_t> _injected_size;
+			// idle workers park on _idle_condition
+			boost::mutex _idle_mutex;
+			boost::condition _idle_condition;
+			boost::atomic<unsigned> _sleepers;
+			boost::atomic<unsigned long> _work_epoch;
+			// method requests which have been posted but haven't finished running yet
+			boost::atomic<long> _outstanding;
+			boost::atomic<bool> _mortallyWounded;
+			boost::atomic<bool> _detached;
+			const scheduler_attributes _attributes;
+		};
+	}
+
+	class work_stealing_scheduler: public scheduler_base
+	{
+	public:
+		/* Starts num_threads threads, or boost::thread::hardware_concurrency() if it is zero.
+		Of the attributes, only the cpu set and help_while_waiting apply, there is no activation
+		queue to take batches from or spin on. */
+		inline explicit work_stealing_scheduler(unsigned num_threads = 0,
+			const scheduler_attributes &attributes = scheduler_attributes());
+		virtual ~work_stealing_scheduler()
+		{
+			_pimpl->detach();
+		}
+		virtual void post_method_request(const boost::shared_ptr<method_request_base> &methodRequest)
+		{
+			_pimpl->post_method_request(methodRequest);
+		}
+		using scheduler_base::post_method_requests;
+		virtual void post_method_requests(const std::vector<boost::shared_ptr<method_request_base> > &methodRequests)
+		{
+			_pimpl->post_method_requests(methodRequests);
+		}
+		virtual void kill()
+		{
+			_pimpl->kill();
+		}
+		inline virtual void join();
+		virtual bool running_in_this_thread() const
+		{
+			return _pimpl->running_in_this_thread();
+		}
+		unsigned num_threads() const
+		{
+			return _dispatcherThreads.size();
+		}
+	private:
+		typedef std::vector<boost::shared_ptr<boost::thread> > thread_container_type;
+
+		boost::shared_ptr<detail::work_stealing_scheduler_impl> _pimpl;
+		thread_container_type _dispatcherThreads;
+	};
+}
+
+#include <poet/detail/work_stealing_scheduler.ipp>
+
+#endif // _POET_WORK_STEALING_SCHEDULER_HPP
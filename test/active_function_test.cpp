@@ -10,9 +10,13 @@
 
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <boost/tuple/tuple.hpp>
 #include <functional>
 #include <iostream>
+#include <stdexcept>
 #include <poet/active_function.hpp>
+#include <poet/strand.hpp>
+#include <poet/work_stealing_scheduler.hpp>
 #include <vector>
 
 int increment(int value)
@@ -83,6 +87,67 @@ void in_order_activation_queue_test()
 	assert(results.at(1).get() == 2);
 }
 
+int get_seven()
+{
+	return 7;
+}
+
+void out_of_order_activation_queue_test()
+{
+	boost::shared_ptr<poet::out_of_order_activation_queue> activation_queue(new poet::out_of_order_activation_queue);
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler(activation_queue));
+	poet::active_function<int (int)> inc(&increment, scheduler);
+	poet::active_function<int ()> seven(&get_seven, scheduler);
+
+	poet::promise<int> blocked_promise;
+	poet::future<int> blocked = inc(blocked_promise);
+	poet::future<int> ready = inc(1);
+	poet::future<int> no_args = seven();
+	// requests with ready arguments don't wait behind ones with pending arguments
+	assert(ready.get() == 2);
+	assert(no_args.get() == 7);
+	assert(blocked.ready() == false);
+
+	poet::promise<int> reneged_promise;
+	poet::future<int> reneged = inc(reneged_promise);
+	reneged_promise.renege(std::runtime_error("reneged"));
+	try
+	{
+		reneged.get();
+		assert(false);
+	}
+	catch(const std::runtime_error &)
+	{}
+
+	blocked_promise.fulfill(2);
+	assert(blocked.get() == 3);
+}
+
+// call_range submits a whole batch of calls at once
+void call_range_test()
+{
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler(
+		boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue)));
+	poet::active_function<int (int, int)> adder((std::plus<int>()), scheduler);
+	std::vector<boost::tuple<int, poet::future<int> > > arguments;
+	int i;
+	for(i = 0; i < 100; ++i)
+	{
+		arguments.push_back(boost::make_tuple(i, poet::future<int>(i)));
+	}
+	std::vector<poet::future<int> > results = adder.call_range(arguments.begin(), arguments.end());
+	assert(results.size() == arguments.size());
+	for(i = 0; i < 100; ++i)
+	{
+		assert(results.at(i).get() == 2 * i);
+	}
+
+	poet::active_function<int ()> seven(&get_seven, scheduler);
+	std::vector<boost::tuple<> > no_arguments(3);
+	results = seven.call_range(no_arguments.begin(), no_arguments.end());
+	assert(results.size() == 3 && results.at(2).get() == 7);
+}
+
 void default_construction_test()
 {
 	poet::active_function<int (int, int)> default_constructed;
@@ -91,6 +156,51 @@ void default_construction_test()
 	assert(default_constructed(1, 2).get() == 3);
 }
 
+boost::thread::id current_thread_id()
+{
+	return boost::this_thread::get_id();
+}
+
+int negate(int value)
+{
+	return -value;
+}
+
+// with a single threaded scheduler, these only return because the inner call runs inline
+bool reentrant_call(const poet::active_function<boost::thread::id ()> &inner)
+{
+	poet::future<boost::thread::id> result = inner();
+	return result.ready() && result.get() == boost::this_thread::get_id();
+}
+
+bool reentrant_call_with_unready_argument(const poet::active_function<int (int)> &inner,
+	const poet::promise<int> &input)
+{
+	return inner(input).ready();
+}
+
+void inline_calls_test(const boost::shared_ptr<poet::scheduler_base> &scheduler)
+{
+	assert(scheduler->running_in_this_thread() == false);
+	poet::active_function<boost::thread::id ()> inner(&current_thread_id, scheduler);
+	assert(inner.inline_calls() == false);
+	inner.set_inline_calls(true);
+	// calls from other threads are still posted
+	assert(inner().get() != boost::this_thread::get_id());
+
+	poet::active_function<bool ()> outer(boost::bind(&reentrant_call, boost::cref(inner)), scheduler);
+	assert(outer().get());
+
+	// calls with incomplete arguments are still posted
+	poet::active_function<int (int)> inner_negate(&negate, scheduler);
+	inner_negate.set_inline_calls(true);
+	poet::promise<int> input;
+	poet::active_function<bool ()> outer_unready(boost::bind(&reentrant_call_with_unready_argument,
+		boost::cref(inner_negate), input), scheduler);
+	assert(outer_unready().get() == false);
+	input.fulfill(1);
+}
+
 int main()
 {
 	std::cerr << __FILE__ << "... ";
@@ -114,7 +224,14 @@ int main()
 	}
 	slot_tracking_test();
 	in_order_activation_queue_test();
+	out_of_order_activation_queue_test();
 	default_construction_test();
+	inline_calls_test(boost::shared_ptr<poet::scheduler_base>(new poet::scheduler));
+	inline_calls_test(boost::shared_ptr<poet::scheduler_base>(new poet::thread_pool_scheduler(2)));
+	inline_calls_test(boost::shared_ptr<poet::scheduler_base>(new poet::strand(
+		boost::shared_ptr<poet::scheduler_base>(new poet::thread_pool_scheduler(2)))));
+	inline_calls_test(boost::shared_ptr<poet::scheduler_base>(new poet::work_stealing_scheduler(2)));
+	call_range_test();
 
 	std::cerr << "OK\n";
 	return 0;
@@ -0,0 +1,273 @@
+/*
+	A test program for bounded_activation_queue.
+*/
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_object.hpp>
+#include <vector>
+
+// appends its id to a log when run, or minus its id when cancelled
+class log_request: public poet::method_request_base
+{
+public:
+	log_request(std::vector<int> &log, int id, const poet::future<void> &guard):
+		_log(log), _id(id), _guard(guard)
+	{}
+	virtual void run()
+	{
+		_log.push_back(_id);
+	}
+	virtual void cancel(const poet::exception_ptr &)
+	{
+		_log.push_back(-_id);
+	}
+	virtual bool cancellable() const
+	{
+		return true;
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return _guard;
+	}
+private:
+	std::vector<int> &_log;
+	int _id;
+	poet::future<void> _guard;
+};
+
+// fulfills a promise when run, and reneges on it when cancelled if cancellable
+class fulfill_request: public poet::method_request_base
+{
+public:
+	fulfill_request(const poet::promise<int> &result, int value, bool cancellable):
+		_result(result), _value(value), _cancellable(cancellable)
+	{}
+	virtual void run()
+	{
+		_result.fulfill(_value);
+	}
+	virtual void cancel(const poet::exception_ptr &exception)
+	{
+		BOOST_ASSERT(_cancellable);
+		_result.renege(exception);
+	}
+	virtual bool cancellable() const
+	{
+		return _cancellable;
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(1);
+	}
+private:
+	poet::promise<int> _result;
+	int _value;
+	bool _cancellable;
+};
+
+boost::shared_ptr<poet::method_request_base> make_request(std::vector<int> &log, int id,
+	const poet::future<void> &guard = poet::future<int>(1))
+{
+	return boost::shared_ptr<poet::method_request_base>(new log_request(log, id, guard));
+}
+
+void fail_test()
+{
+	poet::bounded_activation_queue queue(boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue),
+		2, poet::bounded_activation_queue::fail_on_overflow);
+	BOOST_ASSERT(queue.capacity() == 2);
+	BOOST_ASSERT(queue.policy() == poet::bounded_activation_queue::fail_on_overflow);
+	std::vector<int> log;
+	BOOST_ASSERT(queue.space_available().ready());
+	queue.push_back(make_request(log, 1));
+	queue.push_back(make_request(log, 2));
+	BOOST_ASSERT(queue.size() == 2);
+	try
+	{
+		queue.push_back(make_request(log, 3));
+		BOOST_ASSERT(false);
+	}
+	catch(const poet::queue_full &)
+	{}
+	BOOST_ASSERT(queue.size() == 2);
+	poet::future<void> space = queue.space_available();
+	BOOST_ASSERT(space.ready() == false);
+	queue.get_request()->run();
+	BOOST_ASSERT(space.ready());
+	BOOST_ASSERT(queue.size() == 1);
+	queue.push_back(make_request(log, 3));
+	queue.get_request()->run();
+	queue.get_request()->run();
+	BOOST_ASSERT(queue.empty());
+	static const int expected[] = {1, 2, 3};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 3));
+}
+
+void drop_oldest_test()
+{
+	poet::bounded_activation_queue queue(boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue),
+		2, poet::bounded_activation_queue::drop_oldest_on_overflow);
+	std::vector<int> log;
+	queue.push_back(make_request(log, 1));
+	queue.push_back(make_request(log, 2));
+	queue.push_back(make_request(log, 3));
+	BOOST_ASSERT(queue.size() == 2);
+	queue.get_request()->run();
+	queue.push_back(make_request(log, 4));
+	queue.push_back(make_request(log, 5));
+	while(queue.empty() == false)
+	{
+		queue.get_request()->run();
+	}
+	static const int expected[] = {-1, 2, -3, 4, 5};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 5));
+	queue.wake();
+	BOOST_ASSERT(!queue.get_request());
+}
+
+void push(poet::activation_queue_base &queue, const boost::shared_ptr<poet::method_request_base> &request)
+{
+	queue.push_back(request);
+}
+
+// requests which aren't cancellable are skipped over when dropping, and are never lost
+void drop_custom_request_test()
+{
+	poet::bounded_activation_queue queue(boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue),
+		2, poet::bounded_activation_queue::drop_oldest_on_overflow);
+	// not results(4), which would copy one promise into every element
+	std::vector<poet::promise<int> > results;
+	int i;
+	for(i = 0; i < 4; ++i) results.push_back(poet::promise<int>());
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new fulfill_request(results.at(0), 0, false)));
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new fulfill_request(results.at(1), 1, true)));
+	// drops request 1, since request 0 can't be cancelled
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new fulfill_request(results.at(2), 2, false)));
+	BOOST_ASSERT(queue.size() == 2);
+	try
+	{
+		poet::future<int>(results.at(1)).get();
+		BOOST_ASSERT(false);
+	}
+	catch(const poet::queue_full &)
+	{}
+	// nothing left to drop, so the push waits for space
+	boost::thread pusher(boost::bind(&push, boost::ref(queue),
+		boost::shared_ptr<poet::method_request_base>(new fulfill_request(results.at(3), 3, true))));
+	BOOST_ASSERT(pusher.timed_join(boost::posix_time::millisec(200)) == false);
+	queue.get_request()->run();
+	pusher.join();
+	while(queue.empty() == false)
+	{
+		queue.get_request()->run();
+	}
+	BOOST_ASSERT(poet::future<int>(results.at(0)).get() == 0);
+	BOOST_ASSERT(poet::future<int>(results.at(2)).get() == 2);
+	BOOST_ASSERT(poet::future<int>(results.at(3)).get() == 3);
+}
+
+// dropped requests left waiting in the wrapped queue are limited to the capacity
+void dropped_backlog_test()
+{
+	poet::bounded_activation_queue queue(boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue),
+		1, poet::bounded_activation_queue::drop_oldest_on_overflow);
+	std::vector<int> log;
+	poet::promise<void> guard;
+	queue.push_back(make_request(log, 1, guard));
+	// drops request 1, which stays in the wrapped queue until its guard completes
+	queue.push_back(make_request(log, 2, guard));
+	BOOST_ASSERT(log == std::vector<int>(1, -1));
+	// dropping request 2 as well would leave two dropped requests in the wrapped queue
+	boost::thread pusher(boost::bind(&push, boost::ref(queue), make_request(log, 3)));
+	BOOST_ASSERT(pusher.timed_join(boost::posix_time::millisec(200)) == false);
+	guard.fulfill();
+	// request 2 either runs, or is dropped once request 1 is out of the wrapped queue
+	do
+	{
+		queue.get_request()->run();
+	}while(log.back() != 3);
+	pusher.join();
+	BOOST_ASSERT(queue.empty());
+	BOOST_ASSERT(log.size() == 3);
+}
+
+// a range is pushed whole or not at all
+void range_test()
+{
+	poet::bounded_activation_queue queue(boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue),
+		3, poet::bounded_activation_queue::fail_on_overflow);
+	std::vector<int> log;
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	requests.push_back(make_request(log, 1));
+	requests.push_back(make_request(log, 2));
+	queue.push_back_range(requests);
+	BOOST_ASSERT(queue.size() == 2);
+	requests.clear();
+	requests.push_back(make_request(log, 3));
+	requests.push_back(make_request(log, 4));
+	try
+	{
+		queue.push_back_range(requests);
+		BOOST_ASSERT(false);
+	}
+	catch(const poet::queue_full &)
+	{}
+	BOOST_ASSERT(queue.size() == 2);
+	queue.get_request()->run();
+	queue.push_back_range(requests);
+	BOOST_ASSERT(queue.size() == 3);
+	while(queue.empty() == false)
+	{
+		queue.get_request()->run();
+	}
+	static const int expected[] = {1, 2, 3, 4};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 4));
+
+	// a range larger than the capacity never fits
+	requests.push_back(make_request(log, 5));
+	requests.push_back(make_request(log, 6));
+	try
+	{
+		queue.push_back_range(requests);
+		BOOST_ASSERT(false);
+	}
+	catch(const poet::queue_full &)
+	{}
+	BOOST_ASSERT(queue.empty());
+}
+
+void block_test()
+{
+	poet::bounded_activation_queue queue(boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue), 1);
+	BOOST_ASSERT(queue.policy() == poet::bounded_activation_queue::block_on_overflow);
+	std::vector<int> log;
+	queue.push_back(make_request(log, 1));
+	boost::thread pusher(boost::bind(&push, boost::ref(queue), make_request(log, 2)));
+	BOOST_ASSERT(pusher.timed_join(boost::posix_time::millisec(200)) == false);
+	BOOST_ASSERT(queue.size() == 1);
+	queue.get_request()->run();
+	pusher.join();
+	queue.get_request()->run();
+	static const int expected[] = {1, 2};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 2));
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	fail_test();
+	drop_oldest_test();
+	drop_custom_request_test();
+	block_test();
+	dropped_backlog_test();
+	range_test();
+
+	std::cerr << "OK\n";
+	return 0;
+}
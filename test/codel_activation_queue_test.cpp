@@ -0,0 +1,156 @@
+/*
+	A test program for codel_activation_queue.
+*/
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <vector>
+
+// fulfills a promise when run, and reneges on it when cancelled if cancellable
+class fulfill_request: public poet::method_request_base
+{
+public:
+	fulfill_request(const poet::promise<int> &result, int value, bool cancellable):
+		_result(result), _value(value), _cancellable(cancellable)
+	{}
+	virtual void run()
+	{
+		_result.fulfill(_value);
+	}
+	virtual void cancel(const poet::exception_ptr &exception)
+	{
+		BOOST_ASSERT(_cancellable);
+		_result.renege(exception);
+	}
+	virtual bool cancellable() const
+	{
+		return _cancellable;
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(1);
+	}
+private:
+	poet::promise<int> _result;
+	int _value;
+	bool _cancellable;
+};
+
+int identity(int value)
+{
+	return value;
+}
+
+int slow_identity(int value)
+{
+	boost::this_thread::sleep(boost::posix_time::millisec(5));
+	return value;
+}
+
+// a consumer which keeps up never has requests dropped
+void light_load_test()
+{
+	boost::shared_ptr<poet::codel_activation_queue> queue(new poet::codel_activation_queue(
+		boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue)));
+	BOOST_ASSERT(queue->target() == boost::posix_time::milliseconds(5));
+	BOOST_ASSERT(queue->interval() == boost::posix_time::milliseconds(100));
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler(queue));
+	poet::active_function<int (int)> func(&identity, scheduler);
+	int i;
+	for(i = 0; i < 100; ++i)
+	{
+		BOOST_ASSERT(func(i).get() == i);
+	}
+	BOOST_ASSERT(queue->drop_count() == 0);
+}
+
+// sustained overload gets some requests shed, which bounds the queueing delay
+void overload_test()
+{
+	static const int num_calls = 200;
+	boost::shared_ptr<poet::codel_activation_queue> queue(new poet::codel_activation_queue(
+		boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue),
+		boost::posix_time::milliseconds(2), boost::posix_time::milliseconds(20)));
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler(queue));
+	poet::active_function<int (int)> func(&slow_identity, scheduler);
+	std::vector<poet::future<int> > results;
+	int i;
+	for(i = 0; i < num_calls; ++i)
+	{
+		results.push_back(func(i));
+	}
+	const boost::system_time start = boost::get_system_time();
+	unsigned dropped = 0;
+	for(i = 0; i < num_calls; ++i)
+	{
+		try
+		{
+			BOOST_ASSERT(results.at(i).get() == i);
+		}
+		catch(const poet::overloaded &)
+		{
+			++dropped;
+		}
+	}
+	// the first requests are run before the queue decides it is overloaded
+	BOOST_ASSERT(results.front().has_exception() == false);
+	BOOST_ASSERT(dropped > 0);
+	BOOST_ASSERT(dropped == queue->drop_count());
+	// running all of them would take at least a second
+	BOOST_ASSERT(boost::get_system_time() - start < boost::posix_time::milliseconds(5 * num_calls));
+}
+
+// requests which aren't cancellable are kept even while the queue is dropping
+void uncancellable_test()
+{
+	static const int num_requests = 6;
+	poet::codel_activation_queue queue(boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue),
+		boost::posix_time::milliseconds(1), boost::posix_time::milliseconds(10));
+	// not results(num_requests), which would copy one promise into every element
+	std::vector<poet::promise<int> > results;
+	int i;
+	for(i = 0; i < num_requests; ++i) results.push_back(poet::promise<int>());
+	for(i = 0; i < num_requests; ++i)
+	{
+		// only requests 2 and 4 are cancellable
+		queue.push_back(boost::shared_ptr<poet::method_request_base>(
+			new fulfill_request(results.at(i), i, i == 2 || i == 4)));
+	}
+	boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	// starts the clock on the waits staying above target
+	BOOST_ASSERT(queue.try_get_requests(requests, 1) == 1);
+	boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+	while(queue.empty() == false)
+	{
+		queue.try_get_requests(requests, 1);
+	}
+	for(i = 0; i < static_cast<int>(requests.size()); ++i)
+	{
+		requests.at(i)->run();
+	}
+	// request 2 is the first one CoDel can drop after the interval
+	BOOST_ASSERT(poet::future<int>(results.at(2)).has_exception());
+	BOOST_ASSERT(queue.drop_count() >= 1);
+	for(i = 0; i < num_requests; ++i)
+	{
+		if(i == 2 || i == 4) continue;
+		BOOST_ASSERT(poet::future<int>(results.at(i)).get() == i);
+	}
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	light_load_test();
+	overload_test();
+	uncancellable_test();
+
+	std::cerr << "OK\n";
+	return 0;
+}
@@ -0,0 +1,142 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/assert.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/coroutine.hpp>
+#include <poet/exceptions.hpp>
+#include <stdexcept>
+#include <vector>
+
+boost::thread::id scheduler_thread_id;
+
+poet::task<boost::thread::id> get_thread_id()
+{
+	co_return boost::this_thread::get_id();
+}
+
+poet::task<int> add(poet::future<int> a, poet::future<int> b, poet::promise<void> started)
+{
+	started.fulfill();
+	const int a_value = co_await a;
+	BOOST_ASSERT(boost::this_thread::get_id() == scheduler_thread_id);
+	const int b_value = co_await b;
+	BOOST_ASSERT(boost::this_thread::get_id() == scheduler_thread_id);
+	co_return a_value + b_value;
+}
+
+/* Many tasks suspended at once on a single scheduler thread, each resumed
+on the scheduler thread when main fulfills its inputs. */
+void interleave_test()
+{
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler);
+	scheduler_thread_id = poet::spawn(scheduler, get_thread_id()).get();
+	BOOST_ASSERT(scheduler_thread_id != boost::this_thread::get_id());
+
+	static const int num_tasks = 1000;
+	// pushed one at a time, sizing the vectors would copy one promise into every element
+	std::vector<poet::promise<int> > a_promises;
+	std::vector<poet::promise<int> > b_promises;
+	std::vector<poet::future<void> > started;
+	std::vector<poet::future<int> > results;
+	int i;
+	for(i = 0; i < num_tasks; ++i)
+	{
+		a_promises.push_back(poet::promise<int>());
+		b_promises.push_back(poet::promise<int>());
+		poet::promise<void> started_promise;
+		started.push_back(started_promise);
+		results.push_back(poet::spawn(scheduler, add(a_promises.at(i), b_promises.at(i), started_promise)));
+	}
+	// every task gets going even though none of them can finish yet
+	for(i = 0; i < num_tasks; ++i)
+	{
+		started.at(i).get();
+		BOOST_ASSERT(results.at(i).ready() == false);
+	}
+	for(i = num_tasks - 1; i >= 0; --i)
+	{
+		b_promises.at(i).fulfill(i);
+		a_promises.at(i).fulfill(1);
+	}
+	for(i = 0; i < num_tasks; ++i)
+	{
+		BOOST_ASSERT(results.at(i).get() == i + 1);
+	}
+}
+
+poet::task<void> throw_after(poet::future<int> f)
+{
+	co_await f;
+	throw std::runtime_error("task failed");
+}
+
+poet::task<int> rethrow(poet::future<int> f)
+{
+	const int value = co_await f;
+	co_return value;
+}
+
+// exceptions escaping a task, or carried by an awaited future, end up in the task's future
+void exception_test()
+{
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler);
+	poet::promise<int> p;
+	poet::future<void> result = poet::spawn(scheduler, throw_after(p));
+	p.fulfill(0);
+	try
+	{
+		result.get();
+		BOOST_ASSERT(false);
+	}
+	catch(const std::runtime_error &)
+	{}
+
+	poet::promise<int> reneged;
+	poet::future<int> rethrown = poet::spawn(scheduler, rethrow(reneged));
+	reneged.renege(std::runtime_error("input failed"));
+	try
+	{
+		rethrown.get();
+		BOOST_ASSERT(false);
+	}
+	catch(const std::runtime_error &)
+	{}
+}
+
+// a task suspended on a scheduler which gets killed is destroyed instead of leaking
+void kill_test()
+{
+	poet::promise<int> never;
+	poet::future<int> result;
+	{
+		boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler);
+		poet::promise<int> p;
+		result = poet::spawn(scheduler, rethrow(p));
+		scheduler->kill();
+		scheduler->join();
+		p.fulfill(1);
+	}
+	try
+	{
+		result.get();
+		BOOST_ASSERT(false);
+	}
+	catch(const poet::uncertain_future &)
+	{}
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	interleave_test();
+	exception_test();
+	kill_test();
+
+	std::cerr << "OK" << std::endl;
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+	A test program for deadline_activation_queue.
+*/
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <vector>
+
+// appends its id to a log when run
+class log_request: public poet::method_request_base
+{
+public:
+	log_request(std::vector<int> &log, int id):
+		_log(log), _id(id)
+	{}
+	virtual void run()
+	{
+		_log.push_back(_id);
+	}
+	virtual void cancel(const poet::exception_ptr &)
+	{
+		_log.push_back(-_id);
+	}
+	virtual bool cancellable() const
+	{
+		return true;
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(1);
+	}
+private:
+	std::vector<int> &_log;
+	int _id;
+};
+
+// fulfills a promise when run, and doesn't override cancel()
+class fulfill_request: public poet::method_request_base
+{
+public:
+	fulfill_request(const poet::promise<int> &result, int value):
+		_result(result), _value(value)
+	{}
+	virtual void run()
+	{
+		_result.fulfill(_value);
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(1);
+	}
+protected:
+	poet::promise<int> _result;
+	int _value;
+};
+
+// reneges on its promise when cancelled
+class cancellable_fulfill_request: public fulfill_request
+{
+public:
+	cancellable_fulfill_request(const poet::promise<int> &result, int value):
+		fulfill_request(result, value)
+	{}
+	virtual void cancel(const poet::exception_ptr &exception)
+	{
+		_result.renege(exception);
+	}
+	virtual bool cancellable() const
+	{
+		return true;
+	}
+};
+
+void earliest_deadline_first_test()
+{
+	poet::deadline_activation_queue queue;
+	BOOST_ASSERT(queue.sheds_late_requests() == false);
+	std::vector<int> log;
+	const boost::system_time now = boost::get_system_time();
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 1)), now + boost::posix_time::seconds(3));
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 2)));
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 3)), now + boost::posix_time::seconds(1));
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 4)), now - boost::posix_time::seconds(1));
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 5)), now + boost::posix_time::seconds(1));
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	BOOST_ASSERT(queue.get_requests(requests, 10) == 5);
+	BOOST_ASSERT(queue.empty());
+	unsigned i;
+	for(i = 0; i < requests.size(); ++i) requests.at(i)->run();
+	// late requests still run when not shedding, and no deadline sorts last
+	static const int expected[] = {4, 3, 5, 1, 2};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 5));
+}
+
+void shedding_test()
+{
+	poet::deadline_activation_queue queue(true);
+	std::vector<int> log;
+	const boost::system_time now = boost::get_system_time();
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 1)), now - boost::posix_time::seconds(2));
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 2)), now + boost::posix_time::seconds(10));
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 3)), now - boost::posix_time::seconds(1));
+	queue.get_request()->run();
+	BOOST_ASSERT(queue.empty());
+	static const int expected[] = {-1, -3, 2};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 3));
+	queue.wake();
+	BOOST_ASSERT(!queue.get_request());
+}
+
+// a late request which can't be cancelled is still returned, so nothing waits on it forever
+void uncancellable_test()
+{
+	poet::deadline_activation_queue queue(true);
+	const boost::system_time late = boost::get_system_time() - boost::posix_time::seconds(1);
+	poet::promise<int> first;
+	poet::promise<int> second;
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new fulfill_request(first, 1)), late);
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new cancellable_fulfill_request(second, 2)), late);
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	BOOST_ASSERT(queue.try_get_requests(requests, 10) == 1);
+	BOOST_ASSERT(queue.empty());
+	requests.front()->run();
+	BOOST_ASSERT(poet::future<int>(first).get() == 1);
+	try
+	{
+		poet::future<int>(second).get();
+		BOOST_ASSERT(false);
+	}
+	catch(const poet::deadline_expired &)
+	{}
+}
+
+int slow_identity(int value)
+{
+	boost::this_thread::sleep(boost::posix_time::millisec(200));
+	return value;
+}
+
+void active_function_timeout_test()
+{
+	boost::shared_ptr<poet::activation_queue_base> queue(new poet::deadline_activation_queue(true));
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler(queue));
+	poet::active_function<int (int)> func(&slow_identity, scheduler);
+	func.set_timeout(boost::posix_time::millisec(100));
+	BOOST_ASSERT(func.timeout() == boost::posix_time::millisec(100));
+	poet::future<int> first = func(1);
+	// still queued behind the first call when its 100ms deadline passes
+	poet::future<int> second = func(2);
+	BOOST_ASSERT(first.get() == 1);
+	try
+	{
+		second.get();
+		BOOST_ASSERT(false);
+	}
+	catch(const poet::deadline_expired &)
+	{}
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	earliest_deadline_first_test();
+	shedding_test();
+	uncancellable_test();
+	active_function_timeout_test();
+
+	std::cerr << "OK\n";
+	return 0;
+}
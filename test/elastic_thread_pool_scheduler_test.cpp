@@ -0,0 +1,188 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/assert.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <poet/elastic_thread_pool_scheduler.hpp>
+#include <vector>
+
+int identity(int value)
+{
+	return value;
+}
+
+int block_in_region(const poet::future<int> &external)
+{
+	poet::blocking_region region;
+	// nested regions only count once
+	poet::blocking_region nested;
+	return external.get();
+}
+
+int block_on_future(const poet::future<int> &external)
+{
+	return external.get();
+}
+
+bool has_size(const poet::elastic_pool_snapshot &snapshot, unsigned num_threads, unsigned num_blocked)
+{
+	return snapshot.num_threads == num_threads && snapshot.num_blocked == num_blocked;
+}
+
+// polls the pool's snapshot until it has the given size, or gives up after 10 seconds
+bool wait_for_size(const poet::elastic_thread_pool_scheduler &pool, unsigned num_threads, unsigned num_blocked)
+{
+	const boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(10);
+	while(has_size(pool.snapshot(), num_threads, num_blocked) == false)
+	{
+		if(boost::get_system_time() > deadline) return false;
+		boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+	}
+	return true;
+}
+
+poet::elastic_pool_attributes single_thread_attributes()
+{
+	poet::elastic_pool_attributes attributes;
+	attributes.set_core_threads(1);
+	attributes.set_max_threads(3);
+	attributes.set_wait_threshold(boost::posix_time::seconds(60));
+	attributes.set_idle_timeout(boost::posix_time::milliseconds(50));
+	return attributes;
+}
+
+/* With one core thread, a second method request can only run while the first is blocked
+if the pool makes up for the blocked thread. */
+void blocking_test(int (*blocker)(const poet::future<int> &))
+{
+	poet::elastic_pool_attributes attributes = single_thread_attributes();
+	attributes.set_grow_while_waiting(true);
+	boost::shared_ptr<poet::elastic_thread_pool_scheduler> pool(new poet::elastic_thread_pool_scheduler(attributes));
+	BOOST_ASSERT(pool->num_threads() == 1);
+	poet::active_function<int (int)> quick(&identity, pool);
+
+	poet::promise<int> external;
+	poet::active_function<int ()> blocking(boost::bind(blocker, poet::future<int>(external)), pool);
+	poet::future<int> blocked_result = blocking();
+	BOOST_ASSERT(quick(1).get() == 1);
+	poet::elastic_pool_snapshot snapshot = pool->snapshot();
+	BOOST_ASSERT(snapshot.num_threads == 2);
+	BOOST_ASSERT(snapshot.num_blocked == 1);
+	BOOST_ASSERT(snapshot.grown_for_blocking == 1);
+	BOOST_ASSERT(snapshot.peak_threads == 2);
+	BOOST_ASSERT(blocked_result.ready() == false);
+
+	external.fulfill(2);
+	BOOST_ASSERT(blocked_result.get() == 2);
+	// the extra thread exits once the pool is idle
+	BOOST_ASSERT(wait_for_size(*pool, 1, 0));
+	snapshot = pool->snapshot();
+	BOOST_ASSERT(snapshot.num_blocked == 0);
+	BOOST_ASSERT(snapshot.shrunk == 1);
+
+	// and a thread is added again the next time
+	poet::promise<int> second_external;
+	blocking = poet::active_function<int ()>(boost::bind(blocker, poet::future<int>(second_external)), pool);
+	blocked_result = blocking();
+	BOOST_ASSERT(quick(3).get() == 3);
+	second_external.fulfill(4);
+	BOOST_ASSERT(blocked_result.get() == 4);
+	BOOST_ASSERT(pool->snapshot().grown_for_blocking == 2);
+}
+
+void slow(int milliseconds)
+{
+	boost::this_thread::sleep(boost::posix_time::milliseconds(milliseconds));
+}
+
+// blocks without the pool knowing, until released
+void stall_until(const boost::shared_ptr<boost::atomic<bool> > &released)
+{
+	while(released->load() == false)
+	{
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	}
+}
+
+// a request which doesn't declare that it blocks still gets help once the queue stalls
+void wait_threshold_test()
+{
+	poet::elastic_pool_attributes attributes = single_thread_attributes();
+	attributes.set_wait_threshold(boost::posix_time::milliseconds(20));
+	boost::shared_ptr<poet::elastic_thread_pool_scheduler> pool(new poet::elastic_thread_pool_scheduler(attributes));
+	boost::shared_ptr<boost::atomic<bool> > released(new boost::atomic<bool>(false));
+	poet::active_function<void ()> stuck(boost::bind(&stall_until, released), pool);
+	poet::active_function<int (int)> quick(&identity, pool);
+
+	poet::future<void> stuck_result = stuck();
+	poet::future<int> quick_result = quick(1);
+	// the only core thread is stuck, so quick can only run on a thread grown for the wait
+	BOOST_ASSERT(quick_result.timed_join(boost::get_system_time() + boost::posix_time::seconds(10)));
+	BOOST_ASSERT(quick_result.get() == 1);
+	BOOST_ASSERT(stuck_result.ready() == false);
+	const poet::elastic_pool_snapshot snapshot = pool->snapshot();
+	BOOST_ASSERT(snapshot.grown_for_wait >= 1);
+	BOOST_ASSERT(snapshot.num_threads <= attributes.get_max_threads());
+	released->store(true);
+	stuck_result.get();
+}
+
+void max_threads_test()
+{
+	boost::shared_ptr<poet::elastic_thread_pool_scheduler> pool(
+		new poet::elastic_thread_pool_scheduler(single_thread_attributes()));
+	poet::promise<int> external;
+	poet::active_function<int ()> blocking(boost::bind(&block_in_region, poet::future<int>(external)), pool);
+	std::vector<poet::future<int> > results;
+	int i;
+	for(i = 0; i < 5; ++i) results.push_back(blocking());
+	BOOST_ASSERT(wait_for_size(*pool, 3, 3));
+	// it never grows past max_threads
+	BOOST_ASSERT(pool->snapshot().peak_threads == 3);
+	external.fulfill(5);
+	for(i = 0; i < 5; ++i) BOOST_ASSERT(results.at(i).get() == 5);
+}
+
+void kill_join_test()
+{
+	poet::elastic_thread_pool_scheduler pool(single_thread_attributes());
+	BOOST_ASSERT(pool.running_in_this_thread() == false);
+	pool.kill();
+	pool.join();
+}
+
+// requests already posted still run after the scheduler is destroyed
+void detach_test()
+{
+	poet::future<int> result;
+	{
+		boost::shared_ptr<poet::elastic_thread_pool_scheduler> pool(
+			new poet::elastic_thread_pool_scheduler(single_thread_attributes()));
+		poet::active_function<void (int)> sleeper(&slow, pool);
+		poet::active_function<int (int)> quick(&identity, pool);
+		sleeper(100);
+		result = quick(6);
+	}
+	BOOST_ASSERT(result.get() == 6);
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	blocking_test(&block_in_region);
+	blocking_test(&block_on_future);
+	wait_threshold_test();
+	max_threads_test();
+	kill_join_test();
+	detach_test();
+
+	std::cerr << "OK" << std::endl;
+	return 0;
+}
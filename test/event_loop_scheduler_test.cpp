@@ -0,0 +1,231 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <poet/event_loop_scheduler.hpp>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// waits up to timeout_ms for fd to become readable
+bool readable(int fd, int timeout_ms)
+{
+	pollfd entry;
+	entry.fd = fd;
+	entry.events = POLLIN;
+	entry.revents = 0;
+	return ::poll(&entry, 1, timeout_ms) == 1;
+}
+
+boost::thread::id current_thread_id(int)
+{
+	return boost::this_thread::get_id();
+}
+
+void post_calls(const poet::active_function<boost::thread::id (int)> &af, std::vector<poet::future<boost::thread::id> > &results)
+{
+	int i;
+	for(i = 0; i < 100; ++i) results.push_back(af(i));
+}
+
+/* Method requests posted from another thread wake up the host loop, and run on the
+host loop's thread. */
+void host_loop_test()
+{
+	boost::shared_ptr<poet::event_loop_scheduler> scheduler(new poet::event_loop_scheduler);
+	poet::active_function<boost::thread::id (int)> af(&current_thread_id, scheduler);
+	BOOST_ASSERT(readable(scheduler->ready_fd(), 0) == false);
+
+	std::vector<poet::future<boost::thread::id> > results;
+	boost::thread poster(boost::bind(&post_calls, boost::cref(af), boost::ref(results)));
+	unsigned num_run = 0;
+	while(num_run < 100)
+	{
+		BOOST_ASSERT(readable(scheduler->ready_fd(), 10000));
+		num_run += scheduler->run_ready();
+	}
+	poster.join();
+	BOOST_ASSERT(num_run == 100);
+	unsigned i;
+	for(i = 0; i < results.size(); ++i)
+	{
+		BOOST_ASSERT(results.at(i).get() == boost::this_thread::get_id());
+	}
+	BOOST_ASSERT(readable(scheduler->ready_fd(), 0) == false);
+}
+
+// run_ready runs at most max_requests, and leaves the fd readable if more are ready
+void max_requests_test()
+{
+	boost::shared_ptr<poet::event_loop_scheduler> scheduler(new poet::event_loop_scheduler);
+	poet::active_function<boost::thread::id (int)> af(&current_thread_id, scheduler);
+	std::vector<poet::future<boost::thread::id> > results;
+	int i;
+	for(i = 0; i < 10; ++i) results.push_back(af(i));
+	BOOST_ASSERT(scheduler->run_ready(3) == 3);
+	BOOST_ASSERT(readable(scheduler->ready_fd(), 0));
+	BOOST_ASSERT(scheduler->run_ready(3) == 3);
+	BOOST_ASSERT(scheduler->run_ready(3) == 3);
+	BOOST_ASSERT(scheduler->run_ready(3) == 1);
+	BOOST_ASSERT(scheduler->run_ready() == 0);
+	BOOST_ASSERT(readable(scheduler->ready_fd(), 0) == false);
+}
+
+int identity(int value)
+{
+	return value;
+}
+
+void fulfill(poet::promise<int> &input, int value)
+{
+	input.fulfill(value);
+}
+
+// a request with an unready argument signals the fd when its argument becomes ready
+void guard_test()
+{
+	boost::shared_ptr<poet::event_loop_scheduler> scheduler(new poet::event_loop_scheduler);
+	poet::active_function<int (int)> af(&identity, scheduler);
+	poet::promise<int> input;
+	poet::future<int> result = af(input);
+	scheduler->run_ready();
+	BOOST_ASSERT(readable(scheduler->ready_fd(), 50) == false);
+	BOOST_ASSERT(result.ready() == false);
+
+	boost::thread fulfiller(boost::bind(&fulfill, input, 1));
+	BOOST_ASSERT(readable(scheduler->ready_fd(), 10000));
+	BOOST_ASSERT(scheduler->run_ready() == 1);
+	BOOST_ASSERT(result.get() == 1);
+	fulfiller.join();
+}
+
+void fulfill_after(boost::barrier &start, poet::promise<int> input, int value)
+{
+	start.wait();
+	input.fulfill(value);
+}
+
+/* A scheduling guard which completes while its request is being posted still makes the fd
+readable, whichever of the two finishes first. */
+void concurrent_guard_test(const boost::shared_ptr<poet::activation_queue_base> &queue)
+{
+	boost::shared_ptr<poet::event_loop_scheduler> scheduler(new poet::event_loop_scheduler(queue));
+	poet::active_function<int (int)> af(&identity, scheduler);
+	int i;
+	for(i = 0; i < 1000; ++i)
+	{
+		poet::promise<int> input;
+		boost::barrier start(2);
+		boost::thread fulfiller(boost::bind(&fulfill_after, boost::ref(start), input, i));
+		start.wait();
+		poet::future<int> result = af(input);
+		while(result.ready() == false)
+		{
+			BOOST_ASSERT(readable(scheduler->ready_fd(), 10000));
+			scheduler->run_ready();
+		}
+		BOOST_ASSERT(result.get() == i);
+		fulfiller.join();
+	}
+}
+
+class echo_session
+{
+public:
+	echo_session(int fd): _fd(fd)
+	{}
+	void on_readable()
+	{
+		char buffer[64];
+		const ssize_t num_read = read(_fd, buffer, sizeof(buffer));
+		if(num_read > 0) _received.append(buffer, num_read);
+	}
+	const std::string& received() const {return _received;}
+private:
+	int _fd;
+	std::string _received;
+};
+
+// fd callbacks and method requests both run from poll(), on the host loop's thread
+void watch_fd_test()
+{
+	int sockets[2];
+	BOOST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+	boost::shared_ptr<poet::event_loop_scheduler> scheduler(new poet::event_loop_scheduler);
+	echo_session session(sockets[0]);
+	scheduler->watch_fd(sockets[0], boost::bind(&echo_session::on_readable, &session));
+	BOOST_ASSERT(readable(scheduler->poll_fd(), 0) == false);
+
+	BOOST_ASSERT(write(sockets[1], "hello", 5) == 5);
+	BOOST_ASSERT(readable(scheduler->poll_fd(), 10000));
+	BOOST_ASSERT(scheduler->poll() == 1);
+	BOOST_ASSERT(session.received() == "hello");
+
+	poet::active_function<int (int)> af(&identity, scheduler);
+	poet::future<int> result = af(2);
+	BOOST_ASSERT(readable(scheduler->poll_fd(), 10000));
+	BOOST_ASSERT(scheduler->poll() == 1);
+	BOOST_ASSERT(result.get() == 2);
+
+	scheduler->unwatch_fd(sockets[0]);
+	BOOST_ASSERT(write(sockets[1], "again", 5) == 5);
+	BOOST_ASSERT(readable(scheduler->poll_fd(), 50) == false);
+	BOOST_ASSERT(scheduler->poll() == 0);
+	BOOST_ASSERT(session.received() == "hello");
+
+	// works with pipes too
+	int pipe_fds[2];
+	BOOST_ASSERT(pipe(pipe_fds) == 0);
+	echo_session pipe_session(pipe_fds[0]);
+	scheduler->watch_fd(pipe_fds[0], boost::bind(&echo_session::on_readable, &pipe_session));
+	BOOST_ASSERT(write(pipe_fds[1], "piped", 5) == 5);
+	BOOST_ASSERT(readable(scheduler->poll_fd(), 10000));
+	BOOST_ASSERT(scheduler->poll() == 1);
+	BOOST_ASSERT(pipe_session.received() == "piped");
+	scheduler->unwatch_fd(pipe_fds[0]);
+
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+	close(sockets[0]);
+	close(sockets[1]);
+}
+
+void kill_test()
+{
+	boost::shared_ptr<poet::event_loop_scheduler> scheduler(new poet::event_loop_scheduler);
+	poet::active_function<int (int)> af(&identity, scheduler);
+	poet::future<int> result = af(1);
+	scheduler->kill();
+	scheduler->join();
+	// a killed scheduler doesn't leave a level-triggered host loop spinning
+	BOOST_ASSERT(readable(scheduler->ready_fd(), 0) == false);
+	BOOST_ASSERT(scheduler->run_ready() == 0);
+	BOOST_ASSERT(result.ready() == false);
+	af(2);
+	BOOST_ASSERT(readable(scheduler->ready_fd(), 0) == false);
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	host_loop_test();
+	max_requests_test();
+	guard_test();
+	concurrent_guard_test(boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue));
+	concurrent_guard_test(boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue));
+	concurrent_guard_test(boost::shared_ptr<poet::activation_queue_base>(new poet::priority_activation_queue));
+	watch_fd_test();
+	kill_test();
+
+	std::cerr << "OK" << std::endl;
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+	A test program for in_order_activation_queue.
+*/
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_object.hpp>
+#include <vector>
+
+static const unsigned num_producers = 4;
+static const unsigned requests_per_producer = 10000;
+
+// records the order requests were run in for each producer
+class sequence_request: public poet::method_request_base
+{
+public:
+	sequence_request(std::vector<unsigned> &last_sequence, unsigned producer, unsigned sequence,
+		const poet::future<void> &guard):
+		_last_sequence(last_sequence), _producer(producer), _sequence(sequence), _guard(guard)
+	{}
+	virtual void run()
+	{
+		BOOST_ASSERT(_last_sequence.at(_producer) + 1 == _sequence);
+		_last_sequence.at(_producer) = _sequence;
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return _guard;
+	}
+private:
+	std::vector<unsigned> &_last_sequence;
+	unsigned _producer;
+	unsigned _sequence;
+	poet::future<void> _guard;
+};
+
+void produce(poet::in_order_activation_queue &queue, std::vector<unsigned> &last_sequence, unsigned producer)
+{
+	unsigned i;
+	for(i = 1; i <= requests_per_producer; ++i)
+	{
+		queue.push_back(boost::shared_ptr<poet::method_request_base>(
+			new sequence_request(last_sequence, producer, i, poet::future<int>(1))));
+	}
+}
+
+void multiple_producer_test()
+{
+	poet::in_order_activation_queue queue;
+	std::vector<unsigned> last_sequence(num_producers, 0);
+	boost::thread_group producers;
+	unsigned i;
+	for(i = 0; i < num_producers; ++i)
+	{
+		producers.create_thread(boost::bind(&produce, boost::ref(queue), boost::ref(last_sequence), i));
+	}
+	for(i = 0; i < num_producers * requests_per_producer; ++i)
+	{
+		boost::shared_ptr<poet::method_request_base> request = queue.get_request();
+		BOOST_ASSERT(request);
+		request->run();
+	}
+	producers.join_all();
+	BOOST_ASSERT(queue.empty());
+	for(i = 0; i < num_producers; ++i)
+	{
+		BOOST_ASSERT(last_sequence.at(i) == requests_per_producer);
+	}
+}
+
+void fulfill_later(poet::promise<void> promise)
+{
+	boost::this_thread::sleep(boost::posix_time::millisec(100));
+	promise.fulfill();
+}
+
+// a request whose scheduling guard isn't ready blocks the requests behind it
+void blocked_front_test()
+{
+	poet::in_order_activation_queue queue;
+	std::vector<unsigned> last_sequence(1, 0);
+	poet::promise<void> guard;
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new sequence_request(last_sequence, 0, 1, guard)));
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new sequence_request(last_sequence, 0, 2, poet::future<int>(1))));
+	BOOST_ASSERT(queue.size() == 2);
+	boost::thread fulfiller(boost::bind(&fulfill_later, guard));
+	guard = poet::promise<void>();
+	unsigned i;
+	for(i = 0; i < 2; ++i)
+	{
+		boost::shared_ptr<poet::method_request_base> request = queue.get_request();
+		BOOST_ASSERT(request);
+		request->run();
+	}
+	BOOST_ASSERT(last_sequence.at(0) == 2);
+	BOOST_ASSERT(queue.empty());
+	fulfiller.join();
+}
+
+void wake_test()
+{
+	poet::in_order_activation_queue queue;
+	queue.wake();
+	BOOST_ASSERT(!queue.get_request());
+	std::vector<unsigned> last_sequence(1, 0);
+	poet::promise<void> guard;
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new sequence_request(last_sequence, 0, 1, guard)));
+	queue.wake();
+	BOOST_ASSERT(!queue.get_request());
+	BOOST_ASSERT(queue.size() == 1);
+}
+
+void get_requests_test()
+{
+	poet::in_order_activation_queue queue;
+	std::vector<unsigned> last_sequence(1, 0);
+	poet::promise<void> guard;
+	unsigned i;
+	for(i = 1; i <= 5; ++i)
+	{
+		const poet::future<void> request_guard = i == 4 ? poet::future<void>(guard) : poet::future<void>(poet::future<int>(1));
+		queue.push_back(boost::shared_ptr<poet::method_request_base>(new sequence_request(last_sequence, 0, i, request_guard)));
+	}
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	BOOST_ASSERT(queue.get_requests(requests, 2) == 2);
+	// stops at the request whose scheduling guard is not complete
+	BOOST_ASSERT(queue.get_requests(requests, 10) == 1);
+	BOOST_ASSERT(requests.size() == 3);
+	guard.fulfill();
+	BOOST_ASSERT(queue.get_requests(requests, 10) == 2);
+	BOOST_ASSERT(queue.empty());
+	for(i = 0; i < requests.size(); ++i)
+	{
+		requests.at(i)->run();
+	}
+	BOOST_ASSERT(last_sequence.at(0) == 5);
+	queue.wake();
+	BOOST_ASSERT(queue.get_requests(requests, 10) == 0);
+}
+
+void batched_scheduler_test()
+{
+	boost::shared_ptr<poet::in_order_activation_queue> queue(new poet::in_order_activation_queue);
+	poet::scheduler_attributes attributes;
+	attributes.set_batch_size(16);
+	poet::scheduler scheduler(queue, attributes);
+	std::vector<unsigned> last_sequence(1, 0);
+	unsigned i;
+	for(i = 1; i <= requests_per_producer; ++i)
+	{
+		scheduler.post_method_request(boost::shared_ptr<poet::method_request_base>(
+			new sequence_request(last_sequence, 0, i, poet::future<int>(1))));
+	}
+	while(queue->empty() == false) boost::this_thread::yield();
+	scheduler.kill();
+	scheduler.join();
+	BOOST_ASSERT(last_sequence.at(0) + 16 >= requests_per_producer);
+}
+
+// a batch pushed with push_back_range keeps its order, and still waits on a blocked front
+void push_back_range_test()
+{
+	poet::in_order_activation_queue queue;
+	std::vector<unsigned> last_sequence(1, 0);
+	poet::promise<void> guard;
+	std::vector<boost::shared_ptr<poet::method_request_base> > batch;
+	unsigned i;
+	for(i = 1; i <= 100; ++i)
+	{
+		const poet::future<void> request_guard = i == 50 ? poet::future<void>(guard) : poet::future<void>(poet::future<int>(1));
+		batch.push_back(boost::shared_ptr<poet::method_request_base>(new sequence_request(last_sequence, 0, i, request_guard)));
+	}
+	queue.push_back_range(batch.begin(), batch.end());
+	BOOST_ASSERT(queue.size() == 100);
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	BOOST_ASSERT(queue.get_requests(requests, 1000) == 49);
+	guard.fulfill();
+	BOOST_ASSERT(queue.get_requests(requests, 1000) == 51);
+	for(i = 0; i < requests.size(); ++i)
+	{
+		requests.at(i)->run();
+	}
+	BOOST_ASSERT(last_sequence.at(0) == 100);
+
+	// through a scheduler
+	boost::shared_ptr<poet::in_order_activation_queue> scheduler_queue(new poet::in_order_activation_queue);
+	poet::scheduler scheduler(scheduler_queue);
+	last_sequence.at(0) = 0;
+	batch.clear();
+	for(i = 1; i <= requests_per_producer; ++i)
+	{
+		batch.push_back(boost::shared_ptr<poet::method_request_base>(
+			new sequence_request(last_sequence, 0, i, poet::future<int>(1))));
+	}
+	scheduler.post_method_requests(batch.begin(), batch.end());
+	while(scheduler_queue->empty() == false) boost::this_thread::yield();
+	scheduler.kill();
+	scheduler.join();
+	BOOST_ASSERT(last_sequence.at(0) + 1 >= requests_per_producer);
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	multiple_producer_test();
+	blocked_front_test();
+	wake_test();
+	get_requests_test();
+	batched_scheduler_test();
+	push_back_range_test();
+
+	std::cerr << "OK\n";
+	return 0;
+}
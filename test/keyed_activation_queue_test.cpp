@@ -0,0 +1,152 @@
+/*
+	A test program for keyed_activation_queue.
+*/
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <vector>
+
+// appends its id to a log when run
+class log_request: public poet::method_request_base
+{
+public:
+	log_request(std::vector<int> &log, int id, const poet::future<void> &guard):
+		_log(log), _id(id), _guard(guard)
+	{}
+	virtual void run()
+	{
+		_log.push_back(_id);
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return _guard;
+	}
+private:
+	std::vector<int> &_log;
+	int _id;
+	poet::future<void> _guard;
+};
+
+boost::shared_ptr<poet::method_request_base> make_request(std::vector<int> &log, int id,
+	const poet::future<void> &guard)
+{
+	return boost::shared_ptr<poet::method_request_base>(new log_request(log, id, guard));
+}
+
+void run_ready(poet::activation_queue_base &queue)
+{
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	queue.try_get_requests(requests, 100);
+	unsigned i;
+	for(i = 0; i < requests.size(); ++i) requests.at(i)->run();
+}
+
+// a request which isn't ready only holds up the requests with the same key
+void ordering_test()
+{
+	poet::keyed_activation_queue queue;
+	std::vector<int> log;
+	const poet::future<void> ready = poet::future<int>(1);
+	poet::promise<void> first_guard;
+	poet::promise<void> unkeyed_guard;
+	queue.push_back(make_request(log, 1, first_guard), 10);
+	queue.push_back(make_request(log, 2, ready), 10);
+	queue.push_back(make_request(log, 3, ready), 20);
+	queue.push_back(make_request(log, 4, unkeyed_guard));
+	queue.push_back(make_request(log, 5, ready));
+	queue.push_back(make_request(log, 6, ready), 20);
+	BOOST_ASSERT(queue.size() == 6);
+
+	run_ready(queue);
+	static const int expected_ready[] = {3, 5, 6};
+	BOOST_ASSERT(log == std::vector<int>(expected_ready, expected_ready + 3));
+	BOOST_ASSERT(queue.size() == 3);
+
+	// a later request with the same key still waits for the earlier one
+	queue.push_back(make_request(log, 7, ready), 10);
+	run_ready(queue);
+	BOOST_ASSERT(log.size() == 3);
+
+	first_guard.fulfill();
+	run_ready(queue);
+	static const int expected_key[] = {3, 5, 6, 1, 2, 7};
+	BOOST_ASSERT(log == std::vector<int>(expected_key, expected_key + 6));
+
+	unkeyed_guard.fulfill();
+	BOOST_ASSERT(queue.get_request());
+	BOOST_ASSERT(queue.empty());
+}
+
+// a later request whose guard completes first still waits its turn
+void guard_order_test()
+{
+	poet::keyed_activation_queue queue;
+	std::vector<int> log;
+	poet::promise<void> first_guard;
+	poet::promise<void> second_guard;
+	std::vector<boost::shared_ptr<poet::method_request_base> > batch;
+	batch.push_back(make_request(log, 1, first_guard));
+	batch.push_back(make_request(log, 2, second_guard));
+	batch.push_back(make_request(log, 3, poet::future<int>(1)));
+	int i;
+	for(i = 0; i < 3; ++i) batch.at(i)->set_ordering_key(5);
+	queue.push_back_range(batch);
+	BOOST_ASSERT(queue.size() == 3);
+	second_guard.fulfill();
+	run_ready(queue);
+	BOOST_ASSERT(log.empty());
+	first_guard.fulfill();
+	run_ready(queue);
+	static const int expected[] = {1, 2, 3};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 3));
+	BOOST_ASSERT(queue.empty());
+}
+
+int deposit(int amount)
+{
+	return amount;
+}
+
+// per-account ordering with active_function copies which each have their own key
+void active_function_test()
+{
+	boost::shared_ptr<poet::keyed_activation_queue> queue(new poet::keyed_activation_queue);
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler(queue));
+	poet::active_function<int (int)> account(&deposit, scheduler);
+	poet::active_function<int (int)> first_account = account;
+	first_account.set_ordering_key(1);
+	poet::active_function<int (int)> second_account = account;
+	second_account.set_ordering_key(2);
+	BOOST_ASSERT(account.ordering_key() == boost::none);
+	BOOST_ASSERT(first_account.ordering_key() == std::size_t(1));
+
+	poet::promise<int> slow_input;
+	poet::future<int> first = first_account(poet::future<int>(slow_input));
+	poet::future<int> second = first_account(2);
+	poet::future<int> other = second_account(3);
+	poet::future<int> unordered = account(4);
+	BOOST_ASSERT(other.get() == 3);
+	BOOST_ASSERT(unordered.get() == 4);
+	boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+	BOOST_ASSERT(second.ready() == false);
+	slow_input.fulfill(1);
+	BOOST_ASSERT(second.get() == 2);
+	BOOST_ASSERT(first.ready());
+	BOOST_ASSERT(first.get() == 1);
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	ordering_test();
+	guard_order_test();
+	active_function_test();
+
+	std::cerr << "OK\n";
+	return 0;
+}
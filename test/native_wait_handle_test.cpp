@@ -0,0 +1,160 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/future.hpp>
+#include <poet/future_select.hpp>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// waits up to timeout_ms for fd to become readable
+bool readable(int fd, int timeout_ms)
+{
+	pollfd entry;
+	entry.fd = fd;
+	entry.events = POLLIN;
+	entry.revents = 0;
+	return ::poll(&entry, 1, timeout_ms) == 1;
+}
+
+void fulfill_later(poet::promise<int> &p, int value)
+{
+	boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+	p.fulfill(value);
+}
+
+void future_test()
+{
+	// fulfilled from another thread
+	{
+		poet::promise<int> p;
+		poet::future<int> f = p;
+		const int fd = f.native_wait_handle();
+		BOOST_ASSERT(fd >= 0);
+		BOOST_ASSERT(f.native_wait_handle() == fd);
+		poet::future<int> copy = f;
+		BOOST_ASSERT(copy.native_wait_handle() == fd);
+		BOOST_ASSERT(readable(fd, 0) == false);
+		boost::thread fulfiller(boost::bind(&fulfill_later, p, 1));
+		BOOST_ASSERT(readable(fd, 10000));
+		BOOST_ASSERT(f.get() == 1);
+		// stays readable
+		BOOST_ASSERT(readable(fd, 0));
+		fulfiller.join();
+	}
+	// reneged
+	{
+		poet::promise<int> p;
+		poet::future<int> f = p;
+		const int fd = f.native_wait_handle();
+		p.renege(std::runtime_error("reneged"));
+		BOOST_ASSERT(readable(fd, 0));
+	}
+	// promise destroyed without being fulfilled
+	{
+		poet::future<int> f;
+		int fd;
+		{
+			poet::promise<int> p;
+			f = p;
+			fd = f.native_wait_handle();
+			BOOST_ASSERT(readable(fd, 0) == false);
+		}
+		BOOST_ASSERT(readable(fd, 0));
+	}
+	// already complete, or uncertain
+	{
+		poet::future<int> ready(2);
+		BOOST_ASSERT(readable(ready.native_wait_handle(), 0));
+		poet::future<int> uncertain;
+		BOOST_ASSERT(readable(uncertain.native_wait_handle(), 0));
+	}
+	// void and converted futures
+	{
+		poet::promise<int> p;
+		poet::future<void> void_future = p;
+		poet::future<double> converted = poet::future<int>(p);
+		const int void_fd = void_future.native_wait_handle();
+		const int converted_fd = converted.native_wait_handle();
+		BOOST_ASSERT(readable(void_fd, 0) == false);
+		BOOST_ASSERT(readable(converted_fd, 0) == false);
+		p.fulfill(3);
+		BOOST_ASSERT(readable(void_fd, 0));
+		BOOST_ASSERT(readable(converted_fd, 0));
+		BOOST_ASSERT(converted.get() == 3.);
+	}
+}
+
+// one epoll_wait covers a socket and a future
+void epoll_test()
+{
+	int sockets[2];
+	BOOST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+	poet::promise<int> p;
+	poet::future<int> f = p;
+	const int epoll_fd = epoll_create1(0);
+	BOOST_ASSERT(epoll_fd >= 0);
+	epoll_event event = epoll_event();
+	event.events = EPOLLIN;
+	event.data.fd = sockets[0];
+	BOOST_ASSERT(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockets[0], &event) == 0);
+	event.data.fd = f.native_wait_handle();
+	BOOST_ASSERT(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, f.native_wait_handle(), &event) == 0);
+
+	epoll_event ready;
+	BOOST_ASSERT(epoll_wait(epoll_fd, &ready, 1, 0) == 0);
+	boost::thread fulfiller(boost::bind(&fulfill_later, p, 4));
+	BOOST_ASSERT(epoll_wait(epoll_fd, &ready, 1, 10000) == 1);
+	BOOST_ASSERT(ready.data.fd == f.native_wait_handle());
+	BOOST_ASSERT(f.get() == 4);
+	fulfiller.join();
+
+	BOOST_ASSERT(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, f.native_wait_handle(), 0) == 0);
+	BOOST_ASSERT(write(sockets[1], "x", 1) == 1);
+	BOOST_ASSERT(epoll_wait(epoll_fd, &ready, 1, 10000) == 1);
+	BOOST_ASSERT(ready.data.fd == sockets[0]);
+
+	close(epoll_fd);
+	close(sockets[0]);
+	close(sockets[1]);
+}
+
+void selector_test()
+{
+	poet::future_selector<int> selector;
+	poet::promise<int> first;
+	poet::promise<int> second;
+	selector.push(first);
+	selector.push(second);
+	const int fd = selector.native_wait_handle();
+	BOOST_ASSERT(readable(fd, 0) == false);
+	second.fulfill(2);
+	BOOST_ASSERT(readable(fd, 0));
+	BOOST_ASSERT(selector.selected().get() == 2);
+
+	selector.pop_selected();
+	const int next_fd = selector.native_wait_handle();
+	BOOST_ASSERT(readable(next_fd, 0) == false);
+	first.fulfill(1);
+	BOOST_ASSERT(readable(next_fd, 0));
+	BOOST_ASSERT(selector.selected().get() == 1);
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	future_test();
+	epoll_test();
+	selector_test();
+
+	std::cerr << "OK" << std::endl;
+	return 0;
+}
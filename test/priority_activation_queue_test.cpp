@@ -0,0 +1,242 @@
+/*
+	A test program for priority_activation_queue.
+*/
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <vector>
+
+// appends its id to a log when run
+class log_request: public poet::method_request_base
+{
+public:
+	log_request(std::vector<int> &log, int id, const poet::future<void> &guard):
+		_log(log), _id(id), _guard(guard)
+	{}
+	virtual void run()
+	{
+		_log.push_back(_id);
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return _guard;
+	}
+private:
+	std::vector<int> &_log;
+	int _id;
+	poet::future<void> _guard;
+};
+
+void run_all(poet::activation_queue_base &queue)
+{
+	while(queue.empty() == false)
+	{
+		boost::shared_ptr<poet::method_request_base> request = queue.get_request();
+		BOOST_ASSERT(request);
+		request->run();
+	}
+}
+
+void ordering_test()
+{
+	poet::priority_activation_queue queue;
+	std::vector<int> log;
+	const poet::future<void> ready = poet::future<int>(1);
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 1, ready)), 0);
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 2, ready)), 10);
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 3, ready)), 5);
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 4, ready)), 10);
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 5, ready)), -1);
+	BOOST_ASSERT(queue.size() == 5);
+	run_all(queue);
+	static const int expected[] = {2, 4, 3, 1, 5};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 5));
+}
+
+// a batch is ordered by priority, then by its order in the batch
+void push_back_range_test()
+{
+	poet::priority_activation_queue queue;
+	std::vector<int> log;
+	const poet::future<void> ready = poet::future<int>(1);
+	poet::promise<void> guard;
+	static const int priorities[] = {0, 10, 5, 10, -1, 20};
+	std::vector<boost::shared_ptr<poet::method_request_base> > batch;
+	int i;
+	for(i = 0; i < 6; ++i)
+	{
+		batch.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, i + 1, i == 5 ? poet::future<void>(guard) : ready)));
+		batch.back()->set_priority(priorities[i]);
+	}
+	queue.push_back_range(batch);
+	BOOST_ASSERT(queue.size() == 6);
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	BOOST_ASSERT(queue.get_requests(requests, 10) == 5);
+	guard.fulfill();
+	BOOST_ASSERT(queue.get_requests(requests, 10) == 1);
+	BOOST_ASSERT(queue.empty());
+	for(i = 0; i < 6; ++i) requests.at(i)->run();
+	static const int expected[] = {2, 4, 3, 1, 5, 6};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 6));
+}
+
+// a high priority request which isn't ready doesn't block lower priority ones
+void pending_guard_test()
+{
+	poet::priority_activation_queue queue;
+	std::vector<int> log;
+	poet::promise<void> guard;
+	const poet::future<void> ready = poet::future<int>(1);
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 1, guard)), 10);
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 2, ready)), 0);
+	queue.push_back(boost::shared_ptr<poet::method_request_base>(new log_request(log, 3, ready)), 0);
+	queue.get_request()->run();
+	BOOST_ASSERT(log.size() == 1 && log.back() == 2);
+	guard.fulfill();
+	run_all(queue);
+	static const int expected[] = {2, 1, 3};
+	BOOST_ASSERT(log == std::vector<int>(expected, expected + 3));
+}
+
+// only called from the scheduler thread
+std::vector<int> call_log;
+
+int identity(int value)
+{
+	call_log.push_back(value);
+	return value;
+}
+
+void block(poet::future<void> gate)
+{
+	gate.get();
+}
+
+void active_function_test()
+{
+	boost::shared_ptr<poet::priority_activation_queue> queue(new poet::priority_activation_queue);
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler(queue));
+	poet::active_function<void (poet::future<void>)> blocker(&block, scheduler);
+	poet::active_function<int (int)> background(&identity, scheduler);
+	poet::active_function<int (int)> interactive(&identity, scheduler);
+	interactive.set_priority(1);
+	BOOST_ASSERT(interactive.priority() == 1);
+
+	// keep the scheduler thread busy while the queue fills up
+	poet::promise<void> gate;
+	blocker(poet::future<void>(gate));
+	while(queue->empty() == false) boost::this_thread::yield();
+	std::vector<poet::future<int> > background_results;
+	unsigned i;
+	for(i = 0; i < 10; ++i)
+	{
+		background_results.push_back(background(i));
+	}
+	poet::future<int> interactive_result = interactive(100);
+	gate.fulfill();
+	BOOST_ASSERT(interactive_result.get() == 100);
+	for(i = 0; i < background_results.size(); ++i)
+	{
+		BOOST_ASSERT(background_results.at(i).get() == static_cast<int>(i));
+	}
+	// the interactive call jumped ahead of the background calls queued before it
+	BOOST_ASSERT(call_log.size() == 11);
+	BOOST_ASSERT(call_log.front() == 100);
+}
+
+int negate(int value)
+{
+	call_log.push_back(-value);
+	return -value;
+}
+
+void wait_with_priority(const poet::future<int> &result, int priority)
+{
+	poet::scoped_wait_priority wait_priority(priority);
+	result.get();
+}
+
+// the priority of the method request which will fulfill f
+int producer_priority(const poet::future<int> &f)
+{
+	const boost::intrusive_ptr<poet::detail::priority_inheritor> producer =
+		poet::detail::get_future_body(f)->producer();
+	BOOST_ASSERT(producer);
+	return dynamic_cast<poet::method_request_base &>(*producer).priority();
+}
+
+/* A thread waiting on a result lends its priority to the request producing it, and through
+that request's scheduling guard, to the request producing its input. */
+void inheritance_test()
+{
+	call_log.clear();
+	boost::shared_ptr<poet::priority_activation_queue> queue(new poet::priority_activation_queue);
+	boost::shared_ptr<poet::scheduler> scheduler(new poet::scheduler(queue));
+	poet::promise<void> gate;
+	poet::active_function<void ()> blocker(boost::bind(&block, poet::future<void>(gate)), scheduler);
+	poet::active_function<int (int)> background(&identity, scheduler);
+	poet::active_function<int (int)> consumer(&negate, scheduler);
+
+	blocker();
+	while(queue->empty() == false) boost::this_thread::yield();
+	std::vector<poet::future<int> > background_results;
+	int i;
+	for(i = 0; i < 10; ++i)
+	{
+		background_results.push_back(background(i));
+	}
+	poet::future<int> input = background(100);
+	poet::future<int> result = consumer(input);
+	boost::thread waiter(boost::bind(&wait_with_priority, result, 5));
+	// the waiter has lent its priority to both requests once it starts waiting
+	while(producer_priority(input) < 5) boost::this_thread::yield();
+	BOOST_ASSERT(producer_priority(result) == 5);
+	gate.fulfill();
+	waiter.join();
+	BOOST_ASSERT(result.get() == -100);
+	for(i = 0; i < 10; ++i)
+	{
+		BOOST_ASSERT(background_results.at(i).get() == i);
+	}
+	BOOST_ASSERT(call_log.size() == 12);
+	BOOST_ASSERT(call_log.at(0) == 100);
+	BOOST_ASSERT(call_log.at(1) == -100);
+	BOOST_ASSERT(call_log.at(2) == 0);
+}
+
+bool lends_wait_priority()
+{
+	return poet::detail::current_wait_priority().get() != 0;
+}
+
+// requests only lend their priority to the futures they wait on when it matters
+void lending_test()
+{
+	boost::shared_ptr<poet::scheduler> plain_scheduler(new poet::scheduler);
+	poet::active_function<bool ()> plain(&lends_wait_priority, plain_scheduler);
+	BOOST_ASSERT(plain().get() == false);
+	boost::shared_ptr<poet::scheduler> priority_scheduler(
+		new poet::scheduler(boost::shared_ptr<poet::activation_queue_base>(new poet::priority_activation_queue)));
+	poet::active_function<bool ()> prioritized(&lends_wait_priority, priority_scheduler);
+	BOOST_ASSERT(prioritized().get());
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	ordering_test();
+	push_back_range_test();
+	pending_guard_test();
+	active_function_test();
+	inheritance_test();
+	lending_test();
+
+	std::cerr << "OK\n";
+	return 0;
+}
@@ -0,0 +1,292 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/assert.hpp>
+#include <boost/atomic.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <poet/active_function.hpp>
+#include <poet/detail/recycling_allocator.hpp>
+#include <vector>
+
+// counts every operator new in the program, from any thread
+boost::atomic<unsigned long> allocation_count(0);
+// counts the calling thread's operator new calls
+thread_local unsigned long thread_allocation_count = 0;
+// counts every operator delete of a block, from any thread
+boost::atomic<unsigned long> deallocation_count(0);
+
+void* operator new(std::size_t size)
+{
+	++allocation_count;
+	++thread_allocation_count;
+	void *result = std::malloc(size > 0 ? size : 1);
+	if(result == 0) throw std::bad_alloc();
+	return result;
+}
+
+void operator delete(void *p) throw()
+{
+	if(p) ++deallocation_count;
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) throw()
+{
+	if(p) ++deallocation_count;
+	std::free(p);
+}
+
+struct payload
+{
+	char data[40];
+};
+
+// once warmed up, allocating and freeing recycles blocks without calling operator new
+void pool_test()
+{
+	poet::detail::recycling_allocator<payload> allocator;
+	std::vector<payload *> blocks;
+	blocks.reserve(1000);
+	unsigned i;
+	for(i = 0; i < 1000; ++i) blocks.push_back(allocator.allocate(1));
+	for(i = 0; i < blocks.size(); ++i) allocator.deallocate(blocks.at(i), 1);
+	blocks.clear();
+
+	const unsigned long before = allocation_count.load();
+	unsigned round;
+	for(round = 0; round < 10; ++round)
+	{
+		for(i = 0; i < 1000; ++i) blocks.push_back(allocator.allocate(1));
+		for(i = 0; i < blocks.size(); ++i) allocator.deallocate(blocks.at(i), 1);
+		blocks.clear();
+	}
+	BOOST_ASSERT(allocation_count.load() == before);
+
+	// shared_ptr control blocks are recycled too
+	boost::shared_ptr<payload> warm = boost::allocate_shared<payload>(allocator);
+	warm.reset();
+	const unsigned long shared_before = allocation_count.load();
+	for(i = 0; i < 1000; ++i)
+	{
+		boost::shared_ptr<payload> p = boost::allocate_shared<payload>(allocator);
+	}
+	BOOST_ASSERT(allocation_count.load() == shared_before);
+}
+
+struct large_payload
+{
+	char data[200];
+};
+
+// freeing more blocks than the pool keeps gives the excess back to operator delete
+void high_water_test()
+{
+	typedef poet::detail::recycling_pool<poet::detail::recycling_size_class<sizeof(large_payload)>::value> pool_type;
+	const unsigned num_blocks = 2 * pool_type::max_shared_blocks;
+	poet::detail::recycling_allocator<large_payload> allocator;
+	std::vector<large_payload *> blocks;
+	blocks.reserve(num_blocks);
+	unsigned i;
+	for(i = 0; i < num_blocks; ++i) blocks.push_back(allocator.allocate(1));
+	const unsigned long before = deallocation_count.load();
+	for(i = 0; i < blocks.size(); ++i) allocator.deallocate(blocks.at(i), 1);
+	// this thread keeps at most max_cached_blocks, and the shared list at most max_shared_blocks
+	const unsigned long kept = pool_type::max_cached_blocks + pool_type::max_shared_blocks;
+	BOOST_ASSERT(deallocation_count.load() - before >= num_blocks - kept);
+}
+
+void free_blocks(const std::vector<payload *> &blocks)
+{
+	poet::detail::recycling_allocator<payload> allocator;
+	unsigned i;
+	for(i = 0; i < blocks.size(); ++i) allocator.deallocate(blocks.at(i), 1);
+}
+
+// blocks freed by another thread find their way back to the allocating thread
+void cross_thread_test()
+{
+	poet::detail::recycling_allocator<payload> allocator;
+	std::vector<payload *> blocks;
+	unsigned round;
+	unsigned long steady_allocations = 0;
+	for(round = 0; round < 20; ++round)
+	{
+		const unsigned long before = allocation_count.load();
+		unsigned i;
+		for(i = 0; i < 1000; ++i) blocks.push_back(allocator.allocate(1));
+		if(round >= 10) steady_allocations += allocation_count.load() - before;
+		boost::thread freer(boost::bind(&free_blocks, boost::cref(blocks)));
+		freer.join();
+		blocks.clear();
+	}
+	// the freeing threads keep at most max_cached_blocks each, and hand those back when they exit
+	BOOST_ASSERT(steady_allocations == 0);
+}
+
+int increment(int value)
+{
+	return value + 1;
+}
+
+// a method request written the usual way, for comparison
+class increment_request: public poet::method_request_base
+{
+public:
+	increment_request(const poet::promise<int> &result, int value): _result(result), _value(value)
+	{}
+	virtual void run()
+	{
+		_result.fulfill(increment(_value));
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::detail::ready_scheduling_guard();
+	}
+private:
+	poet::promise<int> _result;
+	int _value;
+};
+
+/* Returns how many times this thread called operator new while creating the method requests.
+The scheduler thread frees them, so the pooled blocks have to find their way back. */
+unsigned long count_request_allocations(const boost::shared_ptr<poet::scheduler_base> &scheduler, bool pooled)
+{
+	static const int num_calls = 1000;
+	unsigned long count = 0;
+	int i;
+	for(i = 0; i < num_calls; ++i)
+	{
+		poet::promise<int> result;
+		boost::shared_ptr<poet::method_request_base> request;
+		const unsigned long before = thread_allocation_count;
+		if(pooled)
+		{
+			request = boost::allocate_shared<increment_request>(
+				poet::detail::recycling_allocator<increment_request>(), result, i);
+		}else
+		{
+			request.reset(new increment_request(result, i));
+		}
+		count += thread_allocation_count - before;
+		scheduler->post_method_request(request);
+		request.reset();
+		BOOST_ASSERT(poet::future<int>(result).get() == i + 1);
+	}
+	return count;
+}
+
+/* Allocating a method request from the pool, with its shared_ptr control block in the same
+block, doesn't call operator new at all in steady state, while allocating it with new and giving
+it a separate control block calls it twice. */
+void method_request_test()
+{
+	boost::shared_ptr<poet::scheduler_base> scheduler(new poet::scheduler);
+	// warm up the pool with a burst of requests
+	{
+		std::vector<boost::shared_ptr<poet::method_request_base> > burst;
+		int i;
+		for(i = 0; i < 1000; ++i)
+		{
+			burst.push_back(boost::allocate_shared<increment_request>(
+				poet::detail::recycling_allocator<increment_request>(), poet::promise<int>(), i));
+		}
+	}
+	count_request_allocations(scheduler, true);
+	BOOST_ASSERT(count_request_allocations(scheduler, true) == 0);
+	BOOST_ASSERT(count_request_allocations(scheduler, false) == 2 * 1000);
+}
+
+int add(int a, int b)
+{
+	return a + b;
+}
+
+// a burst of calls, so the pool has plenty of every block a call needs
+void warm_up(const poet::active_function<int (int)> &inc, const poet::active_function<int (int, int)> &sum)
+{
+	std::vector<poet::future<int> > results;
+	int i;
+	for(i = 0; i < 1000; ++i)
+	{
+		results.push_back(inc(i));
+		results.push_back(sum(i, 1));
+	}
+	for(i = 0; i < 1000; ++i)
+	{
+		BOOST_ASSERT(results.at(2 * i).get() == i + 1);
+		BOOST_ASSERT(results.at(2 * i + 1).get() == i + 1);
+	}
+}
+
+/* In steady state, calling an active function with arguments which are ready doesn't call
+operator new at all: not for the argument futures, the promise and future of the result, nor
+the method request. */
+void active_function_test()
+{
+	boost::shared_ptr<poet::scheduler_base> scheduler(new poet::scheduler);
+	poet::active_function<int (int)> inc(&increment, scheduler);
+	poet::active_function<int (int, int)> sum(&add, scheduler);
+	warm_up(inc, sum);
+	unsigned long count = 0;
+	int i;
+	for(i = 0; i < 10000; ++i)
+	{
+		const unsigned long before = thread_allocation_count;
+		poet::future<int> inc_result = inc(i);
+		poet::future<int> sum_result = sum(i, 2);
+		count += thread_allocation_count - before;
+		BOOST_ASSERT(inc_result.get() == i + 1);
+		BOOST_ASSERT(sum_result.get() == i + 2);
+	}
+	BOOST_ASSERT(count == 0);
+}
+
+/* A result future only points back at the method request which fulfills it, so holding on
+to the result doesn't keep the request's block from being recycled. */
+void held_result_test()
+{
+	boost::shared_ptr<poet::scheduler_base> scheduler(new poet::scheduler);
+	poet::active_function<int (int)> inc(&increment, scheduler);
+	poet::active_function<int (int, int)> sum(&add, scheduler);
+	warm_up(inc, sum);
+	static const int num_calls = 5000;
+	// the held results need more future bodies than the warm up left in the pool
+	{
+		std::vector<poet::future<int> > values;
+		int i;
+		for(i = 0; i < 2 * num_calls; ++i) values.push_back(poet::future<int>(i));
+	}
+	std::vector<poet::future<int> > results;
+	results.reserve(num_calls);
+	unsigned long count = 0;
+	int i;
+	for(i = 0; i < num_calls; ++i)
+	{
+		const unsigned long before = thread_allocation_count;
+		results.push_back(inc(i));
+		count += thread_allocation_count - before;
+		BOOST_ASSERT(results.back().get() == i + 1);
+	}
+	BOOST_ASSERT(count == 0);
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	pool_test();
+	high_water_test();
+	cross_thread_test();
+	method_request_test();
+	active_function_test();
+	held_result_test();
+
+	std::cerr << "OK" << std::endl;
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+	A test program for histogram and scheduler_statistics.
+*/
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <poet/scheduler_statistics.hpp>
+#include <vector>
+
+void bucket_test()
+{
+	typedef poet::histogram::value_type value_type;
+	unsigned last_index = 0;
+	value_type value;
+	for(value = 0; value < 100000; ++value)
+	{
+		const unsigned index = poet::histogram::bucket_index(value);
+		// buckets are contiguous and each value is at least the lower bound of its bucket
+		BOOST_ASSERT(index == last_index || index == last_index + 1);
+		BOOST_ASSERT(poet::histogram::bucket_lower_bound(index) <= value);
+		BOOST_ASSERT(poet::histogram::bucket_lower_bound(index + 1) > value);
+		// relative error is bounded by the number of sub-buckets
+		BOOST_ASSERT((value - poet::histogram::bucket_lower_bound(index)) * poet::histogram::sub_buckets <= value);
+		last_index = index;
+	}
+	const value_type max_value = ~static_cast<value_type>(0);
+	BOOST_ASSERT(poet::histogram::bucket_index(max_value) == poet::histogram::num_buckets - 1);
+}
+
+void snapshot_test()
+{
+	poet::histogram hist;
+	BOOST_ASSERT(hist.snapshot().count() == 0);
+	unsigned i;
+	for(i = 1; i <= 100; ++i)
+	{
+		hist.record(i);
+	}
+	const poet::histogram_snapshot snapshot = hist.snapshot();
+	BOOST_ASSERT(snapshot.count() == 100);
+	BOOST_ASSERT(snapshot.sum() == 5050);
+	BOOST_ASSERT(snapshot.max() == 100);
+	BOOST_ASSERT(snapshot.mean() == 50.5);
+	const poet::histogram::value_type median = snapshot.percentile(0.5);
+	BOOST_ASSERT(median >= 44 && median <= 51);
+	poet::histogram::value_type total = 0;
+	for(i = 0; i < snapshot.buckets().size(); ++i)
+	{
+		total += snapshot.buckets().at(i).second;
+	}
+	BOOST_ASSERT(total == 100);
+}
+
+int sleepy(int value)
+{
+	boost::this_thread::sleep(boost::posix_time::millisec(10));
+	return value;
+}
+
+void scheduler_test()
+{
+	static const int num_calls = 20;
+	boost::shared_ptr<poet::scheduler_statistics> statistics(new poet::scheduler_statistics);
+	poet::scheduler_attributes attributes;
+	attributes.set_statistics(statistics);
+	boost::shared_ptr<poet::scheduler_base> scheduler(new poet::thread_pool_scheduler(2,
+		boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue), attributes));
+	poet::active_function<int (int)> func(&sleepy, scheduler);
+	std::vector<poet::future<int> > results;
+	int i;
+	for(i = 0; i < num_calls; ++i)
+	{
+		results.push_back(func(i));
+	}
+	for(i = 0; i < num_calls; ++i)
+	{
+		BOOST_ASSERT(results.at(i).get() == i);
+	}
+	// the last result may become ready before its run() call returns
+	scheduler->kill();
+	scheduler->join();
+	const poet::scheduler_statistics_snapshot snapshot = statistics->snapshot();
+	BOOST_ASSERT(snapshot.run_time.count() == num_calls);
+	BOOST_ASSERT(snapshot.run_time.mean() >= 10000);
+	BOOST_ASSERT(snapshot.queue_wait.count() == num_calls);
+	// the last requests waited behind the others
+	BOOST_ASSERT(snapshot.queue_wait.max() >= 10000 * (num_calls / 2 - 1));
+	BOOST_ASSERT(snapshot.wakeups >= num_calls);
+	BOOST_ASSERT(snapshot.queue_depth.count() == snapshot.wakeups);
+	BOOST_ASSERT(snapshot.queue_depth.max() > 0);
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	bucket_test();
+	snapshot_test();
+	scheduler_test();
+
+	std::cerr << "OK\n";
+	return 0;
+}
@@ -0,0 +1,149 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/assert.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <poet/exceptions.hpp>
+#include <poet/strand.hpp>
+#include <vector>
+
+/* An unsynchronized servant, which notices if two of its methods ever run at once.
+The strand is all that serializes it. */
+class session
+{
+public:
+	session(): _busy(false), _overlaps(0)
+	{}
+	int append(int value)
+	{
+		if(_busy) ++_overlaps;
+		_busy = true;
+		_values.push_back(value);
+		boost::this_thread::yield();
+		_busy = false;
+		return value;
+	}
+	const std::vector<int>& values() const {return _values;}
+	unsigned overlaps() const {return _overlaps;}
+private:
+	bool _busy;
+	unsigned _overlaps;
+	std::vector<int> _values;
+};
+
+// many strands share a small pool, each runs its requests serially and in order
+void serial_order_test()
+{
+	boost::shared_ptr<poet::thread_pool_scheduler> pool(new poet::thread_pool_scheduler(4));
+	static const unsigned num_sessions = 1000;
+	static const int requests_per_session = 20;
+	std::vector<boost::shared_ptr<session> > sessions;
+	std::vector<poet::active_function<int (int)> > appenders;
+	unsigned i;
+	for(i = 0; i < num_sessions; ++i)
+	{
+		boost::shared_ptr<session> new_session(new session());
+		sessions.push_back(new_session);
+		boost::shared_ptr<poet::strand> new_strand(new poet::strand(pool));
+		BOOST_ASSERT(new_strand->pool() == pool);
+		appenders.push_back(poet::active_function<int (int)>(
+			boost::bind(&session::append, new_session.get(), _1), new_strand));
+	}
+	std::vector<poet::future<int> > results;
+	int j;
+	for(j = 0; j < requests_per_session; ++j)
+	{
+		for(i = 0; i < num_sessions; ++i)
+		{
+			results.push_back(appenders.at(i)(j));
+		}
+	}
+	for(i = 0; i < results.size(); ++i)
+	{
+		results.at(i).get();
+	}
+	for(i = 0; i < num_sessions; ++i)
+	{
+		BOOST_ASSERT(sessions.at(i)->overlaps() == 0);
+		BOOST_ASSERT(sessions.at(i)->values().size() == static_cast<unsigned>(requests_per_session));
+		for(j = 0; j < requests_per_session; ++j)
+		{
+			BOOST_ASSERT(sessions.at(i)->values().at(j) == j);
+		}
+	}
+}
+
+int identity(int value)
+{
+	return value;
+}
+
+/* A request with an unready argument holds up the requests behind it on the same strand,
+but not other strands sharing the pool, even a pool with only one thread. */
+void guard_test()
+{
+	boost::shared_ptr<poet::thread_pool_scheduler> pool(new poet::thread_pool_scheduler(1));
+	boost::shared_ptr<poet::strand> blocked_strand(new poet::strand(pool));
+	boost::shared_ptr<poet::strand> other_strand(new poet::strand(pool));
+	poet::active_function<int (int)> blocked(&identity, blocked_strand);
+	poet::active_function<int (int)> other(&identity, other_strand);
+
+	poet::promise<int> input;
+	poet::future<int> first = blocked(input);
+	poet::future<int> second = blocked(2);
+	BOOST_ASSERT(other(3).get() == 3);
+	boost::this_thread::sleep(boost::posix_time::millisec(100));
+	BOOST_ASSERT(first.ready() == false);
+	BOOST_ASSERT(second.ready() == false);
+	input.fulfill(1);
+	BOOST_ASSERT(second.get() == 2);
+	BOOST_ASSERT(first.get() == 1);
+}
+
+int slow_identity(int value)
+{
+	boost::this_thread::sleep(boost::posix_time::millisec(100));
+	return value;
+}
+
+// killing a strand discards its pending requests but leaves the pool and other strands alone
+void kill_test()
+{
+	boost::shared_ptr<poet::thread_pool_scheduler> pool(new poet::thread_pool_scheduler(2));
+	boost::shared_ptr<poet::strand> killed_strand(new poet::strand(pool));
+	boost::shared_ptr<poet::strand> other_strand(new poet::strand(pool));
+	poet::active_function<int (int)> killed(&slow_identity, killed_strand);
+	poet::active_function<int (int)> other(&identity, other_strand);
+
+	poet::future<int> running = killed(1);
+	poet::future<int> pending = killed(2);
+	boost::this_thread::sleep(boost::posix_time::millisec(50));
+	killed_strand->kill();
+	killed_strand->join();
+	BOOST_ASSERT(running.get() == 1);
+	try
+	{
+		pending.get();
+		BOOST_ASSERT(false);
+	}
+	catch(const poet::uncertain_future &)
+	{}
+	BOOST_ASSERT(other(3).get() == 3);
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	serial_order_test();
+	guard_test();
+	kill_test();
+
+	std::cerr << "OK" << std::endl;
+	return 0;
+}
@@ -0,0 +1,228 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/assert.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <stdexcept>
+#include <poet/active_function.hpp>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+int serial_fib(int n)
+{
+	if(n < 2) return n;
+	return serial_fib(n - 1) + serial_fib(n - 2);
+}
+
+/* Waits on the results of its sub-problems, which deadlocks a pool with fewer threads
+than the recursion is deep, unless its threads help while waiting. */
+class blocking_fib_request: public poet::method_request_base
+{
+public:
+	blocking_fib_request(int n, const poet::promise<int> &result,
+		const boost::shared_ptr<poet::scheduler_base> &scheduler):
+		_n(n), _result(result), _scheduler(scheduler)
+	{}
+	virtual void run()
+	{
+		if(_n < 10)
+		{
+			_result.fulfill(serial_fib(_n));
+			return;
+		}
+		poet::promise<int> a;
+		poet::promise<int> b;
+		_scheduler->post_method_request(boost::shared_ptr<blocking_fib_request>(new blocking_fib_request(_n - 1, a, _scheduler)));
+		_scheduler->post_method_request(boost::shared_ptr<blocking_fib_request>(new blocking_fib_request(_n - 2, b, _scheduler)));
+		_result.fulfill(poet::future<int>(a).get() + poet::future<int>(b).get());
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(0);
+	}
+private:
+	int _n;
+	poet::promise<int> _result;
+	boost::shared_ptr<poet::scheduler_base> _scheduler;
+};
+
+int slow_increment(int value)
+{
+	boost::this_thread::sleep(boost::posix_time::millisec(500));
+	return value + 1;
+}
+
+// requests should run concurrently on the pool threads
+void concurrency_test()
+{
+	static const unsigned num_threads = 4;
+	boost::shared_ptr<poet::thread_pool_scheduler> pool(new poet::thread_pool_scheduler(num_threads));
+	BOOST_ASSERT(pool->num_threads() == num_threads);
+	poet::active_function<int (int)> inc(&slow_increment, pool);
+
+	const boost::system_time start = boost::get_system_time();
+	std::vector<poet::future<int> > results;
+	unsigned i;
+	for(i = 0; i < num_threads; ++i)
+	{
+		results.push_back(inc(i));
+	}
+	for(i = 0; i < results.size(); ++i)
+	{
+		BOOST_ASSERT(results.at(i).get() == static_cast<int>(i + 1));
+	}
+	const boost::posix_time::time_duration elapsed = boost::get_system_time() - start;
+	BOOST_ASSERT(elapsed < boost::posix_time::millisec(500 * num_threads));
+}
+
+// destroying the pool should not prevent already queued requests from running
+void detach_test()
+{
+	std::vector<poet::future<int> > results;
+	{
+		boost::shared_ptr<poet::thread_pool_scheduler> pool(new poet::thread_pool_scheduler(2,
+			boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue)));
+		poet::active_function<int (int)> inc(&slow_increment, pool);
+		unsigned i;
+		for(i = 0; i < 4; ++i)
+		{
+			results.push_back(inc(i));
+		}
+	}
+	unsigned i;
+	for(i = 0; i < results.size(); ++i)
+	{
+		BOOST_ASSERT(results.at(i).get() == static_cast<int>(i + 1));
+	}
+}
+
+void kill_join_test()
+{
+	poet::thread_pool_scheduler pool(3);
+	pool.kill();
+	pool.join();
+}
+
+int increment(int value)
+{
+	return value + 1;
+}
+
+/* Spinning or yielding dispatcher threads should still run every request, account
+for how they found it, and exit promptly when killed or detached. */
+void idle_policy_test(const boost::shared_ptr<poet::activation_queue_base> &queue)
+{
+	boost::shared_ptr<poet::scheduler_statistics> statistics(new poet::scheduler_statistics());
+	poet::scheduler_attributes attributes;
+	attributes.set_spin_duration(boost::posix_time::millisec(50));
+	attributes.set_yield_count(10);
+	attributes.set_statistics(statistics);
+	BOOST_ASSERT(attributes.get_spin_duration() == boost::posix_time::millisec(50));
+	BOOST_ASSERT(attributes.get_yield_count() == 10);
+	{
+		boost::shared_ptr<poet::thread_pool_scheduler> pool(new poet::thread_pool_scheduler(2, queue, attributes));
+		poet::active_function<int (int)> inc(&increment, pool);
+		int i;
+		for(i = 0; i < 20; ++i)
+		{
+			BOOST_ASSERT(inc(i).get() == i + 1);
+		}
+		// long enough for the spinning to give up and park
+		boost::this_thread::sleep(boost::posix_time::millisec(200));
+		BOOST_ASSERT(inc(100).get() == 101);
+	}
+	const poet::scheduler_statistics_snapshot snapshot = statistics->snapshot();
+	BOOST_ASSERT(snapshot.spin_hits + snapshot.yield_hits > 0);
+	BOOST_ASSERT(snapshot.parks > 0);
+
+	const boost::system_time start = boost::get_system_time();
+	poet::thread_pool_scheduler pool(2, queue, attributes);
+	pool.kill();
+	pool.join();
+	BOOST_ASSERT(boost::get_system_time() - start < boost::posix_time::seconds(1));
+}
+
+void help_while_waiting_test(const boost::shared_ptr<poet::activation_queue_base> &queue)
+{
+	static const int n = 20;
+	poet::scheduler_attributes attributes;
+	BOOST_ASSERT(attributes.get_help_while_waiting() == false);
+	attributes.set_help_while_waiting(true);
+	boost::shared_ptr<poet::thread_pool_scheduler> pool(new poet::thread_pool_scheduler(2, queue, attributes));
+	poet::promise<int> result;
+	pool->post_method_request(boost::shared_ptr<blocking_fib_request>(new blocking_fib_request(n, result, pool)));
+	BOOST_ASSERT(poet::future<int>(result).get() == serial_fib(n));
+}
+
+#ifdef __linux__
+int current_cpu()
+{
+	return sched_getcpu();
+}
+
+void affinity_test()
+{
+	poet::scheduler_attributes attributes;
+	BOOST_ASSERT(attributes.get_cpu_set().empty());
+	BOOST_ASSERT(attributes.get_numa_node() == -1);
+	const unsigned last_cpu = boost::thread::hardware_concurrency() - 1;
+	attributes.set_cpu_set(std::vector<unsigned>(1, last_cpu));
+	boost::shared_ptr<poet::scheduler_base> scheduler(new poet::thread_pool_scheduler(2,
+		boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue), attributes));
+	poet::active_function<int ()> func(&current_cpu, scheduler);
+	unsigned i;
+	for(i = 0; i < 10; ++i)
+	{
+		BOOST_ASSERT(func().get() == static_cast<int>(last_cpu));
+	}
+
+	// not every system exposes its NUMA topology
+	bool have_numa_node = true;
+	try
+	{
+		attributes.set_numa_node(0);
+	}
+	catch(const std::invalid_argument &)
+	{
+		have_numa_node = false;
+	}
+	if(have_numa_node)
+	{
+		BOOST_ASSERT(attributes.get_numa_node() == 0);
+		BOOST_ASSERT(attributes.get_cpu_set().empty() == false);
+	}
+	try
+	{
+		attributes.set_numa_node(100000);
+		BOOST_ASSERT(false);
+	}
+	catch(const std::invalid_argument &)
+	{}
+}
+#endif
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	concurrency_test();
+	detach_test();
+	kill_join_test();
+	idle_policy_test(boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue));
+	idle_policy_test(boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue));
+	idle_policy_test(boost::shared_ptr<poet::activation_queue_base>(new poet::priority_activation_queue));
+	help_while_waiting_test(boost::shared_ptr<poet::activation_queue_base>(new poet::out_of_order_activation_queue));
+	help_while_waiting_test(boost::shared_ptr<poet::activation_queue_base>(new poet::in_order_activation_queue));
+#ifdef __linux__
+	affinity_test();
+#endif
+
+	std::cerr << "OK" << std::endl;
+	return 0;
+}
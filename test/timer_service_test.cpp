@@ -0,0 +1,266 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/assert.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <poet/active_object.hpp>
+#include <poet/exceptions.hpp>
+#include <poet/future_select.hpp>
+#include <poet/timer_service.hpp>
+#include <vector>
+
+// drives a timer_wheel by hand, no threads involved
+void wheel_test()
+{
+	poet::detail::timer_wheel wheel;
+	std::vector<boost::shared_ptr<poet::detail::timer_entry> > entries;
+	// spread over all four levels, and beyond
+	const boost::uint64_t expirations[] = {1, 2, 255, 256, 257, 1000, 65535, 65536, 70000,
+		1ULL << 24, (1ULL << 24) + 1, 1ULL << 32, (1ULL << 32) + 5};
+	const unsigned num_entries = sizeof(expirations) / sizeof(expirations[0]);
+	unsigned i;
+	for(i = 0; i < num_entries; ++i)
+	{
+		boost::shared_ptr<poet::detail::timer_entry> entry(
+			new poet::detail::timer_entry(boost::function<void ()>(), expirations[i], 0));
+		entries.push_back(entry);
+		wheel.insert(entry);
+	}
+	BOOST_ASSERT(wheel.size() == num_entries);
+
+	std::vector<boost::shared_ptr<poet::detail::timer_entry> > expired;
+	unsigned next = 0;
+	while(wheel.size() > 0)
+	{
+		const boost::uint64_t wake = wheel.next_wake_tick();
+		BOOST_ASSERT(wake > wheel.current_tick());
+		BOOST_ASSERT(wake <= expirations[next]);
+		wheel.advance(wake, expired);
+		for(i = 0; i < expired.size(); ++i)
+		{
+			BOOST_ASSERT(expired.at(i) == entries.at(next));
+			BOOST_ASSERT(expired.at(i)->expiry == wheel.current_tick());
+			++next;
+		}
+		expired.clear();
+	}
+	BOOST_ASSERT(next == num_entries);
+
+	// removed entries never expire
+	boost::shared_ptr<poet::detail::timer_entry> removed(
+		new poet::detail::timer_entry(boost::function<void ()>(), wheel.current_tick() + 300, 0));
+	wheel.insert(removed);
+	wheel.remove(removed.get());
+	BOOST_ASSERT(wheel.size() == 0);
+	wheel.advance(wheel.current_tick() + 1000, expired);
+	BOOST_ASSERT(expired.empty());
+}
+
+void record_time(boost::system_time &fired, boost::atomic<unsigned> &count)
+{
+	fired = boost::get_system_time();
+	++count;
+}
+
+// timers never fire early, and a cancelled timer doesn't fire at all
+void schedule_test()
+{
+	poet::timer_service service;
+	static const unsigned num_timers = 10;
+	std::vector<boost::system_time> expirations(num_timers);
+	std::vector<boost::system_time> fired(num_timers);
+	boost::atomic<unsigned> count(0);
+	const boost::system_time now = boost::get_system_time();
+	unsigned i;
+	for(i = 0; i < num_timers; ++i)
+	{
+		expirations.at(i) = now + boost::posix_time::milliseconds(10 * (num_timers - i));
+		service.schedule_at(expirations.at(i), boost::bind(&record_time, boost::ref(fired.at(i)), boost::ref(count)));
+	}
+	boost::atomic<unsigned> cancelled_count(0);
+	boost::system_time cancelled_fired;
+	poet::timer_handle cancelled = service.schedule_after(boost::posix_time::milliseconds(50),
+		boost::bind(&record_time, boost::ref(cancelled_fired), boost::ref(cancelled_count)));
+	BOOST_ASSERT(service.size() == num_timers + 1);
+	cancelled.cancel();
+	BOOST_ASSERT(service.size() == num_timers);
+
+	while(count.load() < num_timers) boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	for(i = 0; i < num_timers; ++i)
+	{
+		BOOST_ASSERT(fired.at(i) >= expirations.at(i));
+	}
+	BOOST_ASSERT(cancelled_count.load() == 0);
+	BOOST_ASSERT(service.size() == 0);
+}
+
+class timestamp_request: public poet::method_request_base
+{
+public:
+	timestamp_request(const poet::promise<boost::system_time> &result): _result(result)
+	{}
+	virtual void run()
+	{
+		_result.fulfill(boost::get_system_time());
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::detail::ready_scheduling_guard();
+	}
+private:
+	poet::promise<boost::system_time> _result;
+};
+
+// delayed method requests wait without occupying a scheduler thread
+void post_after_test()
+{
+	boost::shared_ptr<poet::scheduler_base> scheduler(new poet::scheduler);
+	const boost::system_time start = boost::get_system_time();
+	poet::promise<boost::system_time> late;
+	poet::post_after(scheduler, boost::posix_time::milliseconds(200),
+		boost::shared_ptr<poet::method_request_base>(new timestamp_request(late)));
+	poet::promise<boost::system_time> early;
+	poet::post_at(scheduler, start + boost::posix_time::milliseconds(50),
+		boost::shared_ptr<poet::method_request_base>(new timestamp_request(early)));
+	poet::promise<boost::system_time> immediate;
+	scheduler->post_method_request(boost::shared_ptr<poet::method_request_base>(new timestamp_request(immediate)));
+
+	const boost::system_time immediate_time = poet::future<boost::system_time>(immediate).get();
+	const boost::system_time early_time = poet::future<boost::system_time>(early).get();
+	const boost::system_time late_time = poet::future<boost::system_time>(late).get();
+	BOOST_ASSERT(immediate_time < start + boost::posix_time::milliseconds(50));
+	BOOST_ASSERT(early_time >= start + boost::posix_time::milliseconds(50));
+	BOOST_ASSERT(late_time >= start + boost::posix_time::milliseconds(200));
+}
+
+void increment(boost::atomic<unsigned> &count)
+{
+	++count;
+}
+
+// periodic posting repeats until cancelled
+void post_every_test()
+{
+	boost::shared_ptr<poet::scheduler_base> scheduler(new poet::scheduler);
+	boost::atomic<unsigned> count(0);
+	poet::timer_handle periodic = poet::post_every(scheduler, boost::posix_time::milliseconds(10),
+		boost::bind(&increment, boost::ref(count)));
+	while(count.load() < 5) boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	periodic.cancel();
+	// let a request which was already posted finish
+	boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+	const unsigned final_count = count.load();
+	boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+	BOOST_ASSERT(count.load() == final_count);
+}
+
+// delay composes with future_select to make a timeout
+void delay_test()
+{
+	poet::promise<void> never;
+	const boost::system_time start = boost::get_system_time();
+	poet::future<void> timeout = poet::future_select<void>(never, poet::delay(boost::posix_time::milliseconds(100)));
+	timeout.get();
+	BOOST_ASSERT(boost::get_system_time() >= start + boost::posix_time::milliseconds(100));
+
+	poet::promise<void> soon;
+	poet::future<void> first = poet::future_select<void>(soon, poet::delay(boost::posix_time::seconds(100)));
+	BOOST_ASSERT(first.ready() == false);
+	soon.fulfill();
+	BOOST_ASSERT(first.ready());
+}
+
+int slow_identity(int value, boost::atomic<unsigned> &calls)
+{
+	++calls;
+	boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+	return value;
+}
+
+void deadline_test()
+{
+	boost::atomic<unsigned> calls(0);
+	poet::active_function<int (int)> slow(boost::bind(&slow_identity, _1, boost::ref(calls)));
+
+	// a deadline which is met passes the value through
+	poet::future<int> met = poet::with_deadline(slow(1), boost::get_system_time() + boost::posix_time::seconds(10));
+	BOOST_ASSERT(met.get() == 1);
+
+	// a missed deadline doesn't wait for the slow call, and leaves it alone by default
+	const boost::system_time start = boost::get_system_time();
+	poet::future<int> upstream = slow(2);
+	poet::future<int> missed = poet::with_deadline(upstream, start + boost::posix_time::milliseconds(50));
+	try
+	{
+		missed.get();
+		BOOST_ASSERT(false);
+	}
+	catch(const poet::deadline_expired &)
+	{}
+	BOOST_ASSERT(boost::get_system_time() < start + boost::posix_time::milliseconds(190));
+	BOOST_ASSERT(upstream.get() == 2);
+	BOOST_ASSERT(calls.load() == 2);
+
+	// with cancel_upstream, a call which hasn't started yet never runs
+	poet::future<int> running = slow(3);
+	poet::future<int> queued = slow(4);
+	poet::future<int> cancelled = poet::with_deadline(queued, boost::get_system_time() + boost::posix_time::milliseconds(50), true);
+	BOOST_ASSERT(running.get() == 3);
+	BOOST_ASSERT(cancelled.has_exception());
+	BOOST_ASSERT(queued.has_exception());
+	// wait for the scheduler to get past the cancelled request
+	BOOST_ASSERT(slow(5).get() == 5);
+	BOOST_ASSERT(calls.load() == 4);
+
+	// already complete futures are returned as they are
+	BOOST_ASSERT(poet::with_deadline(poet::future<int>(6), boost::get_system_time()).get() == 6);
+}
+
+// lots of pending timers, spread over a few seconds and over every level of the wheel
+void million_timers_test()
+{
+	poet::timer_service service;
+	static const unsigned num_timers = 1000000;
+	boost::atomic<unsigned> count(0);
+	std::vector<poet::timer_handle> cancelled;
+	const boost::system_time now = boost::get_system_time();
+	std::srand(1);
+	unsigned i;
+	for(i = 0; i < num_timers; ++i)
+	{
+		service.schedule_at(now + boost::posix_time::microseconds(std::rand() % 2000000),
+			boost::bind(&increment, boost::ref(count)));
+		if(i % 10 == 0)
+		{
+			cancelled.push_back(service.schedule_at(now + boost::posix_time::hours(1 + i % 1000),
+				boost::bind(&increment, boost::ref(count))));
+		}
+	}
+	for(i = 0; i < cancelled.size(); ++i) cancelled.at(i).cancel();
+	while(count.load() < num_timers) boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	BOOST_ASSERT(service.size() == 0);
+	BOOST_ASSERT(count.load() == num_timers);
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	wheel_test();
+	schedule_test();
+	post_after_test();
+	post_every_test();
+	delay_test();
+	deadline_test();
+	million_timers_test();
+
+	std::cerr << "OK" << std::endl;
+	return 0;
+}
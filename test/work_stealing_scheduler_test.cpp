@@ -0,0 +1,228 @@
+//  Distributed under the Boost Software License, Version 1.0. (See
+//  accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt)
+
+#include <boost/assert.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <functional>
+#include <iostream>
+#include <poet/active_function.hpp>
+#include <poet/work_stealing_scheduler.hpp>
+#include <vector>
+
+int serial_fib(int n)
+{
+	if(n < 2) return n;
+	return serial_fib(n - 1) + serial_fib(n - 2);
+}
+
+class sum_request: public poet::method_request_base
+{
+public:
+	sum_request(const poet::future<int> &a, const poet::future<int> &b, const poet::promise<int> &result):
+		_a(a), _b(b), _result(result)
+	{}
+	virtual void run()
+	{
+		_result.fulfill(_a.get() + _b.get());
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future_barrier(_a, _b);
+	}
+private:
+	poet::future<int> _a;
+	poet::future<int> _b;
+	poet::promise<int> _result;
+};
+
+/* Spawns method requests for the two sub-problems from inside a scheduler
+thread, so they go onto that thread's own deque. */
+class fib_request: public poet::method_request_base
+{
+public:
+	fib_request(int n, const poet::promise<int> &result,
+		const boost::shared_ptr<poet::scheduler_base> &scheduler):
+		_n(n), _result(result), _scheduler(scheduler)
+	{}
+	virtual void run()
+	{
+		if(_n < 10)
+		{
+			_result.fulfill(serial_fib(_n));
+			return;
+		}
+		poet::promise<int> a;
+		poet::promise<int> b;
+		_scheduler->post_method_request(boost::shared_ptr<fib_request>(new fib_request(_n - 1, a, _scheduler)));
+		_scheduler->post_method_request(boost::shared_ptr<fib_request>(new fib_request(_n - 2, b, _scheduler)));
+		_scheduler->post_method_request(boost::shared_ptr<sum_request>(new sum_request(a, b, _result)));
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(0);
+	}
+private:
+	int _n;
+	poet::promise<int> _result;
+	boost::shared_ptr<poet::scheduler_base> _scheduler;
+};
+
+/* Waits on the results of its sub-problems, which deadlocks a pool with fewer threads
+than the recursion is deep, unless its threads help while waiting. */
+class blocking_fib_request: public poet::method_request_base
+{
+public:
+	blocking_fib_request(int n, const poet::promise<int> &result,
+		const boost::shared_ptr<poet::scheduler_base> &scheduler):
+		_n(n), _result(result), _scheduler(scheduler)
+	{}
+	virtual void run()
+	{
+		if(_n < 10)
+		{
+			_result.fulfill(serial_fib(_n));
+			return;
+		}
+		poet::promise<int> a;
+		poet::promise<int> b;
+		_scheduler->post_method_request(boost::shared_ptr<blocking_fib_request>(new blocking_fib_request(_n - 1, a, _scheduler)));
+		_scheduler->post_method_request(boost::shared_ptr<blocking_fib_request>(new blocking_fib_request(_n - 2, b, _scheduler)));
+		_result.fulfill(poet::future<int>(a).get() + poet::future<int>(b).get());
+	}
+	virtual poet::future<void> scheduling_guard() const
+	{
+		return poet::future<int>(0);
+	}
+private:
+	int _n;
+	poet::promise<int> _result;
+	boost::shared_ptr<poet::scheduler_base> _scheduler;
+};
+
+void nested_post_test()
+{
+	static const int n = 20;
+	boost::shared_ptr<poet::work_stealing_scheduler> scheduler(new poet::work_stealing_scheduler(4));
+	BOOST_ASSERT(scheduler->num_threads() == 4);
+	poet::promise<int> result;
+	scheduler->post_method_request(boost::shared_ptr<fib_request>(new fib_request(n, result, scheduler)));
+	BOOST_ASSERT(poet::future<int>(result).get() == serial_fib(n));
+}
+
+void help_while_waiting_test()
+{
+	static const int n = 20;
+	poet::scheduler_attributes attributes;
+	attributes.set_help_while_waiting(true);
+	boost::shared_ptr<poet::work_stealing_scheduler> scheduler(new poet::work_stealing_scheduler(2, attributes));
+	poet::promise<int> result;
+	scheduler->post_method_request(boost::shared_ptr<blocking_fib_request>(new blocking_fib_request(n, result, scheduler)));
+	BOOST_ASSERT(poet::future<int>(result).get() == serial_fib(n));
+}
+
+// a bulk post mixing ready requests with ones still waiting on their inputs
+void bulk_post_test()
+{
+	static const int n = 16;
+	boost::shared_ptr<poet::work_stealing_scheduler> scheduler(new poet::work_stealing_scheduler(4));
+	std::vector<poet::promise<int> > inputs;
+	std::vector<poet::promise<int> > results;
+	std::vector<boost::shared_ptr<poet::method_request_base> > requests;
+	int i;
+	for(i = 0; i < n; ++i)
+	{
+		inputs.push_back(poet::promise<int>());
+		results.push_back(poet::promise<int>());
+		if(i % 2 == 0) inputs.back().fulfill(i);
+		requests.push_back(boost::shared_ptr<sum_request>(new sum_request(poet::future<int>(inputs.back()), poet::future<int>(1), results.back())));
+	}
+	scheduler->post_method_requests(requests);
+	for(i = 0; i < n; i += 2)
+	{
+		BOOST_ASSERT(poet::future<int>(results.at(i)).get() == i + 1);
+	}
+	for(i = 1; i < n; i += 2)
+	{
+		BOOST_ASSERT(poet::future<int>(results.at(i)).ready() == false);
+		inputs.at(i).fulfill(i);
+	}
+	for(i = 1; i < n; i += 2)
+	{
+		BOOST_ASSERT(poet::future<int>(results.at(i)).get() == i + 1);
+	}
+}
+
+int negate(int x)
+{
+	return -x;
+}
+
+// method requests should not run until their inputs are ready
+void scheduling_guard_test()
+{
+	boost::shared_ptr<poet::work_stealing_scheduler> scheduler(new poet::work_stealing_scheduler(2));
+	poet::active_function<int (int)> async_negate(&negate, scheduler);
+	poet::active_function<double (double, double)> async_add((std::plus<double>()), scheduler);
+
+	poet::promise<int> p0;
+	poet::promise<int> p1;
+	poet::future<int> negated = async_negate(p0);
+	// converting future<int> to future<double> creates a lazy proxy future
+	poet::future<double> sum = async_add(poet::future<int>(p1), negated);
+	boost::this_thread::sleep(boost::posix_time::millisec(100));
+	BOOST_ASSERT(negated.ready() == false);
+	BOOST_ASSERT(sum.ready() == false);
+	p0.fulfill(1);
+	BOOST_ASSERT(negated.get() == -1);
+	p1.fulfill(3);
+	BOOST_ASSERT(sum.get() == 2.);
+}
+
+int slow_increment(int value)
+{
+	boost::this_thread::sleep(boost::posix_time::millisec(100));
+	return value + 1;
+}
+
+void detach_test()
+{
+	std::vector<poet::future<int> > results;
+	{
+		boost::shared_ptr<poet::work_stealing_scheduler> scheduler(new poet::work_stealing_scheduler(2));
+		poet::active_function<int (int)> inc(&slow_increment, scheduler);
+		unsigned i;
+		for(i = 0; i < 6; ++i)
+		{
+			results.push_back(inc(i));
+		}
+	}
+	unsigned i;
+	for(i = 0; i < results.size(); ++i)
+	{
+		BOOST_ASSERT(results.at(i).get() == static_cast<int>(i + 1));
+	}
+}
+
+void kill_join_test()
+{
+	poet::work_stealing_scheduler scheduler(3);
+	scheduler.kill();
+	scheduler.join();
+}
+
+int main()
+{
+	std::cerr << __FILE__ << "... ";
+
+	nested_post_test();
+	help_while_waiting_test();
+	bulk_post_test();
+	scheduling_guard_test();
+	detach_test();
+	kill_join_test();
+
+	std::cerr << "OK" << std::endl;
+	return 0;
+}